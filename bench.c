@@ -0,0 +1,240 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/
+/**
+ * @file bench.c
+ * @brief Harness and entry point for the FIFO benchmarks
+ *
+ * Runs the benchmark suites, prints a results table and writes the
+ * same results as CSV and JSON so runs can be compared across releases.
+ *
+ *   ./bench [--quick] [--csv PATH] [--json PATH] [suite ...]
+ *
+ * Suites are run in the order given, or all of them if none are named.
+ * Results go to bench_results.csv and bench_results.json by default.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#include "bench.h"
+
+uint64_t bench_timer_ns;
+
+// Every result reported so far
+static bench_result_t *results;
+static size_t num_results, max_results;
+
+
+uint64_t bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Measures the smallest gap between two timestamps
+static void bench_calibrate()
+{
+    uint64_t best = UINT64_MAX;
+    for(int i = 0; i < 10000; i++) {
+        uint64_t t0 = bench_now_ns();
+        uint64_t t1 = bench_now_ns();
+        if(t1 - t0 < best)
+            best = t1 - t0;
+    }
+    bench_timer_ns = best;
+}
+
+
+int bench_lat_init(bench_lat_t *lat, size_t max)
+{
+    lat->samples = (uint32_t *)malloc(max * sizeof(uint32_t));
+    lat->count = 0;
+    lat->max = lat->samples ? max : 0;
+    return lat->samples ? 0 : -1;
+}
+
+
+void bench_lat_free(bench_lat_t *lat)
+{
+    free(lat->samples);
+    lat->samples = NULL;
+    lat->count = lat->max = 0;
+}
+
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the sample below which fraction q of the samples lie
+static double percentile(const bench_lat_t *lat, double q)
+{
+    size_t i = (size_t)(q * (lat->count - 1) + 0.5);
+    return lat->samples[i];
+}
+
+
+void bench_report(bench_result_t *r, bench_lat_t *lat)
+{
+    if(lat && lat->count > 0) {
+        qsort(lat->samples, lat->count, sizeof(uint32_t), cmp_u32);
+        r->p50_ns = percentile(lat, 0.50);
+        r->p99_ns = percentile(lat, 0.99);
+        r->p999_ns = percentile(lat, 0.999);
+    }
+
+    double ns_per_op = r->ops ? r->seconds * 1e9 / r->ops : 0;
+    double ops_per_s = r->seconds > 0 ? r->ops / r->seconds : 0;
+    printf("%-8s %-18s %-30s %12.0f %9.1f %8.0f %8.0f %8.0f %9.1f\n", r->suite,
+        r->name, r->params, ops_per_s, ns_per_op, r->p50_ns, r->p99_ns,
+        r->p999_ns, r->mb_per_s);
+    fflush(stdout);
+
+    if(num_results == max_results) {
+        size_t max = max_results ? 2 * max_results : 64;
+        bench_result_t *grown = (bench_result_t *)realloc(results, max * sizeof(*grown));
+        if(grown == NULL)
+            return;
+        results = grown;
+        max_results = max;
+    }
+    results[num_results++] = *r;
+}
+
+
+int bench_write_csv(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if(f == NULL)
+        return -1;
+
+    fprintf(f, "suite,name,params,ops,seconds,ops_per_s,ns_per_op,p50_ns,p99_ns,p999_ns,mb_per_s\n");
+    for(size_t i = 0; i < num_results; i++) {
+        bench_result_t *r = &results[i];
+        fprintf(f, "%s,%s,%s,%llu,%.6f,%.1f,%.2f,%.0f,%.0f,%.0f,%.1f\n", r->suite,
+            r->name, r->params, (unsigned long long)r->ops, r->seconds,
+            r->seconds > 0 ? r->ops / r->seconds : 0,
+            r->ops ? r->seconds * 1e9 / r->ops : 0,
+            r->p50_ns, r->p99_ns, r->p999_ns, r->mb_per_s);
+    }
+    return fclose(f) ? -1 : 0;
+}
+
+
+int bench_write_json(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if(f == NULL)
+        return -1;
+
+    fprintf(f, "{\n  \"timer_overhead_ns\": %llu,\n  \"results\": [\n",
+        (unsigned long long)bench_timer_ns);
+    for(size_t i = 0; i < num_results; i++) {
+        bench_result_t *r = &results[i];
+        fprintf(f, "    {\"suite\": \"%s\", \"name\": \"%s\", \"params\": \"%s\", "
+            "\"ops\": %llu, \"seconds\": %.6f, \"ops_per_s\": %.1f, "
+            "\"ns_per_op\": %.2f, \"p50_ns\": %.0f, \"p99_ns\": %.0f, "
+            "\"p999_ns\": %.0f, \"mb_per_s\": %.1f}%s\n", r->suite, r->name,
+            r->params, (unsigned long long)r->ops, r->seconds,
+            r->seconds > 0 ? r->ops / r->seconds : 0,
+            r->ops ? r->seconds * 1e9 / r->ops : 0,
+            r->p50_ns, r->p99_ns, r->p999_ns, r->mb_per_s,
+            (i + 1 < num_results) ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) ? -1 : 0;
+}
+
+
+// Failed attempts to spin through before yielding the CPU
+#define BENCH_SPIN 64
+
+void bench_backoff(int *spins)
+{
+    if(++*spins >= BENCH_SPIN) {
+        sched_yield();
+        *spins = 0;
+    }
+}
+
+
+// The suites, in their default order
+static const struct {
+    const char *name;
+    void (*run)(const bench_opts_t *opts);
+} suites[] = {
+    { "cbfifo", bench_cbfifo },
+    { "llfifo", bench_llfifo },
+    { "mpmcfifo", bench_mpmcfifo },
+    { "shardq", bench_shardq },
+    { "wsdeque", bench_wsdeque },
+};
+
+static const int num_suites = sizeof(suites) / sizeof(suites[0]);
+
+
+int main(int argc, char **argv)
+{
+    bench_opts_t opts = { 0 };
+    const char *csv_path = "bench_results.csv";
+    const char *json_path = "bench_results.json";
+    const char *selected[16];
+    int num_selected = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--quick") == 0) {
+            opts.quick = 1;
+        } else if(strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if(strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if(argv[i][0] != '-' && num_selected < 16) {
+            selected[num_selected++] = argv[i];
+        } else {
+            printf("usage: %s [--quick] [--csv PATH] [--json PATH] [suite ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench_calibrate();
+    printf("%-8s %-18s %-30s %12s %9s %8s %8s %8s %9s\n", "suite", "name",
+        "params", "ops/s", "ns/op", "p50", "p99", "p999", "MB/s");
+
+    if(num_selected == 0) {
+        for(int s = 0; s < num_suites; s++)
+            suites[s].run(&opts);
+    }
+    for(int i = 0; i < num_selected; i++) {
+        int s;
+        for(s = 0; s < num_suites; s++) {
+            if(strcmp(selected[i], suites[s].name) == 0) {
+                suites[s].run(&opts);
+                break;
+            }
+        }
+        if(s == num_suites)
+            printf("unknown suite: %s\n", selected[i]);
+    }
+
+    if(bench_write_csv(csv_path) != 0)
+        printf("could not write %s\n", csv_path);
+    if(bench_write_json(json_path) != 0)
+        printf("could not write %s\n", json_path);
+    free(results);
+    return 0;
+}
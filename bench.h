@@ -0,0 +1,119 @@
+/*
+ * bench.h - shared harness for the FIFO benchmarks
+ *
+ * Author: Arpit Savarkar, (arpit.savarkar@colorado.edu)
+ *
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Options shared by all benchmark suites
+ */
+typedef struct {
+    // Run smaller workloads, for a quick smoke test
+    int quick;
+} bench_opts_t;
+
+
+/*
+ * Per-operation latency samples for one measurement. Once max samples
+ * are taken, further ones are dropped.
+ */
+typedef struct {
+    uint32_t *samples;
+    size_t count, max;
+} bench_lat_t;
+
+
+/*
+ * One measurement. Fields that do not apply are left at 0.
+ */
+typedef struct {
+    const char *suite;      // e.g. "cbfifo"
+    const char *name;       // e.g. "enqueue+dequeue"
+    char params[80];        // e.g. "ring=pow2 xfer=64"
+    uint64_t ops;           // operations timed
+    double seconds;         // time taken by the ops
+    double mb_per_s;        // for byte streams
+    double p50_ns, p99_ns, p999_ns;
+} bench_result_t;
+
+
+// Cost of one bench_now_ns() pair, subtracted from latency samples
+extern uint64_t bench_timer_ns;
+
+
+/*
+ * Returns a monotonic timestamp in nanoseconds
+ */
+uint64_t bench_now_ns();
+
+
+/*
+ * Allocates room for max latency samples
+ *
+ * Returns:
+ *   0 on success, -1 on failure
+ */
+int bench_lat_init(bench_lat_t *lat, size_t max);
+
+
+/*
+ * Records one latency sample, measured between two bench_now_ns() calls
+ */
+static inline void bench_lat_add(bench_lat_t *lat, uint64_t ns)
+{
+    if(lat->count < lat->max) {
+        ns = (ns > bench_timer_ns) ? ns - bench_timer_ns : 0;
+        lat->samples[lat->count++] = (ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)ns;
+    }
+}
+
+
+/*
+ * Frees the samples
+ */
+void bench_lat_free(bench_lat_t *lat);
+
+
+/*
+ * Fills in the percentiles of r from lat (if not NULL), prints r as a
+ * row of the results table and keeps it for bench_write_csv() and
+ * bench_write_json()
+ */
+void bench_report(bench_result_t *r, bench_lat_t *lat);
+
+
+/*
+ * Writes every reported result to path
+ *
+ * Returns:
+ *   0 on success, -1 on failure
+ */
+int bench_write_csv(const char *path);
+int bench_write_json(const char *path);
+
+
+/*
+ * Backs off after a failed attempt in a cross-thread polling loop,
+ * spinning briefly before yielding the CPU
+ */
+void bench_backoff(int *spins);
+
+
+/*
+ * Benchmark suites
+ */
+void bench_cbfifo(const bench_opts_t *opts);
+void bench_llfifo(const bench_opts_t *opts);
+void bench_mpmcfifo(const bench_opts_t *opts);
+void bench_shardq(const bench_opts_t *opts);
+void bench_wsdeque(const bench_opts_t *opts);
+
+#endif // _BENCH_H_
@@ -0,0 +1,730 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/
+/**
+ * @file bench_cbfifo.c
+ * @brief Benchmarks for the Circular Buffer in cbfifo.c
+ *
+ * - Moves data through a cbfifo in transfers of 64 B to 64 KB, for an
+ *   odd sized ring, a CBFIFO_POW2 ring and a CBFIFO_MIRROR ring, next to
+ *   a reference copy of the original byte-at-a-time algorithm.
+ * - Times single enqueue and dequeue calls of 8 B to 1 KB with the ring
+ *   empty, half full and 90% full.
+ * - Streams data from a producer thread to a consumer thread through a
+ *   CBFIFO_SPSC ring and through a plain ring guarded by a mutex, and
+ *   measures ping-pong round trips for those and CBFIFO_BLOCKING rings.
+ * - Moves 16 B to 1 KB messages through a CBFIFO_MSG ring with batched
+ *   dequeues, next to framing by hand with a header and a body call.
+ * - Moves 8 fragments of 16 B to 1 KB per call with cbfifo_enqueuev() and
+ *   cbfifo_dequeuev(), next to one enqueue and dequeue per fragment.
+ * - Times enqueues onto a full CBFIFO_OVERWRITE ring, which drop the
+ *   oldest bytes or messages, next to enqueue+dequeue on a plain ring.
+ * - Relays a stream between two socketpairs through a ring, with
+ *   cbfifo_read_from_fd() and cbfifo_write_to_fd() against read() and
+ *   write() through a bounce buffer.
+ * - Streams data from 1 to 8 producer threads to one consumer through a
+ *   CBFIFO_MPSC ring and through a plain ring guarded by a mutex.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "cbfifo.h"
+
+// Bytes moved through the FIFO for each throughput measurement
+#define BENCH_TOTAL_BYTES   (256u * 1024 * 1024)
+// Ring capacity, large enough for the biggest transfer
+#define BENCH_RING_SIZE     (128u * 1024)
+// Calls timed one by one for each latency measurement
+#define BENCH_LAT_OPS       200000
+
+/*
+ * Reference ring which moves one byte per iteration and wraps with a
+ * modulo each time, as cbfifo.c did before the bulk copy path
+ */
+typedef struct {
+    uint8_t buff[BENCH_RING_SIZE];
+    size_t head, tail, size;
+    bool full_status;
+} bytewise_t;
+
+static bytewise_t ref;
+
+static size_t bytewise_length(bytewise_t *f)
+{
+    if(f->full_status)
+        return f->size;
+    if(f->head >= f->tail)
+        return f->head - f->tail;
+    return f->size + f->head - f->tail;
+}
+
+static size_t bytewise_enqueue(bytewise_t *f, const uint8_t *data, size_t nbyte)
+{
+    if(bytewise_length(f) + nbyte > f->size)
+        return -1;
+    for(size_t i = 0; i < nbyte; i++) {
+        f->buff[f->head] = data[i];
+        if(f->full_status)
+            f->tail = (f->tail + 1) % f->size;
+        f->head = (f->head + 1) % f->size;
+        f->full_status = (f->head == f->tail);
+    }
+    return nbyte;
+}
+
+static size_t bytewise_dequeue(bytewise_t *f, uint8_t *data, size_t nbyte)
+{
+    size_t len = 0;
+    for(size_t i = 0; i < nbyte; i++) {
+        if(!f->full_status && f->head == f->tail)
+            break;
+        data[i] = f->buff[f->tail];
+        f->full_status = false;
+        f->tail = (f->tail + 1) % f->size;
+        len++;
+    }
+    return len;
+}
+
+static uint8_t src[BENCH_RING_SIZE], dst[BENCH_RING_SIZE];
+
+/*
+ * Runs enqueue+dequeue pairs of xfer bytes through fifo, or through the
+ * bytewise reference if fifo is NULL, and reports the throughput and the
+ * latency of a pair. cmp, if not NULL, tags a baseline run for another
+ * table so its row does not repeat one of the transfer table's.
+ */
+static void bench_pairs(const char *ring, cbfifo_t *fifo, size_t xfer, size_t total,
+    const char *cmp)
+{
+    bench_result_t r = { .suite = "cbfifo", .name = "enqueue+dequeue" };
+    bench_lat_t lat;
+    size_t iters = total / xfer;
+
+    if(cmp)
+        snprintf(r.params, sizeof(r.params), "ring=%s xfer=%zu cmp=%s", ring, xfer, cmp);
+    else
+        snprintf(r.params, sizeof(r.params), "ring=%s xfer=%zu", ring, xfer);
+    uint64_t start = bench_now_ns();
+    for(size_t i = 0; i < iters; i++) {
+        if(fifo) {
+            cbfifo_enqueue_to(fifo, src, xfer);
+            cbfifo_dequeue_from(fifo, dst, xfer);
+        } else {
+            bytewise_enqueue(&ref, src, xfer);
+            bytewise_dequeue(&ref, dst, xfer);
+        }
+    }
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+    r.ops = iters;
+    r.mb_per_s = (double)iters * xfer / (1024.0 * 1024.0) / r.seconds;
+
+    if(iters > BENCH_LAT_OPS)
+        iters = BENCH_LAT_OPS;
+    if(bench_lat_init(&lat, iters) == 0) {
+        for(size_t i = 0; i < iters; i++) {
+            uint64_t t0 = bench_now_ns();
+            if(fifo) {
+                cbfifo_enqueue_to(fifo, src, xfer);
+                cbfifo_dequeue_from(fifo, dst, xfer);
+            } else {
+                bytewise_enqueue(&ref, src, xfer);
+                bytewise_dequeue(&ref, dst, xfer);
+            }
+            bench_lat_add(&lat, bench_now_ns() - t0);
+        }
+    }
+    bench_report(&r, &lat);
+    bench_lat_free(&lat);
+}
+
+/*
+ * Times single enqueue and then dequeue calls of xfer bytes while the
+ * ring holds fill bytes. These results report the summed call times, so
+ * ns/op is the mean latency rather than a throughput figure.
+ */
+static void bench_fill(cbfifo_t *fifo, size_t xfer, int fill_pct, size_t ops)
+{
+    bench_result_t enq = { .suite = "cbfifo", .name = "enqueue" };
+    bench_result_t deq = { .suite = "cbfifo", .name = "dequeue" };
+    bench_lat_t enq_lat, deq_lat;
+    size_t fill = cbfifo_capacity_of(fifo) * fill_pct / 100;
+    uint64_t enq_ns = 0, deq_ns = 0;
+
+    snprintf(enq.params, sizeof(enq.params), "xfer=%zu fill=%d%%", xfer, fill_pct);
+    memcpy(deq.params, enq.params, sizeof(deq.params));
+    if(bench_lat_init(&enq_lat, ops) || bench_lat_init(&deq_lat, ops))
+        return;
+
+    // Bring the ring to the fill level, keeping room for one transfer
+    cbfifo_consume(fifo, cbfifo_length_of(fifo));
+    if(fill + xfer > cbfifo_capacity_of(fifo))
+        fill = cbfifo_capacity_of(fifo) - xfer;
+    for(size_t n = 0; n < fill; n += xfer)
+        cbfifo_enqueue_to(fifo, src, fill - n < xfer ? fill - n : xfer);
+
+    for(size_t i = 0; i < ops; i++) {
+        uint64_t t0 = bench_now_ns();
+        cbfifo_enqueue_to(fifo, src, xfer);
+        uint64_t t1 = bench_now_ns();
+        cbfifo_dequeue_from(fifo, dst, xfer);
+        uint64_t t2 = bench_now_ns();
+        bench_lat_add(&enq_lat, t1 - t0);
+        bench_lat_add(&deq_lat, t2 - t1);
+        enq_ns += t1 - t0;
+        deq_ns += t2 - t1;
+    }
+
+    enq.ops = deq.ops = ops;
+    enq.seconds = (enq_ns - ops * bench_timer_ns) * 1e-9;
+    deq.seconds = (deq_ns - ops * bench_timer_ns) * 1e-9;
+    bench_report(&enq, &enq_lat);
+    bench_report(&deq, &deq_lat);
+    bench_lat_free(&enq_lat);
+    bench_lat_free(&deq_lat);
+}
+
+// Messages moved per batch in the framing measurement
+#define BENCH_MSG_BATCH     32
+
+/*
+ * Moves total bytes of len byte messages through fifo, BENCH_MSG_BATCH
+ * at a time, and reports the cost per message. A CBFIFO_MSG ring is
+ * used through the message calls; otherwise each message is framed by
+ * hand, with a 4 byte length enqueued and dequeued ahead of the body.
+ */
+static void bench_msgs(const char *ring, cbfifo_t *fifo, size_t len, size_t total)
+{
+    bench_result_t r = { .suite = "cbfifo", .name = "messages" };
+    cbfifo_msg_t msgs[BENCH_MSG_BATCH];
+    bool framed = cbfifo_flags_of(fifo) & CBFIFO_MSG;
+    size_t iters = total / (len * BENCH_MSG_BATCH);
+    uint32_t hdr;
+
+    uint64_t start = bench_now_ns();
+    for(size_t i = 0; i < iters; i++) {
+        for(int m = 0; m < BENCH_MSG_BATCH; m++) {
+            if(framed) {
+                cbfifo_msg_enqueue(fifo, src, len);
+            } else {
+                hdr = len;
+                cbfifo_enqueue_to(fifo, &hdr, sizeof(hdr));
+                cbfifo_enqueue_to(fifo, src, len);
+            }
+        }
+        if(framed) {
+            cbfifo_msg_dequeue_batch(fifo, dst, sizeof(dst), msgs, BENCH_MSG_BATCH);
+        } else {
+            for(int m = 0; m < BENCH_MSG_BATCH; m++) {
+                cbfifo_dequeue_from(fifo, &hdr, sizeof(hdr));
+                cbfifo_dequeue_from(fifo, dst, hdr);
+            }
+        }
+    }
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "ring=%s len=%zu batch=%d", ring, len, BENCH_MSG_BATCH);
+    r.ops = iters * BENCH_MSG_BATCH;
+    r.mb_per_s = (double)r.ops * len / (1024.0 * 1024.0) / r.seconds;
+    bench_report(&r, NULL);
+}
+
+// Fragments per call in the scatter/gather measurement
+#define BENCH_FRAGMENTS     8
+
+/*
+ * Moves BENCH_FRAGMENTS fragments of frag bytes through fifo per
+ * iteration, with one vectored call each way if vectored is set, else
+ * with one call per fragment, and reports the cost per iteration
+ */
+static void bench_vector(bool vectored, cbfifo_t *fifo, size_t frag, size_t total)
+{
+    bench_result_t r = { .suite = "cbfifo", .name = "fragments" };
+    struct iovec in[BENCH_FRAGMENTS], out[BENCH_FRAGMENTS];
+    size_t iters = total / (frag * BENCH_FRAGMENTS);
+
+    for(int f = 0; f < BENCH_FRAGMENTS; f++) {
+        in[f].iov_base = src + f * frag;
+        in[f].iov_len = frag;
+        out[f].iov_base = dst + f * frag;
+        out[f].iov_len = frag;
+    }
+
+    uint64_t start = bench_now_ns();
+    for(size_t i = 0; i < iters; i++) {
+        if(vectored) {
+            cbfifo_enqueuev(fifo, in, BENCH_FRAGMENTS);
+            cbfifo_dequeuev(fifo, out, BENCH_FRAGMENTS);
+        } else {
+            for(int f = 0; f < BENCH_FRAGMENTS; f++)
+                cbfifo_enqueue_to(fifo, in[f].iov_base, frag);
+            for(int f = 0; f < BENCH_FRAGMENTS; f++)
+                cbfifo_dequeue_from(fifo, out[f].iov_base, frag);
+        }
+    }
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "calls=%s frag=%zu x%d",
+        vectored ? "iovec" : "each", frag, BENCH_FRAGMENTS);
+    r.ops = iters;
+    r.mb_per_s = (double)iters * frag * BENCH_FRAGMENTS / (1024.0 * 1024.0) / r.seconds;
+    bench_report(&r, NULL);
+}
+
+/*
+ * Times enqueues of len bytes, or len byte messages on a CBFIFO_MSG
+ * ring, onto a CBFIFO_OVERWRITE ring that stays full, so each one drops
+ * the oldest data to make room
+ */
+static void bench_overwrite(const char *ring, cbfifo_t *fifo, size_t len, size_t total)
+{
+    bench_result_t r = { .suite = "cbfifo", .name = "overwrite enqueue" };
+    bool framed = cbfifo_flags_of(fifo) & CBFIFO_MSG;
+    size_t iters = total / len;
+
+    uint64_t start = bench_now_ns();
+    for(size_t i = 0; i < iters; i++) {
+        if(framed)
+            cbfifo_msg_enqueue(fifo, src, len);
+        else
+            cbfifo_enqueue_to(fifo, src, len);
+    }
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "ring=%s len=%zu", ring, len);
+    r.ops = iters;
+    r.mb_per_s = (double)iters * len / (1024.0 * 1024.0) / r.seconds;
+    bench_report(&r, NULL);
+}
+
+// Bytes streamed between threads for each measurement
+#define BENCH_THREAD_BYTES  (64u * 1024 * 1024)
+// Ring capacity for the cross-thread measurements
+#define BENCH_THREAD_RING   (64u * 1024)
+// Round trips for the latency measurement
+#define BENCH_ROUND_TRIPS   100000
+
+/*
+ * One side of a cross-thread FIFO. lock is NULL for a CBFIFO_SPSC or
+ * CBFIFO_MPSC ring, otherwise every call is made while holding it. A
+ * CBFIFO_BLOCKING ring is used through the waiting calls.
+ */
+typedef struct {
+    cbfifo_t *fifo;
+    pthread_mutex_t *lock;
+} xfifo_t;
+
+static size_t xfifo_enqueue(xfifo_t *x, void *buf, size_t nbyte)
+{
+    size_t ret;
+    if(cbfifo_flags_of(x->fifo) & CBFIFO_BLOCKING)
+        return cbfifo_enqueue_wait(x->fifo, buf, nbyte, -1);
+    if(x->lock)
+        pthread_mutex_lock(x->lock);
+    ret = cbfifo_enqueue_to(x->fifo, buf, nbyte);
+    if(x->lock)
+        pthread_mutex_unlock(x->lock);
+    return ret;
+}
+
+static size_t xfifo_dequeue(xfifo_t *x, void *buf, size_t nbyte)
+{
+    size_t ret;
+    if(cbfifo_flags_of(x->fifo) & CBFIFO_BLOCKING)
+        return cbfifo_dequeue_wait(x->fifo, buf, nbyte, nbyte, -1);
+    if(x->lock)
+        pthread_mutex_lock(x->lock);
+    ret = cbfifo_dequeue_from(x->fifo, buf, nbyte);
+    if(x->lock)
+        pthread_mutex_unlock(x->lock);
+    return ret;
+}
+
+typedef struct {
+    xfifo_t *to, *from;
+    size_t xfer, total;
+    int round_trips;
+} stream_arg_t;
+
+// Producer thread for the throughput measurement
+static void *stream_producer(void *p)
+{
+    stream_arg_t *arg = (stream_arg_t *)p;
+    size_t sent = 0;
+    int spins = 0;
+    while(sent < arg->total) {
+        if(xfifo_enqueue(arg->to, src, arg->xfer) == arg->xfer)
+            sent += arg->xfer;
+        else
+            bench_backoff(&spins);
+    }
+    return NULL;
+}
+
+// Streams total bytes between two threads and reports the throughput
+static void bench_stream(const char *ring, xfifo_t *x, size_t xfer, size_t total)
+{
+    bench_result_t r = { .suite = "cbfifo", .name = "stream" };
+    stream_arg_t arg = { x, NULL, xfer, total, 0 };
+    pthread_t producer;
+    size_t received = 0;
+    int spins = 0;
+
+    uint64_t start = bench_now_ns();
+    pthread_create(&producer, NULL, stream_producer, &arg);
+    while(received < total) {
+        size_t n = xfifo_dequeue(x, dst, BENCH_THREAD_RING);
+        if(n)
+            received += n;
+        else
+            bench_backoff(&spins);
+    }
+    pthread_join(producer, NULL);
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "ring=%s xfer=%zu", ring, xfer);
+    r.ops = total / xfer;
+    r.mb_per_s = total / (1024.0 * 1024.0) / r.seconds;
+    bench_report(&r, NULL);
+}
+
+// Largest number of producers for the multi-producer measurement
+#define BENCH_MAX_PRODUCERS 8
+
+/*
+ * Streams total bytes from producers threads, each sending an equal
+ * share, to this one and reports the throughput
+ */
+static void bench_mpsc(const char *ring, xfifo_t *x, int producers, size_t xfer, size_t total)
+{
+    bench_result_t r = { .suite = "cbfifo", .name = "mpsc stream" };
+    stream_arg_t arg = { x, NULL, xfer, total / producers / xfer * xfer, 0 };
+    pthread_t threads[BENCH_MAX_PRODUCERS];
+    size_t received = 0;
+    int spins = 0;
+
+    total = arg.total * producers;
+    uint64_t start = bench_now_ns();
+    for(int i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, stream_producer, &arg);
+    while(received < total) {
+        size_t n = xfifo_dequeue(x, dst, BENCH_THREAD_RING);
+        if(n)
+            received += n;
+        else
+            bench_backoff(&spins);
+    }
+    for(int i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "ring=%s producers=%d xfer=%zu", ring, producers, xfer);
+    r.ops = total / xfer;
+    r.mb_per_s = total / (1024.0 * 1024.0) / r.seconds;
+    bench_report(&r, NULL);
+}
+
+// Echo thread for the latency measurement
+static void *pong(void *p)
+{
+    stream_arg_t *arg = (stream_arg_t *)p;
+    uint64_t msg;
+    int spins = 0;
+    for(int i = 0; i < arg->round_trips; i++) {
+        while(xfifo_dequeue(arg->from, &msg, sizeof(msg)) != sizeof(msg))
+            bench_backoff(&spins);
+        while(xfifo_enqueue(arg->to, &msg, sizeof(msg)) != sizeof(msg))
+            bench_backoff(&spins);
+    }
+    return NULL;
+}
+
+// Reports the round trip time of an 8 byte message between two threads
+static void bench_pingpong(const char *ring, xfifo_t *ping, xfifo_t *back, int round_trips)
+{
+    bench_result_t r = { .suite = "cbfifo", .name = "round trip" };
+    stream_arg_t arg = { back, ping, sizeof(uint64_t), 0, round_trips };
+    bench_lat_t lat;
+    pthread_t echo;
+    uint64_t msg;
+    int spins = 0;
+
+    if(bench_lat_init(&lat, round_trips))
+        return;
+    pthread_create(&echo, NULL, pong, &arg);
+    uint64_t start = bench_now_ns();
+    for(int i = 0; i < round_trips; i++) {
+        uint64_t t0 = bench_now_ns();
+        msg = i;
+        while(xfifo_enqueue(ping, &msg, sizeof(msg)) != sizeof(msg))
+            bench_backoff(&spins);
+        while(xfifo_dequeue(back, &msg, sizeof(msg)) != sizeof(msg))
+            bench_backoff(&spins);
+        bench_lat_add(&lat, bench_now_ns() - t0);
+    }
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+    pthread_join(echo, NULL);
+
+    snprintf(r.params, sizeof(r.params), "ring=%s xfer=8", ring);
+    r.ops = round_trips;
+    bench_report(&r, &lat);
+    bench_lat_free(&lat);
+}
+
+typedef struct {
+    int fd;
+    size_t total;
+} relay_end_t;
+
+// Source thread for the relay: writes total bytes, then closes its end
+static void *relay_source(void *p)
+{
+    relay_end_t *end = (relay_end_t *)p;
+    for(size_t sent = 0; sent < end->total; ) {
+        size_t n = end->total - sent < BENCH_THREAD_RING ? end->total - sent : BENCH_THREAD_RING;
+        ssize_t put = write(end->fd, src, n);
+        if(put <= 0)
+            break;
+        sent += put;
+    }
+    close(end->fd);
+    return NULL;
+}
+
+// Sink thread for the relay: reads until end of file
+static void *relay_sink(void *p)
+{
+    relay_end_t *end = (relay_end_t *)p;
+    static uint8_t sink[BENCH_THREAD_RING];
+    while(read(end->fd, sink, sizeof(sink)) > 0)
+        ;
+    return NULL;
+}
+
+/*
+ * Relays total bytes from one socketpair to another through a ring of
+ * BENCH_THREAD_RING bytes, up to xfer bytes per call, and reports the
+ * throughput. With direct set, the ring is filled and drained by
+ * cbfifo_read_from_fd() and cbfifo_write_to_fd(); otherwise by read()
+ * and write() through a bounce buffer, as callers did before.
+ */
+static void bench_relay(bool direct, size_t xfer, size_t total)
+{
+    bench_result_t r = { .suite = "cbfifo", .name = "socket relay" };
+    static uint8_t bounce[BENCH_THREAD_RING];
+    cbfifo_t *fifo = cbfifo_new_ex(BENCH_THREAD_RING, CBFIFO_POW2);
+    int in[2], out[2];
+    pthread_t source, sink;
+    bool eof = false;
+
+    if(fifo == NULL || socketpair(AF_UNIX, SOCK_STREAM, 0, in) != 0) {
+        cbfifo_free(fifo);
+        return;
+    }
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, out) != 0) {
+        close(in[0]);
+        close(in[1]);
+        cbfifo_free(fifo);
+        return;
+    }
+    relay_end_t from = { in[0], total }, to = { out[1], total };
+
+    uint64_t start = bench_now_ns();
+    pthread_create(&source, NULL, relay_source, &from);
+    pthread_create(&sink, NULL, relay_sink, &to);
+    while(!eof || cbfifo_length_of(fifo) > 0) {
+        if(!eof && cbfifo_length_of(fifo) < cbfifo_capacity_of(fifo)) {
+            size_t got;
+            if(direct) {
+                got = cbfifo_read_from_fd(fifo, in[1], xfer);
+            } else {
+                size_t room = cbfifo_capacity_of(fifo) - cbfifo_length_of(fifo);
+                ssize_t n = read(in[1], bounce, room < xfer ? room : xfer);
+                got = (n > 0) ? cbfifo_enqueue_to(fifo, bounce, n) : (size_t)n;
+            }
+            if(got == 0 || got == (size_t)-1)
+                eof = true;
+        }
+        if(direct) {
+            cbfifo_write_to_fd(fifo, out[0], xfer);
+        } else {
+            size_t n = cbfifo_dequeue_from(fifo, bounce, xfer);
+            for(size_t off = 0; off < n; ) {
+                ssize_t put = write(out[0], bounce + off, n - off);
+                if(put <= 0)
+                    break;
+                off += put;
+            }
+        }
+    }
+    close(out[0]);
+    pthread_join(source, NULL);
+    pthread_join(sink, NULL);
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "io=%s xfer=%zu", direct ? "fd" : "bounce", xfer);
+    r.ops = total / xfer;
+    r.mb_per_s = total / (1024.0 * 1024.0) / r.seconds;
+    bench_report(&r, NULL);
+
+    close(in[1]);
+    close(out[1]);
+    cbfifo_free(fifo);
+}
+
+static void bench_threads(const bench_opts_t *opts)
+{
+    const size_t sizes[] = { 64, 1024, 16384 };
+    const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    size_t total = opts->quick ? BENCH_THREAD_BYTES / 16 : BENCH_THREAD_BYTES;
+    int round_trips = opts->quick ? BENCH_ROUND_TRIPS / 10 : BENCH_ROUND_TRIPS;
+    pthread_mutex_t lock1 = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t lock2 = PTHREAD_MUTEX_INITIALIZER;
+
+    xfifo_t spsc1 = { cbfifo_new_ex(BENCH_THREAD_RING, CBFIFO_SPSC), NULL };
+    xfifo_t spsc2 = { cbfifo_new_ex(BENCH_THREAD_RING, CBFIFO_SPSC), NULL };
+    xfifo_t locked1 = { cbfifo_new_ex(BENCH_THREAD_RING, CBFIFO_POW2), &lock1 };
+    xfifo_t locked2 = { cbfifo_new_ex(BENCH_THREAD_RING, CBFIFO_POW2), &lock2 };
+    xfifo_t blocking1 = { cbfifo_new_ex(BENCH_THREAD_RING, CBFIFO_BLOCKING), NULL };
+    xfifo_t blocking2 = { cbfifo_new_ex(BENCH_THREAD_RING, CBFIFO_BLOCKING), NULL };
+    xfifo_t mpsc = { cbfifo_new_ex(BENCH_THREAD_RING, CBFIFO_MPSC), NULL };
+    if(!spsc1.fifo || !spsc2.fifo || !locked1.fifo || !locked2.fifo ||
+       !blocking1.fifo || !blocking2.fifo || !mpsc.fifo) {
+        printf("cbfifo_new_ex failed\n");
+        cbfifo_free(spsc1.fifo);
+        cbfifo_free(spsc2.fifo);
+        cbfifo_free(locked1.fifo);
+        cbfifo_free(locked2.fifo);
+        cbfifo_free(blocking1.fifo);
+        cbfifo_free(blocking2.fifo);
+        cbfifo_free(mpsc.fifo);
+        return;
+    }
+
+    for(int i = 0; i < num_sizes; i++) {
+        bench_stream("spsc", &spsc1, sizes[i], total);
+        bench_stream("mutex", &locked1, sizes[i], total);
+    }
+    bench_pingpong("spsc", &spsc1, &spsc2, round_trips);
+    bench_pingpong("mutex", &locked1, &locked2, round_trips);
+    bench_pingpong("blocking", &blocking1, &blocking2, round_trips);
+
+    for(int i = 0; i < num_sizes; i++) {
+        bench_relay(true, sizes[i], total);
+        bench_relay(false, sizes[i], total);
+    }
+
+    for(int producers = 1; producers <= BENCH_MAX_PRODUCERS; producers *= 2) {
+        for(int i = 0; i < num_sizes - 1; i++) {
+            bench_mpsc("mpsc", &mpsc, producers, sizes[i], total);
+            bench_mpsc("mutex", &locked1, producers, sizes[i], total);
+        }
+    }
+
+    cbfifo_free(spsc1.fifo);
+    cbfifo_free(spsc2.fifo);
+    cbfifo_free(locked1.fifo);
+    cbfifo_free(locked2.fifo);
+    cbfifo_free(blocking1.fifo);
+    cbfifo_free(blocking2.fifo);
+    cbfifo_free(mpsc.fifo);
+}
+
+void bench_cbfifo(const bench_opts_t *opts)
+{
+    const size_t sizes[] = { 64, 256, 1024, 4096, 16384, 65536 };
+    const size_t quick_sizes[] = { 64, 4096 };
+    const size_t *xfers = opts->quick ? quick_sizes : sizes;
+    const int num_xfers = opts->quick ? 2 : sizeof(sizes) / sizeof(sizes[0]);
+    size_t total = opts->quick ? BENCH_TOTAL_BYTES / 16 : BENCH_TOTAL_BYTES;
+
+    // An odd capacity, so transfers keep landing on the wrap point
+    cbfifo_t *fifo = cbfifo_new(BENCH_RING_SIZE - 1);
+    cbfifo_t *pow2 = cbfifo_new_ex(BENCH_RING_SIZE, CBFIFO_POW2);
+    cbfifo_t *mirror = cbfifo_new_ex(BENCH_RING_SIZE, CBFIFO_POW2 | CBFIFO_MIRROR);
+    if(fifo == NULL || pow2 == NULL || mirror == NULL) {
+        printf("cbfifo_new failed\n");
+        cbfifo_free(fifo);
+        cbfifo_free(pow2);
+        cbfifo_free(mirror);
+        return;
+    }
+    ref.size = BENCH_RING_SIZE - 1;
+
+    for(size_t i = 0; i < sizeof(src); i++)
+        src[i] = (uint8_t)i;
+
+    for(int i = 0; i < num_xfers; i++) {
+        bench_pairs("plain", fifo, xfers[i], total, NULL);
+        bench_pairs("pow2", pow2, xfers[i], total, NULL);
+        bench_pairs("mirror", mirror, xfers[i], total, NULL);
+        // The reference is two orders of magnitude slower
+        bench_pairs("bytewise", NULL, xfers[i], total / 64, NULL);
+    }
+
+    const size_t fill_xfers[] = { 8, 64, 1024 };
+    const int fills[] = { 0, 50, 90 };
+    for(int i = 0; i < 3; i++)
+        for(int f = 0; f < 3; f++)
+            bench_fill(pow2, fill_xfers[i], fills[f],
+                opts->quick ? BENCH_LAT_OPS / 10 : BENCH_LAT_OPS);
+
+    cbfifo_free(fifo);
+    cbfifo_free(pow2);
+    cbfifo_free(mirror);
+
+    cbfifo_t *msg = cbfifo_new_ex(BENCH_RING_SIZE, CBFIFO_MSG | CBFIFO_POW2);
+    pow2 = cbfifo_new_ex(BENCH_RING_SIZE, CBFIFO_POW2);
+    if(msg == NULL || pow2 == NULL) {
+        printf("cbfifo_new_ex failed\n");
+        cbfifo_free(msg);
+        cbfifo_free(pow2);
+        return;
+    }
+    const size_t msg_lens[] = { 16, 64, 256, 1024 };
+    for(int i = 0; i < 4; i++) {
+        bench_msgs("msg", msg, msg_lens[i], total / 4);
+        bench_msgs("by hand", pow2, msg_lens[i], total / 4);
+    }
+
+    cbfifo_t *lossy = cbfifo_new_ex(BENCH_RING_SIZE, CBFIFO_OVERWRITE);
+    cbfifo_t *lossy_msg = cbfifo_new_ex(BENCH_RING_SIZE, CBFIFO_OVERWRITE | CBFIFO_MSG);
+    if(lossy == NULL || lossy_msg == NULL) {
+        printf("cbfifo_new_ex failed\n");
+        cbfifo_free(lossy);
+        cbfifo_free(lossy_msg);
+        cbfifo_free(msg);
+        cbfifo_free(pow2);
+        return;
+    }
+    for(int i = 0; i < 4; i++) {
+        bench_overwrite("bytes", lossy, msg_lens[i], total / 4);
+        bench_overwrite("msg", lossy_msg, msg_lens[i], total / 4);
+        bench_pairs("pow2", pow2, msg_lens[i], total / 4, "overwrite");
+    }
+    for(int i = 0; i < 4; i++) {
+        bench_vector(true, pow2, msg_lens[i], total / 4);
+        bench_vector(false, pow2, msg_lens[i], total / 4);
+    }
+    cbfifo_free(lossy);
+    cbfifo_free(lossy_msg);
+    cbfifo_free(msg);
+    cbfifo_free(pow2);
+
+    bench_threads(opts);
+}
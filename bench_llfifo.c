@@ -0,0 +1,501 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/
+/**
+ * @file bench_llfifo.c
+ * @brief Benchmarks for the Linked List Based Queue in llfifo.c
+ *
+ * Fills an llfifo to a given depth and drains it again, timing the
+ * enqueue and dequeue calls, for three growth patterns:
+ *
+ *   presized  created with llfifo_create(depth), so nothing is allocated
+ *   growing   created with llfifo_create(0) for every fill, so every
+ *             enqueue grows the FIFO
+ *   regrown   created with llfifo_create(0) once and reused, so only
+ *             the first fill grows it
+ *
+ * each for the block-based llfifo and an LLFIFO_ARRAY one, at depths
+ * up to 10M.
+ *
+ * Queues depth distinct 64 byte packets, reading each one as it is
+ * dequeued, through a presized llfifo and an LLFIFO_INTRUSIVE one.
+ * Moves elements in batches with llfifo_enqueue_many() and
+ * llfifo_dequeue_many(), next to the same batches moved one call at a
+ * time. Also times llfifo_create(n), llfifo_destroy() of an unused FIFO of
+ * that capacity, and growing a FIFO from llfifo_create(0) to n elements.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "bench.h"
+#include "llfifo.h"
+
+// Elements moved through the FIFO for each measurement
+#define BENCH_LL_OPS        4000000
+// Calls timed one by one for each latency measurement
+#define BENCH_LAT_OPS       200000
+
+typedef enum { PRESIZED, GROWING, REGROWN } pattern_t;
+
+static const char *pattern_names[] = { "presized", "growing", "regrown" };
+
+/*
+ * Fills fifo to depth and drains it, adding the time spent to enq_ns
+ * and deq_ns, and the per-call latencies to the lat arrays if they are
+ * not NULL
+ */
+static void fill_drain(llfifo_t *fifo, int depth, uint64_t *enq_ns, uint64_t *deq_ns,
+    bench_lat_t *enq_lat, bench_lat_t *deq_lat)
+{
+    static char element;
+
+    if(enq_lat == NULL) {
+        uint64_t t0 = bench_now_ns();
+        for(int i = 0; i < depth; i++)
+            llfifo_enqueue(fifo, &element);
+        uint64_t t1 = bench_now_ns();
+        for(int i = 0; i < depth; i++)
+            llfifo_dequeue(fifo);
+        uint64_t t2 = bench_now_ns();
+        *enq_ns += t1 - t0;
+        *deq_ns += t2 - t1;
+        return;
+    }
+
+    for(int i = 0; i < depth; i++) {
+        uint64_t t0 = bench_now_ns();
+        llfifo_enqueue(fifo, &element);
+        bench_lat_add(enq_lat, bench_now_ns() - t0);
+    }
+    for(int i = 0; i < depth; i++) {
+        uint64_t t0 = bench_now_ns();
+        llfifo_dequeue(fifo);
+        bench_lat_add(deq_lat, bench_now_ns() - t0);
+    }
+}
+
+/*
+ * Runs fill_drain() enough times to move about total elements, first
+ * for throughput and then again with each call timed, on FIFOs
+ * created with the given llfifo_create_ex() flags
+ */
+static void bench_depth(pattern_t pattern, int depth, long total, unsigned flags)
+{
+    bench_result_t enq = { .suite = "llfifo", .name = (flags & LLFIFO_ARRAY) ? "array enqueue" : "enqueue" };
+    bench_result_t deq = { .suite = "llfifo", .name = (flags & LLFIFO_ARRAY) ? "array dequeue" : "dequeue" };
+    bench_lat_t enq_lat, deq_lat;
+    uint64_t enq_ns = 0, deq_ns = 0;
+    long reps = total / depth;
+    llfifo_t *fifo = NULL;
+
+    if(reps < 1)
+        reps = 1;
+    snprintf(enq.params, sizeof(enq.params), "pattern=%s depth=%d",
+        pattern_names[pattern], depth);
+    memcpy(deq.params, enq.params, sizeof(deq.params));
+
+    for(int timed = 0; timed < 2; timed++) {
+        long lat_reps = reps;
+        if(timed) {
+            // Keep the latency pass to about BENCH_LAT_OPS calls
+            lat_reps = BENCH_LAT_OPS / depth;
+            if(lat_reps < 1)
+                lat_reps = 1;
+            if(bench_lat_init(&enq_lat, lat_reps * depth) ||
+               bench_lat_init(&deq_lat, lat_reps * depth))
+                return;
+        }
+
+        if(pattern != GROWING)
+            fifo = llfifo_create_ex(pattern == PRESIZED ? depth : 0, flags);
+        for(long r = 0; r < lat_reps; r++) {
+            if(pattern == GROWING)
+                fifo = llfifo_create_ex(0, flags);
+            if(fifo == NULL) {
+                printf("llfifo_create failed\n");
+                return;
+            }
+            fill_drain(fifo, depth, &enq_ns, &deq_ns, timed ? &enq_lat : NULL,
+                timed ? &deq_lat : NULL);
+            if(pattern == GROWING)
+                llfifo_destroy(fifo);
+        }
+        if(pattern != GROWING)
+            llfifo_destroy(fifo);
+    }
+
+    enq.ops = deq.ops = reps * depth;
+    enq.seconds = enq_ns * 1e-9;
+    deq.seconds = deq_ns * 1e-9;
+    bench_report(&enq, &enq_lat);
+    bench_report(&deq, &deq_lat);
+    bench_lat_free(&enq_lat);
+    bench_lat_free(&deq_lat);
+}
+
+/*
+ * Times reps calls each of llfifo_create(n) and llfifo_destroy(), and
+ * of growing an llfifo_create(0) FIFO to n elements and destroying it
+ */
+static void bench_lifecycle(int n, int reps)
+{
+    bench_result_t create = { .suite = "llfifo", .name = "create" };
+    bench_result_t destroy = { .suite = "llfifo", .name = "destroy" };
+    bench_result_t grow = { .suite = "llfifo", .name = "grow" };
+    bench_lat_t create_lat, destroy_lat, grow_lat;
+    uint64_t create_ns = 0, destroy_ns = 0, grow_ns = 0;
+    static char element;
+
+    if(bench_lat_init(&create_lat, reps) || bench_lat_init(&destroy_lat, reps) ||
+       bench_lat_init(&grow_lat, reps))
+        return;
+
+    for(int r = 0; r < reps; r++) {
+        uint64_t t0 = bench_now_ns();
+        llfifo_t *fifo = llfifo_create(n);
+        uint64_t t1 = bench_now_ns();
+        if(fifo == NULL) {
+            printf("llfifo_create failed\n");
+            return;
+        }
+        llfifo_destroy(fifo);
+        uint64_t t2 = bench_now_ns();
+
+        fifo = llfifo_create(0);
+        for(int i = 0; i < n; i++)
+            llfifo_enqueue(fifo, &element);
+        llfifo_destroy(fifo);
+        uint64_t t3 = bench_now_ns();
+
+        bench_lat_add(&create_lat, t1 - t0);
+        bench_lat_add(&destroy_lat, t2 - t1);
+        bench_lat_add(&grow_lat, t3 - t2);
+        create_ns += t1 - t0;
+        destroy_ns += t2 - t1;
+        grow_ns += t3 - t2;
+    }
+
+    snprintf(create.params, sizeof(create.params), "capacity=%d", n);
+    memcpy(destroy.params, create.params, sizeof(destroy.params));
+    snprintf(grow.params, sizeof(grow.params), "to=%d", n);
+    create.ops = destroy.ops = grow.ops = reps;
+    create.seconds = create_ns * 1e-9;
+    destroy.seconds = destroy_ns * 1e-9;
+    grow.seconds = grow_ns * 1e-9;
+    bench_report(&create, &create_lat);
+    bench_report(&destroy, &destroy_lat);
+    bench_report(&grow, &grow_lat);
+    bench_lat_free(&create_lat);
+    bench_lat_free(&destroy_lat);
+    bench_lat_free(&grow_lat);
+}
+
+/*
+ * Moves about total elements through a FIFO in batches of batch, with
+ * the batch calls (many is true) or one call per element, and reports
+ * the time per element
+ */
+static void bench_batch(int batch, int many, long total)
+{
+    bench_result_t r = { .suite = "llfifo", .name = many ? "enq+deq many" : "enq+deq" };
+    static void *elems[4096], *out[4096];
+    long reps = total / batch;
+    llfifo_t *fifo = llfifo_create(batch);
+
+    if(fifo == NULL) {
+        printf("llfifo_create failed\n");
+        return;
+    }
+    for(int i = 0; i < batch; i++)
+        elems[i] = &elems[i];
+
+    uint64_t start = bench_now_ns();
+    for(long rep = 0; rep < reps; rep++) {
+        if(many) {
+            llfifo_enqueue_many(fifo, elems, batch);
+            llfifo_dequeue_many(fifo, out, batch);
+        } else {
+            for(int i = 0; i < batch; i++)
+                llfifo_enqueue(fifo, elems[i]);
+            for(int i = 0; i < batch; i++)
+                out[i] = llfifo_dequeue(fifo);
+        }
+    }
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+    llfifo_destroy(fifo);
+
+    snprintf(r.params, sizeof(r.params), "batch=%d", batch);
+    r.ops = reps * batch;
+    bench_report(&r, NULL);
+}
+
+// Elements streamed for each producer count
+#define BENCH_MPSC_OPS      1000000
+#define BENCH_MAX_PRODUCERS 64
+
+typedef struct {
+    llfifo_link_t link;
+} mpsc_item_t;
+
+typedef struct {
+    llfifo_mpsc_t *mpsc;    // NULL for the locked llfifo
+    llfifo_t *fifo;
+    pthread_mutex_t *lock;
+    mpsc_item_t *items;
+    long count;
+} producer_arg_t;
+
+static void *mpsc_producer(void *p)
+{
+    producer_arg_t *arg = (producer_arg_t *)p;
+    for(long i = 0; i < arg->count; i++) {
+        if(arg->mpsc) {
+            llfifo_mpsc_push(arg->mpsc, &arg->items[i].link);
+        } else {
+            pthread_mutex_lock(arg->lock);
+            llfifo_enqueue(arg->fifo, &arg->items[i]);
+            pthread_mutex_unlock(arg->lock);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Streams about total elements from producers threads into this one,
+ * through an llfifo_mpsc_t (mpsc is true) or a locked llfifo, and
+ * reports the throughput
+ */
+static void bench_producers(int producers, int mpsc, long total)
+{
+    bench_result_t r = { .suite = "llfifo", .name = mpsc ? "mpsc stream" : "mutex stream" };
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t threads[BENCH_MAX_PRODUCERS];
+    producer_arg_t args[BENCH_MAX_PRODUCERS];
+    long per = total / producers;
+    long received = 0;
+    int spins = 0;
+
+    mpsc_item_t *items = (mpsc_item_t *)malloc(per * producers * sizeof(mpsc_item_t));
+    llfifo_mpsc_t *queue = mpsc ? llfifo_mpsc_create() : NULL;
+    llfifo_t *fifo = mpsc ? NULL : llfifo_create(0);
+    if(items == NULL || (mpsc ? queue == NULL : fifo == NULL)) {
+        printf("bench_producers setup failed\n");
+        free(items);
+        return;
+    }
+
+    uint64_t start = bench_now_ns();
+    for(int p = 0; p < producers; p++) {
+        producer_arg_t a = { queue, fifo, &lock, items + p * per, per };
+        args[p] = a;
+        pthread_create(&threads[p], NULL, mpsc_producer, &args[p]);
+    }
+    while(received < per * producers) {
+        int got;
+        if(mpsc) {
+            got = llfifo_mpsc_pop(queue) != NULL;
+        } else {
+            pthread_mutex_lock(&lock);
+            got = llfifo_dequeue(fifo) != NULL;
+            pthread_mutex_unlock(&lock);
+        }
+        if(got)
+            received++;
+        else
+            bench_backoff(&spins);
+    }
+    for(int p = 0; p < producers; p++)
+        pthread_join(threads[p], NULL);
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "producers=%d", producers);
+    r.ops = per * producers;
+    bench_report(&r, NULL);
+
+    if(mpsc)
+        llfifo_mpsc_destroy(queue);
+    else
+        llfifo_destroy(fifo);
+    free(items);
+}
+
+typedef struct {
+    llfifo_t *fifo;
+    pthread_mutex_t *lock;  // NULL for LLFIFO_MPMC
+    long count;
+    _Atomic long *left;     // elements still to be dequeued
+} mpmc_arg_t;
+
+static void *mpmc_producer(void *p)
+{
+    mpmc_arg_t *arg = (mpmc_arg_t *)p;
+    static char element;
+    for(long i = 0; i < arg->count; i++) {
+        if(arg->lock)
+            pthread_mutex_lock(arg->lock);
+        llfifo_enqueue(arg->fifo, &element);
+        if(arg->lock)
+            pthread_mutex_unlock(arg->lock);
+    }
+    return NULL;
+}
+
+static void *mpmc_consumer(void *p)
+{
+    mpmc_arg_t *arg = (mpmc_arg_t *)p;
+    int spins = 0;
+    while(atomic_load_explicit(arg->left, memory_order_relaxed) > 0) {
+        if(arg->lock)
+            pthread_mutex_lock(arg->lock);
+        void *e = llfifo_dequeue(arg->fifo);
+        if(arg->lock)
+            pthread_mutex_unlock(arg->lock);
+        if(e)
+            atomic_fetch_sub_explicit(arg->left, 1, memory_order_relaxed);
+        else
+            bench_backoff(&spins);
+    }
+    return NULL;
+}
+
+/*
+ * Streams about total elements from threads producers to as many
+ * consumers, through an LLFIFO_MPMC llfifo (mpmc is true) or a locked
+ * llfifo, and reports the throughput
+ */
+static void bench_mpmc(int threads, int mpmc, long total)
+{
+    bench_result_t r = { .suite = "llfifo", .name = mpmc ? "mpmc stream" : "mutex mpmc stream" };
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t tids[2 * BENCH_MAX_PRODUCERS];
+    long per = total / threads;
+    _Atomic long left = per * threads;
+    mpmc_arg_t arg = { NULL, mpmc ? NULL : &lock, per, &left };
+
+    arg.fifo = llfifo_create_ex(0, mpmc ? LLFIFO_MPMC : 0);
+    if(arg.fifo == NULL) {
+        printf("llfifo_create_ex failed\n");
+        return;
+    }
+
+    uint64_t start = bench_now_ns();
+    for(int t = 0; t < threads; t++) {
+        pthread_create(&tids[t], NULL, mpmc_consumer, &arg);
+        pthread_create(&tids[threads + t], NULL, mpmc_producer, &arg);
+    }
+    for(int t = 0; t < 2 * threads; t++)
+        pthread_join(tids[t], NULL);
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "producers=%d consumers=%d", threads, threads);
+    r.ops = per * threads;
+    bench_report(&r, NULL);
+    llfifo_destroy(arg.fifo);
+}
+
+typedef struct {
+    uint64_t payload[7];
+    llfifo_link_t link;
+} packet_t;
+
+/*
+ * Fills a FIFO with depth packets and drains it, reading each packet
+ * dequeued, until about total packets have gone through. Reports the
+ * time per packet for a presized llfifo (intrusive false) or an
+ * LLFIFO_INTRUSIVE one.
+ */
+static void bench_packets(int depth, int intrusive, long total)
+{
+    bench_result_t r = { .suite = "llfifo", .name = intrusive ? "packets intrusive" : "packets" };
+    packet_t *packets = (packet_t *)malloc(depth * sizeof(packet_t));
+    llfifo_t *fifo = intrusive ? llfifo_create_intrusive(offsetof(packet_t, link))
+        : llfifo_create(depth);
+    long reps = total / depth;
+    uint64_t sum = 0;
+
+    if(packets == NULL || fifo == NULL) {
+        printf("bench_packets setup failed\n");
+        free(packets);
+        return;
+    }
+    if(reps < 1)
+        reps = 1;
+    for(int i = 0; i < depth; i++)
+        packets[i].payload[0] = i;
+
+    uint64_t start = bench_now_ns();
+    for(long rep = 0; rep < reps; rep++) {
+        for(int i = 0; i < depth; i++)
+            llfifo_enqueue(fifo, &packets[i]);
+        for(int i = 0; i < depth; i++)
+            sum += ((packet_t *)llfifo_dequeue(fifo))->payload[0];
+    }
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    // Keep the reads from being optimized away
+    if(sum == 1)
+        printf("\n");
+    snprintf(r.params, sizeof(r.params), "depth=%d", depth);
+    r.ops = reps * depth;
+    bench_report(&r, NULL);
+    llfifo_destroy(fifo);
+    free(packets);
+}
+
+void bench_llfifo(const bench_opts_t *opts)
+{
+    const int depths[] = { 10, 1000, 100000, 1000000 };
+    const int quick_depths[] = { 10, 1000, 10000 };
+    const int *list = opts->quick ? quick_depths : depths;
+    const int num_depths = opts->quick ? 3 : sizeof(depths) / sizeof(depths[0]);
+    long total = opts->quick ? BENCH_LL_OPS / 20 : BENCH_LL_OPS;
+
+    // Block-based and LLFIFO_ARRAY side by side, up to 10M deep
+    const int fill_depths[] = { 10, 1000, 100000, 1000000, 10000000 };
+    const int num_fill = opts->quick ? 3 : sizeof(fill_depths) / sizeof(fill_depths[0]);
+    for(int d = 0; d < num_fill; d++) {
+        int depth = opts->quick ? list[d] : fill_depths[d];
+        for(int p = PRESIZED; p <= REGROWN; p++) {
+            bench_depth((pattern_t)p, depth, total, 0);
+            bench_depth((pattern_t)p, depth, total, LLFIFO_ARRAY);
+        }
+    }
+
+    for(int d = 0; d < num_depths; d++) {
+        bench_packets(list[d], 0, total);
+        bench_packets(list[d], 1, total);
+    }
+
+    const int batches[] = { 16, 256, 4096 };
+    for(int b = 0; b < 3; b++) {
+        bench_batch(batches[b], 0, total);
+        bench_batch(batches[b], 1, total);
+    }
+
+    long mpsc_total = opts->quick ? BENCH_MPSC_OPS / 10 : BENCH_MPSC_OPS;
+    for(int p = 1; p <= BENCH_MAX_PRODUCERS; p *= 2) {
+        bench_producers(p, 1, mpsc_total);
+        bench_producers(p, 0, mpsc_total);
+    }
+    for(int t = 1; t <= BENCH_MAX_PRODUCERS / 2; t *= 2) {
+        bench_mpmc(t, 1, mpsc_total);
+        bench_mpmc(t, 0, mpsc_total);
+    }
+
+    for(int d = 0; d < num_depths; d++) {
+        int reps = total / list[d];
+        bench_lifecycle(list[d], reps < 10 ? 10 : reps > 10000 ? 10000 : reps);
+    }
+}
@@ -0,0 +1,214 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file bench_mpmcfifo.c
+ * @brief Benchmarks for the bounded multi-producer, multi-consumer FIFO
+ * in mpmcfifo.c
+ *
+ * Streams elements from N producer threads to N consumer threads
+ * through an mpmcfifo, with the polling calls and with the waiting
+ * ones, next to an llfifo behind a mutex and an LLFIFO_MPMC llfifo
+ * doing the same work.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "bench.h"
+#include "mpmcfifo.h"
+#include "llfifo.h"
+
+// Elements moved through the FIFO for each measurement
+#define BENCH_MPMC_OPS      1000000
+#define BENCH_MAX_PAIRS     32
+// Capacity of the bounded FIFOs
+#define BENCH_MPMC_SLOTS    1024
+
+typedef enum { RING, RING_WAIT, LL_MUTEX, LL_MPMC } kind_t;
+
+static const char *kind_names[] = {
+    "stream poll", "stream wait", "llfifo mutex", "llfifo mpmc"
+};
+
+typedef struct {
+    kind_t kind;
+    mpmcfifo_t *ring;
+    llfifo_t *list;
+    pthread_mutex_t lock;
+    long count;             // elements per producer
+    _Atomic long left;      // elements still to be dequeued
+} stream_t;
+
+static void *stream_producer(void *p)
+{
+    stream_t *s = (stream_t *)p;
+    static char element;
+    int spins = 0;
+
+    for(long i = 0; i < s->count; i++) {
+        switch(s->kind) {
+        case RING:
+            while(mpmcfifo_enqueue(s->ring, &element) < 0)
+                bench_backoff(&spins);
+            break;
+        case RING_WAIT:
+            mpmcfifo_enqueue_wait(s->ring, &element, -1);
+            break;
+        case LL_MUTEX:
+            pthread_mutex_lock(&s->lock);
+            llfifo_enqueue(s->list, &element);
+            pthread_mutex_unlock(&s->lock);
+            break;
+        case LL_MPMC:
+            llfifo_enqueue(s->list, &element);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void *stream_consumer(void *p)
+{
+    stream_t *s = (stream_t *)p;
+    int spins = 0;
+
+    while(atomic_load_explicit(&s->left, memory_order_relaxed) > 0) {
+        void *e;
+        switch(s->kind) {
+        case RING:
+            e = mpmcfifo_dequeue(s->ring);
+            break;
+        case RING_WAIT:
+            // Time out now and then to notice that the others finished
+            e = mpmcfifo_dequeue_wait(s->ring, 1000);
+            break;
+        case LL_MUTEX:
+            pthread_mutex_lock(&s->lock);
+            e = llfifo_dequeue(s->list);
+            pthread_mutex_unlock(&s->lock);
+            break;
+        default:
+            e = llfifo_dequeue(s->list);
+            break;
+        }
+        if(e)
+            atomic_fetch_sub_explicit(&s->left, 1, memory_order_relaxed);
+        else if(s->kind != RING_WAIT)
+            bench_backoff(&spins);
+    }
+    return NULL;
+}
+
+/*
+ * Streams about total elements from pairs producers to as many
+ * consumers through a FIFO of the given kind, and reports the
+ * throughput
+ */
+static void bench_stream(kind_t kind, int pairs, long total)
+{
+    bench_result_t r = { .suite = "mpmcfifo", .name = kind_names[kind] };
+    pthread_t tids[2 * BENCH_MAX_PAIRS];
+    stream_t s;
+
+    s.kind = kind;
+    s.ring = NULL;
+    s.list = NULL;
+    pthread_mutex_init(&s.lock, NULL);
+    s.count = total / pairs;
+    atomic_init(&s.left, s.count * pairs);
+    if(kind == RING || kind == RING_WAIT)
+        s.ring = mpmcfifo_create(BENCH_MPMC_SLOTS);
+    else
+        s.list = llfifo_create_ex(BENCH_MPMC_SLOTS, (kind == LL_MPMC) ? LLFIFO_MPMC : 0);
+    if(s.ring == NULL && s.list == NULL) {
+        printf("bench_stream setup failed\n");
+        return;
+    }
+
+    uint64_t start = bench_now_ns();
+    for(int t = 0; t < pairs; t++) {
+        pthread_create(&tids[t], NULL, stream_consumer, &s);
+        pthread_create(&tids[pairs + t], NULL, stream_producer, &s);
+    }
+    for(int t = 0; t < 2 * pairs; t++)
+        pthread_join(tids[t], NULL);
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "producers=%d consumers=%d", pairs, pairs);
+    r.ops = s.count * pairs;
+    bench_report(&r, NULL);
+
+    mpmcfifo_destroy(s.ring);
+    if(s.list)
+        llfifo_destroy(s.list);
+    pthread_mutex_destroy(&s.lock);
+}
+
+
+/*
+ * Times single-threaded enqueue and dequeue calls on an mpmcfifo kept
+ * half full, to show the cost of the atomics when nothing contends
+ */
+static void bench_uncontended(long total)
+{
+    bench_result_t enq = { .suite = "mpmcfifo", .name = "enqueue" };
+    bench_result_t deq = { .suite = "mpmcfifo", .name = "dequeue" };
+    bench_lat_t enq_lat, deq_lat;
+    mpmcfifo_t *fifo = mpmcfifo_create(BENCH_MPMC_SLOTS);
+    static char element;
+    uint64_t enq_ns = 0, deq_ns = 0;
+
+    if(fifo == NULL || bench_lat_init(&enq_lat, total) < 0 || bench_lat_init(&deq_lat, total) < 0) {
+        printf("bench_uncontended setup failed\n");
+        mpmcfifo_destroy(fifo);
+        return;
+    }
+
+    for(int i = 0; i < BENCH_MPMC_SLOTS / 2; i++)
+        mpmcfifo_enqueue(fifo, &element);
+    for(long i = 0; i < total; i++) {
+        uint64_t t0 = bench_now_ns();
+        mpmcfifo_enqueue(fifo, &element);
+        uint64_t t1 = bench_now_ns();
+        mpmcfifo_dequeue(fifo);
+        uint64_t t2 = bench_now_ns();
+        bench_lat_add(&enq_lat, t1 - t0);
+        bench_lat_add(&deq_lat, t2 - t1);
+        enq_ns += t1 - t0;
+        deq_ns += t2 - t1;
+    }
+
+    snprintf(enq.params, sizeof(enq.params), "depth=%d", BENCH_MPMC_SLOTS / 2);
+    snprintf(deq.params, sizeof(deq.params), "depth=%d", BENCH_MPMC_SLOTS / 2);
+    enq.ops = deq.ops = total;
+    enq.seconds = enq_ns * 1e-9;
+    deq.seconds = deq_ns * 1e-9;
+    bench_report(&enq, &enq_lat);
+    bench_report(&deq, &deq_lat);
+
+    bench_lat_free(&enq_lat);
+    bench_lat_free(&deq_lat);
+    mpmcfifo_destroy(fifo);
+}
+
+
+void bench_mpmcfifo(const bench_opts_t *opts)
+{
+    long total = opts->quick ? BENCH_MPMC_OPS / 10 : BENCH_MPMC_OPS;
+
+    bench_uncontended(opts->quick ? 20000 : 200000);
+    for(int p = 1; p <= BENCH_MAX_PAIRS; p *= 2)
+        for(int k = RING; k <= LL_MPMC; k++)
+            bench_stream((kind_t)k, p, total);
+}
@@ -0,0 +1,156 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file bench_shardq.c
+ * @brief Benchmarks for the per-core sharded queue in shardq.c
+ *
+ * Runs a pool of 1 up to one thread per online CPU, each handing out
+ * and taking back work items through the queue, and compares a shardq
+ * with a single llfifo behind one mutex. Also drains a queue whose
+ * work all went to one shard, so every item has to be stolen.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "shardq.h"
+#include "llfifo.h"
+
+// Work items each thread enqueues and dequeues, for each measurement
+#define BENCH_SHARDQ_OPS    1000000
+// Items enqueued before they are taken back
+#define BENCH_SHARDQ_BURST  8
+#define BENCH_SHARDQ_MAX    256
+
+typedef struct {
+    shardq_t *q;            // NULL for the locked llfifo
+    llfifo_t *fifo;
+    pthread_mutex_t lock;
+    long count;
+} pool_t;
+
+static void *pool_worker(void *p)
+{
+    pool_t *pool = (pool_t *)p;
+    static char element;
+
+    for(long i = 0; i < pool->count; i += BENCH_SHARDQ_BURST) {
+        if(pool->q) {
+            for(int j = 0; j < BENCH_SHARDQ_BURST; j++)
+                shardq_enqueue(pool->q, &element);
+            for(int j = 0; j < BENCH_SHARDQ_BURST; j++)
+                shardq_dequeue(pool->q);
+        } else {
+            for(int j = 0; j < BENCH_SHARDQ_BURST; j++) {
+                pthread_mutex_lock(&pool->lock);
+                llfifo_enqueue(pool->fifo, &element);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            for(int j = 0; j < BENCH_SHARDQ_BURST; j++) {
+                pthread_mutex_lock(&pool->lock);
+                llfifo_dequeue(pool->fifo);
+                pthread_mutex_unlock(&pool->lock);
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Runs threads workers, each moving count items through a shardq
+ * (sharded is true) or a locked llfifo, and reports the throughput
+ */
+static void bench_pool(int threads, int sharded, long count)
+{
+    bench_result_t r = { .suite = "shardq", .name = sharded ? "pool sharded" : "pool one lock" };
+    pthread_t tids[BENCH_SHARDQ_MAX];
+    pool_t pool;
+
+    pool.q = sharded ? shardq_create(0, BENCH_SHARDQ_BURST * threads) : NULL;
+    pool.fifo = sharded ? NULL : llfifo_create(BENCH_SHARDQ_BURST * threads);
+    pthread_mutex_init(&pool.lock, NULL);
+    pool.count = count;
+    if(pool.q == NULL && pool.fifo == NULL) {
+        printf("bench_pool setup failed\n");
+        return;
+    }
+
+    uint64_t start = bench_now_ns();
+    for(int t = 0; t < threads; t++)
+        pthread_create(&tids[t], NULL, pool_worker, &pool);
+    for(int t = 0; t < threads; t++)
+        pthread_join(tids[t], NULL);
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "threads=%d", threads);
+    r.ops = 2 * count * threads;
+    bench_report(&r, NULL);
+
+    shardq_destroy(pool.q);
+    if(pool.fifo)
+        llfifo_destroy(pool.fifo);
+    pthread_mutex_destroy(&pool.lock);
+}
+
+/*
+ * Fills one shard of a queue with n items, then times taking them all
+ * from a thread whose own shard is another one
+ */
+static void bench_steal(int shards, long n)
+{
+    bench_result_t r = { .suite = "shardq", .name = "steal" };
+    shardq_t *q = shardq_create(shards, 0);
+    static char element;
+
+    if(q == NULL) {
+        printf("bench_steal setup failed\n");
+        return;
+    }
+    int victim = (shardq_self(q) + shards - 1) % shards;
+    for(long i = 0; i < n; i++)
+        shardq_enqueue_to(q, victim, &element);
+
+    uint64_t start = bench_now_ns();
+    for(long i = 0; i < n; i++)
+        shardq_dequeue(q);
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "shards=%d", shards);
+    r.ops = n;
+    bench_report(&r, NULL);
+    shardq_destroy(q);
+}
+
+
+void bench_shardq(const bench_opts_t *opts)
+{
+    long count = opts->quick ? BENCH_SHARDQ_OPS / 10 : BENCH_SHARDQ_OPS;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cpus < 1)
+        cpus = 1;
+    if(cpus > BENCH_SHARDQ_MAX)
+        cpus = BENCH_SHARDQ_MAX;
+
+    // 1, 2, 4, ... threads, ending with one per CPU
+    for(int t = 1; ; t = (2 * t < cpus) ? 2 * t : (int)cpus) {
+        bench_pool(t, 1, count);
+        bench_pool(t, 0, count);
+        if(t == cpus)
+            break;
+    }
+
+    for(int s = 2; s <= 64; s *= 4)
+        bench_steal(s, count);
+}
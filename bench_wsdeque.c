@@ -0,0 +1,202 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file bench_wsdeque.c
+ * @brief Benchmarks for the work-stealing deque in wsdeque.c and the
+ * executor in executor.c
+ *
+ * Times the owner's push and pop on an uncontended wsdeque, next to
+ * llfifo_enqueue() and llfifo_dequeue(). Then runs a tree of tiny tasks,
+ * each submitting two more, on the executor and on a plain pool whose
+ * workers share one llfifo behind a mutex, from 1 worker up to one per
+ * online CPU.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "wsdeque.h"
+#include "executor.h"
+#include "llfifo.h"
+
+// Elements pushed and popped for the uncontended measurement
+#define BENCH_WS_OPS        4000000
+// Depth of the task tree: 2^(depth + 1) - 1 tasks
+#define BENCH_WS_DEPTH      19
+#define BENCH_WS_MAX        256
+
+/*
+ * Pushes and pops batches of 64 elements on a deque (or an llfifo)
+ * from its owner, and reports the time per push plus pop
+ */
+static void bench_owner(int deque, long total)
+{
+    bench_result_t r = { .suite = "wsdeque", .name = deque ? "push+pop" : "llfifo enq+deq" };
+    wsdeque_t *dq = deque ? wsdeque_create(64) : NULL;
+    llfifo_t *fifo = deque ? NULL : llfifo_create(64);
+    static char element;
+
+    if(dq == NULL && fifo == NULL) {
+        printf("bench_owner setup failed\n");
+        return;
+    }
+
+    uint64_t start = bench_now_ns();
+    for(long i = 0; i < total; i += 64) {
+        if(deque) {
+            for(int j = 0; j < 64; j++)
+                wsdeque_push(dq, &element);
+            for(int j = 0; j < 64; j++)
+                wsdeque_pop(dq);
+        } else {
+            for(int j = 0; j < 64; j++)
+                llfifo_enqueue(fifo, &element);
+            for(int j = 0; j < 64; j++)
+                llfifo_dequeue(fifo);
+        }
+    }
+    r.seconds = (bench_now_ns() - start) * 1e-9;
+
+    snprintf(r.params, sizeof(r.params), "batch=64");
+    r.ops = total;
+    bench_report(&r, NULL);
+    wsdeque_destroy(dq);
+    if(fifo)
+        llfifo_destroy(fifo);
+}
+
+
+/*
+ * The task tree, on the executor: each task submits two children until
+ * depth runs out. The depth is carried in the argument pointer, so no
+ * task allocates anything of its own.
+ */
+static executor_t *tree_exec;
+
+static void tree_task(void *arg)
+{
+    intptr_t depth = (intptr_t)arg;
+    if(depth > 0) {
+        executor_submit(tree_exec, tree_task, (void *)(depth - 1));
+        executor_submit(tree_exec, tree_task, (void *)(depth - 1));
+    }
+}
+
+/*
+ * The same tree on a plain pool sharing one locked llfifo. Elements
+ * are depth + 1, so none is NULL; pending counts tasks not yet run.
+ */
+typedef struct {
+    llfifo_t *fifo;
+    pthread_mutex_t lock;
+    _Atomic long pending;
+} pool_t;
+
+static void *pool_worker(void *p)
+{
+    pool_t *pool = (pool_t *)p;
+    int spins = 0;
+
+    while(atomic_load_explicit(&pool->pending, memory_order_acquire) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        intptr_t task = (intptr_t)llfifo_dequeue(pool->fifo);
+        pthread_mutex_unlock(&pool->lock);
+        if(task == 0) {
+            bench_backoff(&spins);
+            continue;
+        }
+        intptr_t depth = task - 1;
+        if(depth > 0) {
+            atomic_fetch_add_explicit(&pool->pending, 2, memory_order_relaxed);
+            pthread_mutex_lock(&pool->lock);
+            llfifo_enqueue(pool->fifo, (void *)depth);
+            llfifo_enqueue(pool->fifo, (void *)depth);
+            pthread_mutex_unlock(&pool->lock);
+        }
+        atomic_fetch_sub_explicit(&pool->pending, 1, memory_order_release);
+    }
+    return NULL;
+}
+
+/*
+ * Runs the tree of depth on workers threads, on the executor (stealing
+ * is true) or the locked llfifo pool, and reports the time per task
+ */
+static void bench_tree(int workers, int stealing, int depth)
+{
+    bench_result_t r = { .suite = "wsdeque", .name = stealing ? "tasks executor" : "tasks one llfifo" };
+    uint64_t start;
+
+    if(stealing) {
+        tree_exec = executor_create(workers);
+        if(tree_exec == NULL) {
+            printf("executor_create failed\n");
+            return;
+        }
+        start = bench_now_ns();
+        executor_submit(tree_exec, tree_task, (void *)(intptr_t)depth);
+        executor_wait(tree_exec);
+        r.seconds = (bench_now_ns() - start) * 1e-9;
+        executor_destroy(tree_exec);
+    } else {
+        pthread_t tids[BENCH_WS_MAX];
+        pool_t pool;
+        pool.fifo = llfifo_create(1024);
+        if(pool.fifo == NULL) {
+            printf("llfifo_create failed\n");
+            return;
+        }
+        pthread_mutex_init(&pool.lock, NULL);
+        atomic_init(&pool.pending, 1);
+        llfifo_enqueue(pool.fifo, (void *)(intptr_t)(depth + 1));
+
+        start = bench_now_ns();
+        for(int t = 0; t < workers; t++)
+            pthread_create(&tids[t], NULL, pool_worker, &pool);
+        for(int t = 0; t < workers; t++)
+            pthread_join(tids[t], NULL);
+        r.seconds = (bench_now_ns() - start) * 1e-9;
+        pthread_mutex_destroy(&pool.lock);
+        llfifo_destroy(pool.fifo);
+    }
+
+    snprintf(r.params, sizeof(r.params), "workers=%d depth=%d", workers, depth);
+    r.ops = (2L << depth) - 1;
+    bench_report(&r, NULL);
+}
+
+
+void bench_wsdeque(const bench_opts_t *opts)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int depth = opts->quick ? BENCH_WS_DEPTH - 4 : BENCH_WS_DEPTH;
+    if(cpus < 1)
+        cpus = 1;
+    if(cpus > BENCH_WS_MAX)
+        cpus = BENCH_WS_MAX;
+
+    bench_owner(1, opts->quick ? BENCH_WS_OPS / 10 : BENCH_WS_OPS);
+    bench_owner(0, opts->quick ? BENCH_WS_OPS / 10 : BENCH_WS_OPS);
+
+    // 1, 2, 4, ... workers, ending with one per CPU
+    for(int w = 1; ; w = (2 * w < cpus) ? 2 * w : (int)cpus) {
+        bench_tree(w, 1, depth);
+        bench_tree(w, 0, depth);
+        if(w == cpus)
+            break;
+    }
+}
@@ -29,229 +29,1639 @@
 #ifndef _CBFIFO_C_
 #define _CBFIFO_C_
 
+// For memfd_create()
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
 #include "cbfifo.h"
 
 
-// Checks for Global Bool Status
-bool created = false;
+// Checks for Global Bool Status
+bool created = false;
+
+// Size of a cache line, used to keep the producer and consumer
+// indices from sharing one
+#define CBFIFO_CACHELINE 64
+
+// Bounds for the number of times a blocking call polls before sleeping
+#define CBFIFO_SPIN_MIN  16
+#define CBFIFO_SPIN_MAX  4096
+
+/*
+ * Definition
+ *
+ * head counts bytes ever enqueued and tail bytes ever dequeued, so the
+ * stored length is always head - tail. head is only written by the
+ * producer and tail only by the consumer; each is published with a
+ * release store and read by the other side with an acquire load, which
+ * makes a CBFIFO_SPSC ring safe across two threads without locks.
+ * Each side also keeps a private copy of the other side's index and
+ * only reloads it when the copy says the ring is full (or empty), so
+ * the shared cache line is touched once per wrap rather than per call.
+ *
+ * A CBFIFO_MPSC ring has many producers, so the private tail_cache is
+ * not used. Instead each producer claims its bytes by advancing
+ * reserve, copies them in, and then waits for head to reach the start
+ * of its claim before moving head past it. head is thus the count of
+ * bytes published in claim order, and the consumer side is unchanged.
+ *
+ * On a CBFIFO_OVERWRITE ring the producer moves tail as well, to drop
+ * the oldest bytes, so both sides move it with a compare-and-swap. The
+ * consumer copies bytes out first and then tries to move tail past
+ * them; if the producer got there first, the copy may be torn and is
+ * thrown away, as a seqlock reader would.
+ */
+struct cbfifo_s { 
+    uint8_t * buff;
+    size_t size;
+    // size - 1 when the size is a power of two (CBFIFO_POW2)
+    size_t mask;
+    unsigned flags;
+
+    // Producer side
+    _Alignas(CBFIFO_CACHELINE) _Atomic size_t head;
+    size_t tail_cache;
+    // Bytes and messages dropped to make room (CBFIFO_OVERWRITE)
+    _Atomic size_t dropped_bytes;
+    _Atomic size_t dropped_msgs;
+
+    // Bytes ever claimed by producers (CBFIFO_MPSC), kept off the head
+    // line so claims do not slow the consumer's reads of head
+    _Alignas(CBFIFO_CACHELINE) _Atomic size_t reserve;
+
+    // Consumer side
+    _Alignas(CBFIFO_CACHELINE) _Atomic size_t tail;
+    size_t head_cache;
+    // tail as the consumer last saw it, which cbfifo_consume() removes
+    // from so it notices bytes dropped since cbfifo_peek()
+    // (CBFIFO_OVERWRITE)
+    size_t peek_tail;
+
+    // Blocking support (CBFIFO_BLOCKING), see cbfifo_wait_for(). The
+    // consumer sleeps on data_seq and the producer on space_seq; the
+    // waiters counts let the other side skip the wake-up syscall when
+    // nobody is asleep.
+    _Alignas(CBFIFO_CACHELINE) _Atomic uint32_t data_seq;
+    _Atomic uint32_t data_waiters;
+    _Atomic uint32_t space_seq;
+    _Atomic uint32_t space_waiters;
+    // Adaptive spin counts, owned by the consumer and producer
+    unsigned data_spin, space_spin;
+}; 
+
+// Default instance behind the legacy cbfifo_*() functions
+cbfifo_t my_fifo;
+uint8_t CBbuffer[SIZE];
+
+
+/*
+ * Maps a running count onto an offset in the ring. In CBFIFO_POW2 mode
+ * the counts run freely and are masked. Otherwise the dequeue path keeps
+ * tail below size (and so head below 2 * size), which lets a single
+ * subtraction stand in for the modulo.
+ */
+static inline size_t cbfifo_index(const cbfifo_t *fifo, size_t pos)
+{
+    if(fifo->flags & CBFIFO_POW2)
+        return pos & fifo->mask;
+    return (pos >= fifo->size) ? pos - fifo->size : pos;
+}
+
+/*
+ * Returns how many bytes from offset off can be accessed as one span.
+ * A CBFIFO_MIRROR ring is mapped twice back to back, so any span of up
+ * to size bytes is contiguous; otherwise a span ends at the end of the
+ * ring.
+ */
+static inline size_t cbfifo_run(const cbfifo_t *fifo, size_t off)
+{
+    if(fifo->flags & CBFIFO_MIRROR)
+        return fifo->size;
+    return fifo->size - off;
+}
+
+#ifdef __linux__
+/*
+ * Maps the same pages twice, back to back, to back a CBFIFO_MIRROR
+ * ring. Rounds *size up to a whole number of pages. Returns NULL if
+ * *size is under one page or the mapping cannot be made, in which case
+ * the caller falls back to a plain array.
+ */
+static uint8_t *cbfifo_map_mirror(size_t *size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if(*size < page || *size > SIZE_MAX / 2 - page)
+        return NULL;
+    size_t len = (*size + page - 1) / page * page;
+
+    int fd = memfd_create("cbfifo", MFD_CLOEXEC);
+    if(fd < 0)
+        return NULL;
+    if(ftruncate(fd, len) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // Reserve both halves first, so nothing else can land in between
+    uint8_t *base = (uint8_t*)mmap(NULL, 2 * len, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if(mmap(base, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+       mmap(base + len, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * len);
+        close(fd);
+        return NULL;
+    }
+
+    // The mappings keep the memory alive
+    close(fd);
+    *size = len;
+    return base;
+}
+#else
+static uint8_t *cbfifo_map_mirror(size_t *size)
+{
+    (void)size;
+    return NULL;
+}
+#endif
+
+// Helper Function
+static bool cbfifo_is_empty(cbfifo_t *fifo)
+{
+	assert(fifo);
+    return (cbfifo_length_of(fifo) == 0);
+}
+
+// Helper Function to point a FIFO at its ring and empty it
+static void cbfifo_init(cbfifo_t *fifo, uint8_t *buff, size_t size, unsigned flags)
+{
+    fifo->buff = buff;
+    // Size of buffer
+    fifo->size = size;
+    fifo->mask = size - 1;
+    fifo->flags = flags;
+
+    // Helper Pointers for circular buffer 
+    atomic_init(&fifo->head, 0);
+    atomic_init(&fifo->tail, 0);
+    atomic_init(&fifo->reserve, 0);
+    atomic_init(&fifo->dropped_bytes, 0);
+    atomic_init(&fifo->dropped_msgs, 0);
+    fifo->tail_cache = 0;
+    fifo->head_cache = 0;
+    fifo->peek_tail = 0;
+
+    atomic_init(&fifo->data_seq, 0);
+    atomic_init(&fifo->data_waiters, 0);
+    atomic_init(&fifo->space_seq, 0);
+    atomic_init(&fifo->space_waiters, 0);
+    fifo->data_spin = CBFIFO_SPIN_MIN;
+    fifo->space_spin = CBFIFO_SPIN_MIN;
+}
+
+void cbfifo_create() {
+    for(int i = 0; i < SIZE; i++)
+        CBbuffer[i] = 0;
+    cbfifo_init(&my_fifo, CBbuffer, SIZE, (SIZE & (SIZE - 1)) ? 0 : CBFIFO_POW2);
+    created = true;
+}
+
+
+/*
+ * Creates a new FIFO with its own ring of the requested capacity
+ *
+ * Parameters:
+ *   capacity  Size of the ring, in bytes
+ * 
+ * Returns:
+ *   A pointer to a cbfifo_t, or NULL in case of an error.
+ */
+cbfifo_t *cbfifo_new(size_t capacity) {
+    return cbfifo_new_ex(capacity, 0);
+}
+
+
+/*
+ * Creates a new FIFO, with options
+ *
+ * Parameters:
+ *   capacity  Size of the ring, in bytes
+ *   flags     Bitwise OR of CBFIFO_* options, or 0
+ * 
+ * Returns:
+ *   A pointer to a cbfifo_t, or NULL in case of an error.
+ */
+cbfifo_t *cbfifo_new_ex(size_t capacity, unsigned flags) {
+    if(capacity == 0)
+        return NULL;
+
+    // Waiting only makes sense with the other side on another thread
+    if((flags & CBFIFO_BLOCKING) && !(flags & CBFIFO_MPSC))
+        flags |= CBFIFO_SPSC;
+
+    // Both sides may run at once only if neither rewrites the other's
+    // index, which the non power of two wrap in cbfifo_advance_tail() does
+    if(flags & (CBFIFO_SPSC | CBFIFO_MPSC | CBFIFO_OVERWRITE))
+        flags |= CBFIFO_POW2;
+
+    // Producers claim room in turn, which dropping bytes would undo
+    if((flags & CBFIFO_MPSC) && (flags & CBFIFO_OVERWRITE))
+        return NULL;
+
+    if(flags & CBFIFO_POW2) {
+        // Round up to the next power of two
+        size_t size = 1;
+        while(size < capacity) {
+            if(size > SIZE_MAX / 2)
+                return NULL;
+            size <<= 1;
+        }
+        capacity = size;
+    }
+    if(capacity > SIZE_MAX - sizeof(cbfifo_t) - CBFIFO_CACHELINE)
+        return NULL;
+
+    uint8_t *mirror = NULL;
+    if(flags & CBFIFO_MIRROR) {
+        mirror = cbfifo_map_mirror(&capacity);
+        if(mirror == NULL)
+            flags &= ~CBFIFO_MIRROR;
+    }
+
+    // Unless mirrored, the ring is allocated in the same block, right
+    // after the struct. The block is cache line aligned for the index
+    // fields.
+    size_t bytes = sizeof(cbfifo_t) + (mirror ? 0 : capacity);
+    bytes = (bytes + CBFIFO_CACHELINE - 1) & ~(size_t)(CBFIFO_CACHELINE - 1);
+    cbfifo_t *fifo = (cbfifo_t*)aligned_alloc(CBFIFO_CACHELINE, bytes);
+    if(fifo == NULL) {
+        if(mirror)
+            munmap(mirror, 2 * capacity);
+        return NULL;
+    }
+
+    cbfifo_init(fifo, mirror ? mirror : (uint8_t*)(fifo + 1), capacity, flags);
+    return fifo;
+}
+
+
+/*
+ * Teardown function. Frees the ring and the FIFO itself. After calling
+ * this function, the fifo should not be used again!
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   none
+ */
+void cbfifo_free(cbfifo_t *fifo) {
+    // The default instance is statically allocated
+    if(fifo == NULL || fifo == &my_fifo)
+        return;
+    if(fifo->flags & CBFIFO_MIRROR)
+        munmap(fifo->buff, 2 * fifo->size);
+    free(fifo);
+}
+
+
+/*
+ * Returns the options in effect for the given FIFO
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   Bitwise OR of CBFIFO_* options. CBFIFO_MIRROR is cleared if the
+ * FIFO fell back to a plain array.
+ */
+unsigned cbfifo_flags_of(cbfifo_t *fifo) {
+    assert(fifo);
+    return fifo->flags;
+}
+
+
+/*
+ * Returns the default FIFO used by the legacy cbfifo_*() functions,
+ * creating it on first use
+ *
+ * Parameters:
+ *   none
+ * 
+ * Returns:
+ *   A pointer to the default cbfifo_t
+ */
+cbfifo_t *cbfifo_default() {
+    if (!created) {
+    cbfifo_create(); 
+    }
+    return &my_fifo;
+}
+
+#ifdef __linux__
+/*
+ * Sleeps while *addr still holds val, for at most timeout (or forever
+ * if NULL). Returns early on a wake-up, a signal or a changed value.
+ */
+static void cbfifo_futex_wait(_Atomic uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+// Wakes every thread sleeping on addr
+static void cbfifo_futex_wake(_Atomic uint32_t *addr)
+{
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
+#else
+// Without futexes, sleeping is a yield and waking is implicit
+static void cbfifo_futex_wait(_Atomic uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    (void)addr; (void)val; (void)timeout;
+    sched_yield();
+}
+
+static void cbfifo_futex_wake(_Atomic uint32_t *addr)
+{
+    (void)addr;
+}
+#endif
+
+// Tells the CPU we are in a polling loop
+static inline void cbfifo_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+/*
+ * Called after publishing an index on a CBFIFO_BLOCKING ring: wakes the
+ * other side if it is asleep. The fence orders the index store before
+ * the waiters load, pairing with the fence in cbfifo_wait_for(), so
+ * either the sleeper sees the new index or we see the sleeper.
+ */
+static void cbfifo_notify(cbfifo_t *fifo, _Atomic uint32_t *seq, _Atomic uint32_t *waiters)
+{
+    if(!(fifo->flags & CBFIFO_BLOCKING))
+        return;
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(waiters, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(seq, 1, memory_order_release);
+        cbfifo_futex_wake(seq);
+    }
+}
+
+/*
+ * Producer side: returns the free space in the ring, given the
+ * producer's own head. The consumer's tail is only reloaded when the
+ * cached copy does not show at least want bytes free.
+ */
+static size_t cbfifo_space(cbfifo_t *fifo, size_t head, size_t want)
+{
+    size_t space = fifo->size - (head - fifo->tail_cache);
+    if(space < want) {
+        fifo->tail_cache = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+        space = fifo->size - (head - fifo->tail_cache);
+    }
+    return space;
+}
+
+/*
+ * Consumer side: returns the bytes stored in the ring, given the
+ * consumer's own tail. The producer's head is only reloaded when the
+ * cached copy does not show at least want bytes stored.
+ */
+static size_t cbfifo_avail(cbfifo_t *fifo, size_t tail, size_t want)
+{
+    size_t avail = fifo->head_cache - tail;
+    // On a CBFIFO_OVERWRITE ring tail may have passed the cached head
+    if(avail < want || avail > fifo->size) {
+        fifo->head_cache = atomic_load_explicit(&fifo->head, memory_order_acquire);
+        avail = fifo->head_cache - tail;
+    }
+    return avail;
+}
+
+/*
+ * Consumer side: loads tail and the bytes stored from it. On a
+ * CBFIFO_OVERWRITE ring the producer may lap the tail we loaded before
+ * head is read, which shows more than the ring holds; that tail is
+ * stale, so load it again.
+ */
+static size_t cbfifo_load_tail(cbfifo_t *fifo, size_t want, size_t *avail)
+{
+    size_t tail;
+    do {
+        tail = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+        *avail = cbfifo_avail(fifo, tail, want);
+    } while(*avail > fifo->size);
+    return tail;
+}
+
+/*
+ * Copies nbyte bytes into the ring at running count pos, as at most two
+ * contiguous spans (up to the end of the ring, then from its start)
+ */
+static void cbfifo_write_at(cbfifo_t *fifo, size_t pos, const uint8_t *data, size_t nbyte)
+{
+    size_t off = cbfifo_index(fifo, pos);
+    size_t first = cbfifo_run(fifo, off);
+    if(first > nbyte)
+        first = nbyte;
+    memcpy(fifo->buff + off, data, first);
+    memcpy(fifo->buff, data + first, nbyte - first);
+}
+
+/*
+ * Producer side: makes the bytes below head visible to the consumer
+ */
+static void cbfifo_publish(cbfifo_t *fifo, size_t head)
+{
+    atomic_store_explicit(&fifo->head, head, memory_order_release);
+    cbfifo_notify(fifo, &fifo->data_seq, &fifo->data_waiters);
+}
+
+/*
+ * Copies nbyte bytes into the ring at head and publishes the new head
+ * once. The caller has checked that the bytes fit.
+ */
+static void cbfifo_copy_in(cbfifo_t *fifo, size_t head, const uint8_t *data, size_t nbyte)
+{
+    cbfifo_write_at(fifo, head, data, nbyte);
+    cbfifo_publish(fifo, head + nbyte);
+}
+
+/*
+ * CBFIFO_MPSC producer side: returns the space not yet claimed by any
+ * producer, given a claim count read after tail
+ */
+static size_t cbfifo_mpsc_space(cbfifo_t *fifo, size_t tail, size_t reserve)
+{
+    size_t used = reserve - tail;
+    return (used < fifo->size) ? fifo->size - used : 0;
+}
+
+/*
+ * CBFIFO_MPSC producer side: claims as many of nbyte bytes of the ring
+ * as are unclaimed, but at least min, setting *start to the running
+ * count of the first one. Returns the number claimed, or 0 without
+ * claiming anything if fewer than min are unclaimed, so a full ring
+ * never leaves a hole in the stream.
+ *
+ * tail is read first, so it can only be behind the claim count read
+ * after it, and the acquire makes the consumer's reads of the freed
+ * bytes happen before we overwrite them.
+ */
+static size_t cbfifo_mpsc_claim(cbfifo_t *fifo, size_t min, size_t nbyte, size_t *start)
+{
+    size_t tail = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+    size_t pos = atomic_load_explicit(&fifo->reserve, memory_order_relaxed);
+    bool fresh = false;
+
+    for(;;) {
+        size_t n = cbfifo_mpsc_space(fifo, tail, pos);
+        if(n > nbyte)
+            n = nbyte;
+        if(n < min) {
+            // Our tail may be stale, look once more before failing
+            if(fresh)
+                return 0;
+            tail = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+            pos = atomic_load_explicit(&fifo->reserve, memory_order_relaxed);
+            fresh = true;
+        } else if(atomic_compare_exchange_weak_explicit(&fifo->reserve, &pos, pos + n,
+                memory_order_relaxed, memory_order_relaxed)) {
+            *start = pos;
+            return n;
+        }
+    }
+}
+
+/*
+ * CBFIFO_MPSC producer side: publishes the claim [start, start + nbyte)
+ * once every earlier claim has been published. Earlier producers are
+ * only copying, so this mostly spins; it yields in case one of them was
+ * preempted. The acquire load chains each producer's bytes to the next
+ * one's release, so the consumer sees all bytes below head.
+ */
+static void cbfifo_mpsc_publish(cbfifo_t *fifo, size_t start, size_t nbyte)
+{
+    unsigned spins = 0;
+
+    while(atomic_load_explicit(&fifo->head, memory_order_acquire) != start) {
+        if(++spins < CBFIFO_SPIN_MIN)
+            cbfifo_cpu_relax();
+        else
+            sched_yield();
+    }
+    cbfifo_publish(fifo, start + nbyte);
+}
+
+/*
+ * Publishes tail advanced by nbyte bytes, freeing them for the producer.
+ * Returns false if a CBFIFO_OVERWRITE producer moved tail first, in
+ * which case the bytes read from tail may have been overwritten.
+ */
+static bool cbfifo_advance_tail(cbfifo_t *fifo, size_t tail, size_t nbyte)
+{
+    if(fifo->flags & CBFIFO_OVERWRITE) {
+        // Pairs with the fence in cbfifo_make_room(): if our reads saw
+        // any byte the producer wrote after moving tail, the swap fails.
+        // The producer never waits for room, so there is nobody to wake.
+        atomic_thread_fence(memory_order_acquire);
+        if(!atomic_compare_exchange_strong_explicit(&fifo->tail, &tail, tail + nbyte,
+            memory_order_release, memory_order_relaxed))
+            return false;
+        fifo->peek_tail = tail + nbyte;
+        return true;
+    }
+
+    tail += nbyte;
+    if(!(fifo->flags & CBFIFO_POW2) && tail >= fifo->size) {
+        // Keep the running counts bounded, see cbfifo_index(). This
+        // rewrites the producer's index, so is single threaded only.
+        size_t head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+        atomic_store_explicit(&fifo->head, head - fifo->size, memory_order_relaxed);
+        fifo->head_cache -= fifo->size;
+        tail -= fifo->size;
+        fifo->tail_cache = tail;
+    }
+    atomic_store_explicit(&fifo->tail, tail, memory_order_release);
+    cbfifo_notify(fifo, &fifo->space_seq, &fifo->space_waiters);
+    return true;
+}
+
+/*
+ * Copies nbyte bytes out of the ring from running count pos, as at
+ * most two contiguous spans
+ */
+static void cbfifo_read_at(cbfifo_t *fifo, size_t pos, uint8_t *data, size_t nbyte)
+{
+    size_t off = cbfifo_index(fifo, pos);
+    size_t first = cbfifo_run(fifo, off);
+    if(first > nbyte)
+        first = nbyte;
+    memcpy(data, fifo->buff + off, first);
+    memcpy(data + first, fifo->buff, nbyte - first);
+}
+
+/*
+ * Copies nbyte bytes out of the ring from tail and publishes the new
+ * tail once. The caller has checked that that many bytes are stored.
+ * Returns false if the copy was overwritten, see cbfifo_advance_tail().
+ */
+static bool cbfifo_copy_out(cbfifo_t *fifo, size_t tail, uint8_t *data, size_t nbyte)
+{
+    cbfifo_read_at(fifo, tail, data, nbyte);
+    return cbfifo_advance_tail(fifo, tail, nbyte);
+}
+
+// Longest varint message header, enough for any size_t
+#define CBFIFO_VARINT_MAX ((sizeof(size_t) * 8 + 6) / 7)
+
+/*
+ * Writes len as a varint: seven bits per byte, low bits first, with the
+ * top bit set on every byte but the last. Messages under 128 bytes
+ * thus cost one header byte. Returns the number of bytes written.
+ */
+static size_t cbfifo_varint_encode(uint8_t *out, size_t len)
+{
+    size_t n = 0;
+    while(len >= 0x80) {
+        out[n++] = (uint8_t)(len | 0x80);
+        len >>= 7;
+    }
+    out[n++] = (uint8_t)len;
+    return n;
+}
+
+/*
+ * Consumer side: reads a varint message header from running count pos,
+ * where avail bytes are stored. Returns the header length and sets
+ * *len, or returns 0 if no complete header is there.
+ */
+static size_t cbfifo_varint_decode(cbfifo_t *fifo, size_t pos, size_t avail, size_t *len)
+{
+    size_t value = 0;
+    for(size_t n = 0; n < avail && n < CBFIFO_VARINT_MAX; n++) {
+        uint8_t byte = fifo->buff[cbfifo_index(fifo, pos + n)];
+        value |= (size_t)(byte & 0x7f) << (7 * n);
+        if(!(byte & 0x80)) {
+            *len = value;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * CBFIFO_OVERWRITE producer side: moves tail far enough past the oldest
+ * bytes that nbyte more fit at head, counting what was dropped. With
+ * CBFIFO_MSG, tail moves over whole messages; their headers are read
+ * from bytes only the producer writes, so a consumer moving tail at the
+ * same time just makes the swap fail and the walk start again.
+ */
+static void cbfifo_make_room(cbfifo_t *fifo, size_t head, size_t nbyte)
+{
+    size_t tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+
+    while(head + nbyte - tail > fifo->size) {
+        size_t need = head + nbyte - tail - fifo->size;
+        size_t drop = need, msgs = 0;
+
+        if(fifo->flags & CBFIFO_MSG) {
+            for(drop = 0; drop < need; msgs++) {
+                size_t len;
+                size_t hlen = cbfifo_varint_decode(fifo, tail + drop, head - tail - drop, &len);
+                assert(hlen > 0);
+                drop += hlen + len;
+            }
+        }
+
+        if(atomic_compare_exchange_weak_explicit(&fifo->tail, &tail, tail + drop,
+                memory_order_relaxed, memory_order_relaxed)) {
+            // Orders the move of tail before the writes that follow, for
+            // a consumer checking its copy in cbfifo_advance_tail()
+            atomic_thread_fence(memory_order_release);
+            atomic_fetch_add_explicit(&fifo->dropped_bytes, drop, memory_order_relaxed);
+            atomic_fetch_add_explicit(&fifo->dropped_msgs, msgs, memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+
+/*
+ * Returns the total length of iovcnt buffers, or -1 if the list is not
+ * valid or the total does not fit a size_t
+ */
+static size_t cbfifo_iov_total(const struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    if(iovcnt < 0 || (iov == NULL && iovcnt > 0))
+        return -1;
+    for(int i = 0; i < iovcnt; i++) {
+        if(iov[i].iov_base == NULL && iov[i].iov_len > 0)
+            return -1;
+        if(iov[i].iov_len > SIZE_MAX - 1 - total)
+            return -1;
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+/*
+ * Copies nbyte bytes, gathered from the buffers after skipping their
+ * first skip bytes, into the ring at running count pos
+ */
+static void cbfifo_writev_at(cbfifo_t *fifo, size_t pos, const struct iovec *iov, int iovcnt,
+    size_t skip, size_t nbyte)
+{
+    for(int i = 0; i < iovcnt && nbyte > 0; i++) {
+        const uint8_t *base = (const uint8_t*)iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        if(skip >= len) {
+            skip -= len;
+            continue;
+        }
+        base += skip;
+        len -= skip;
+        skip = 0;
+        if(len > nbyte)
+            len = nbyte;
+        cbfifo_write_at(fifo, pos, base, len);
+        pos += len;
+        nbyte -= len;
+    }
+}
+
+/*
+ * Copies nbyte bytes out of the ring from running count pos, scattered
+ * over the buffers in order
+ */
+static void cbfifo_readv_at(cbfifo_t *fifo, size_t pos, const struct iovec *iov, int iovcnt,
+    size_t nbyte)
+{
+    for(int i = 0; i < iovcnt && nbyte > 0; i++) {
+        size_t len = iov[i].iov_len;
+        if(len > nbyte)
+            len = nbyte;
+        cbfifo_read_at(fifo, pos, (uint8_t*)iov[i].iov_base, len);
+        pos += len;
+        nbyte -= len;
+    }
+}
+
+/*
+ * Describes the nbyte bytes of the ring from running count pos as one
+ * or two buffers, split where they wrap. Returns the number of buffers.
+ */
+static int cbfifo_spans(cbfifo_t *fifo, size_t pos, size_t nbyte, struct iovec *iov)
+{
+    size_t off = cbfifo_index(fifo, pos);
+    size_t first = cbfifo_run(fifo, off);
+
+    iov[0].iov_base = fifo->buff + off;
+    if(first >= nbyte) {
+        iov[0].iov_len = nbyte;
+        return 1;
+    }
+    iov[0].iov_len = first;
+    iov[1].iov_base = fifo->buff;
+    iov[1].iov_len = nbyte - first;
+    return 2;
+}
+
+/*
+ * Producer side of cbfifo_enqueuev(): enqueues as much of the total
+ * bytes in the buffers as fits, and publishes them at once. Returns
+ * the number of bytes enqueued. A CBFIFO_OVERWRITE ring takes all of
+ * them, keeping only the last capacity bytes if there are more.
+ */
+static size_t cbfifo_gather_in(cbfifo_t *fifo, const struct iovec *iov, int iovcnt, size_t total)
+{
+    size_t head, n;
+
+    if(total == 0)
+        return 0;
+
+    if(fifo->flags & CBFIFO_MPSC) {
+        n = cbfifo_mpsc_claim(fifo, 1, total, &head);
+        if(n > 0) {
+            cbfifo_writev_at(fifo, head, iov, iovcnt, 0, n);
+            cbfifo_mpsc_publish(fifo, head, n);
+        }
+        return n;
+    }
+
+    head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    if(fifo->flags & CBFIFO_OVERWRITE) {
+        // Only the newest bytes of an oversized enqueue can be kept
+        size_t skip = (total > fifo->size) ? total - fifo->size : 0;
+        if(skip)
+            atomic_fetch_add_explicit(&fifo->dropped_bytes, skip, memory_order_relaxed);
+        cbfifo_make_room(fifo, head, total - skip);
+        cbfifo_writev_at(fifo, head, iov, iovcnt, skip, total - skip);
+        cbfifo_publish(fifo, head + total - skip);
+        return total;
+    }
+
+    n = cbfifo_space(fifo, head, total);
+    if(n > total)
+        n = total;
+    if(n > 0) {
+        cbfifo_writev_at(fifo, head, iov, iovcnt, 0, n);
+        cbfifo_publish(fifo, head + n);
+    }
+    return n;
+}
+
+
+/*
+ * Enqueues data onto the given FIFO, if all of it fits. See
+ * cbfifo_enqueue_partial() to enqueue as much as fits instead.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   buf      Pointer to the data
+ *   nbyte    Number of bytes to enqueue
+ * 
+ * Returns:
+ *   nbyte, if the bytes were enqueued. If they do not all fit, nothing
+ * is enqueued and -1 is returned; also -1 in case of an error. A
+ * CBFIFO_OVERWRITE FIFO always takes, and returns, all nbyte bytes.
+ */
+size_t cbfifo_enqueue_to(cbfifo_t *fifo, void *buf, size_t nbyte) {
+
+    assert(fifo);
+    // Checks for assertions 
+    if (buf && (fifo->flags & CBFIFO_MPSC)) {
+        size_t start;
+        if(nbyte == 0)
+            return 0;
+        if(!cbfifo_mpsc_claim(fifo, nbyte, nbyte, &start))
+            return -1;
+        // Other producers copy into their own claims meanwhile
+        cbfifo_write_at(fifo, start, (const uint8_t*)buf, nbyte);
+        cbfifo_mpsc_publish(fifo, start, nbyte);
+        return nbyte;
+    }
+    else if (buf && (fifo->flags & CBFIFO_OVERWRITE)) {
+        // Always takes everything
+        struct iovec iov = { buf, nbyte };
+        return cbfifo_gather_in(fifo, &iov, 1, nbyte);
+    }
+    else if (buf) {
+        size_t head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+
+        // Checks if the bytes to be inserted exceeds the 
+        // max capacity of the Circular Buffer  
+        if(nbyte > cbfifo_space(fifo, head, nbyte)) {
+            // Error Handling 
+            return -1;
+        }
+        // Helper Function call to Enqueue 
+        cbfifo_copy_in(fifo, head, (const uint8_t*)buf, nbyte);
+        return nbyte;
+    }
+    else {
+        return -1;
+    }
+    
+}
+
+
+/*
+ * Attempts to remove ("dequeue") up to nbyte bytes of data from the
+ * given FIFO. Removed data will be copied into the buffer pointed to
+ * by buf.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   buf      Destination for the dequeued data
+ *   nbyte    Bytes of data requested
+ * 
+ * Returns:
+ *   The number of bytes actually copied, which will be between 0 and
+ *  nbyte. In case of an error, returns -1.
+ */
+size_t cbfifo_dequeue_from(cbfifo_t *fifo, void *buf, size_t nbyte) {
+
+    uint8_t *buffer = (uint8_t*) buf;
+    assert(fifo && buffer);
+    size_t tail, len;
+
+    do {
+        // Cannot Dequeue more than is stored
+        tail = cbfifo_load_tail(fifo, nbyte, &len);
+        if(len > nbyte)
+            len = nbyte;
+    } while(len > 0 && !cbfifo_copy_out(fifo, tail, buffer, len));
+
+    // Returns the number of bytes Dequeued 
+    return len;
+}
+
+
+/*
+ * Enqueues as many of nbyte bytes as fit onto the given FIFO
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   buf      Pointer to the data
+ *   nbyte    Max number of bytes to enqueue
+ * 
+ * Returns:
+ *   The number of bytes actually enqueued, from the start of buf, which
+ * could be 0. In case of an error, returns -1.
+ */
+size_t cbfifo_enqueue_partial(cbfifo_t *fifo, const void *buf, size_t nbyte) {
+
+    assert(fifo);
+    if(buf == NULL)
+        return -1;
+    struct iovec iov = { (void*)buf, nbyte };
+    return cbfifo_gather_in(fifo, &iov, 1, nbyte);
+}
+
+
+/*
+ * Gathers data from iovcnt buffers onto the given FIFO, as much as
+ * fits, in order, publishing it to the consumer together
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   iov      The buffers, as for writev()
+ *   iovcnt   Number of buffers, which may be 0
+ * 
+ * Returns:
+ *   The number of bytes actually enqueued, which could be 0. In case
+ * of an error, returns -1.
+ */
+size_t cbfifo_enqueuev(cbfifo_t *fifo, const struct iovec *iov, int iovcnt) {
+
+    assert(fifo);
+    size_t total = cbfifo_iov_total(iov, iovcnt);
+    if(total == (size_t)-1)
+        return -1;
+    return cbfifo_gather_in(fifo, iov, iovcnt, total);
+}
+
+
+/*
+ * Scatters as much data as is stored, up to the total size of iovcnt
+ * buffers, from the given FIFO into those buffers
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   iov      The buffers, as for readv()
+ *   iovcnt   Number of buffers, which may be 0
+ * 
+ * Returns:
+ *   The number of bytes actually copied, which could be 0. In case of
+ * an error, returns -1.
+ */
+size_t cbfifo_dequeuev(cbfifo_t *fifo, const struct iovec *iov, int iovcnt) {
+
+    assert(fifo);
+    size_t total = cbfifo_iov_total(iov, iovcnt);
+    size_t tail, len;
+    if(total == (size_t)-1)
+        return -1;
+
+    // One tail update for all the buffers
+    do {
+        tail = cbfifo_load_tail(fifo, total, &len);
+        if(len > total)
+            len = total;
+        if(len > 0)
+            cbfifo_readv_at(fifo, tail, iov, iovcnt, len);
+    } while(len > 0 && !cbfifo_advance_tail(fifo, tail, len));
+    return len;
+}
 
-// Definition
-typedef struct cbfifo_s { 
-    uint8_t * buff;
-    size_t head, tail;
-    size_t size;
-    bool full_status;
-    size_t storedbytes;
-} cbfifo_t; 
 
-cbfifo_t my_fifo;
-cbfifo_t* fifo = &my_fifo;
-uint8_t CBbuffer[SIZE];
+/*
+ * Reads from a file descriptor straight into the free space of the
+ * given FIFO
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   fd       File descriptor to read, blocking or not
+ *   max      Most bytes to read
+ * 
+ * Returns:
+ *   The number of bytes read, or 0 at end of file or if max is 0. On
+ * failure returns -1 with errno set and nothing enqueued: EAGAIN if a
+ * non-blocking fd has nothing to read, ENOBUFS if the FIFO is full,
+ * EINVAL for a CBFIFO_MPSC FIFO, or the error from readv().
+ */
+size_t cbfifo_read_from_fd(cbfifo_t *fifo, int fd, size_t max) {
 
+    struct iovec iov[2];
+    ssize_t got;
+    assert(fifo);
+    // The space would have to be claimed before knowing how much arrives
+    if(fifo->flags & CBFIFO_MPSC) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(max == 0)
+        return 0;
 
-// Helper Function
-bool cbfifo_empty()
-{
-	assert(fifo);
-    return (!fifo->full_status && (fifo->head == fifo->tail));
+    size_t head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    size_t room = cbfifo_space(fifo, head, max);
+    if(room > max)
+        room = max;
+    if(room == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    int cnt = cbfifo_spans(fifo, head, room, iov);
+    do {
+        got = readv(fd, iov, cnt);
+    } while(got < 0 && errno == EINTR);
+    if(got < 0)
+        return -1;
+    if(got > 0)
+        cbfifo_publish(fifo, head + got);
+    return got;
 }
 
-// Helper Function
-static void update_head_tail()
-{
-	assert(fifo);
-	if(fifo->full_status) {
-		fifo->tail = (fifo->tail + 1) % fifo->size;
-	}
-	fifo->head = (fifo->head + 1) % fifo->size;
-	fifo->full_status = (fifo->head == fifo->tail);
-    fifo->storedbytes = cbfifo_length();
+
+/*
+ * Writes stored bytes from the given FIFO straight to a file
+ * descriptor, and removes the bytes that were written
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   fd       File descriptor to write, blocking or not
+ *   max      Most bytes to write
+ * 
+ * Returns:
+ *   The number of bytes written, or 0 if the FIFO is empty or max is
+ * 0. On failure returns -1 with errno set and nothing removed: EAGAIN
+ * if a non-blocking fd cannot take more, EINVAL for a CBFIFO_OVERWRITE
+ * FIFO, or the error from writev().
+ */
+size_t cbfifo_write_to_fd(cbfifo_t *fifo, int fd, size_t max) {
+
+    struct iovec iov[2];
+    ssize_t put;
+    assert(fifo);
+    if(fifo->flags & CBFIFO_OVERWRITE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+    size_t len = cbfifo_avail(fifo, tail, max);
+    if(len > max)
+        len = max;
+    if(len == 0)
+        return 0;
+
+    int cnt = cbfifo_spans(fifo, tail, len, iov);
+    do {
+        put = writev(fd, iov, cnt);
+    } while(put < 0 && errno == EINTR);
+    if(put < 0)
+        return -1;
+    if(put > 0)
+        cbfifo_advance_tail(fifo, tail, put);
+    return put;
 }
 
-// Helper Function
-static void reset_tail()
-{
-	assert(fifo);
-    // Updates the full status 
-	fifo->full_status = false;
-    // Since it is a cirular buffer if it resizes to 
-    // back to position zero if the tail size overFlows
-	fifo->tail = (fifo->tail + 1) % fifo->size;
+
+/*
+ * Reserves space for the producer to write into the ring directly,
+ * without copying from a buffer of its own.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   nbyte    Minimum number of bytes needed, or 0 for whatever is free
+ *   ptr      Set to the first free byte in the ring
+ *   contig   Set to the number of free bytes from ptr up to the end of
+ *            the ring. Any further free bytes start at the beginning of
+ *            the ring, and are reached by committing and reserving again.
+ * 
+ * Returns:
+ *   The total number of free bytes, or 0 if fewer than nbyte are free.
+ */
+size_t cbfifo_reserve(cbfifo_t *fifo, size_t nbyte, void **ptr, size_t *contig) {
+
+    assert(fifo && ptr && contig);
+    if(fifo->flags & CBFIFO_MPSC) {
+        // Space has to be claimed, which only the enqueue calls do
+        *ptr = NULL;
+        *contig = 0;
+        return 0;
+    }
+    size_t head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    size_t space = cbfifo_space(fifo, head, nbyte ? nbyte : 1);
+    size_t off = cbfifo_index(fifo, head);
+
+    *ptr = fifo->buff + off;
+    *contig = cbfifo_run(fifo, off);
+    if(*contig > space)
+        *contig = space;
+    return (space < nbyte) ? 0 : space;
 }
 
-void cbfifo_create() {
-    // // Assigns memory pointer for the Circular Buffer
-    // fifo = (cbfifo_t*)malloc(sizeof(cbfifo_t));
-    //Contiguious Dynamic Memory allocation of upto SIZE 
-    // fifo-> buff = (uint8_t *)malloc(SIZE * sizeof(uint8_t));
-    fifo-> buff = CBbuffer;
-    // Dynamic Memory allocation failure handling
-    for(int i = 0; i < SIZE; i++)
-        fifo-> buff[i] = 0;
-    if(fifo-> buff == NULL) {
-        exit(0);
+
+/*
+ * Makes bytes written into space from cbfifo_reserve() visible to the
+ * consumer
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   nbyte    Number of bytes written, at most the contig value returned
+ *            by the last cbfifo_reserve()
+ * 
+ * Returns:
+ *   The number of bytes committed. In case of an error, returns -1.
+ */
+size_t cbfifo_commit(cbfifo_t *fifo, size_t nbyte) {
+
+    assert(fifo);
+    if(fifo->flags & CBFIFO_MPSC)
+        return -1;
+    size_t head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+
+    // Only bytes inside the free region can be committed
+    if(nbyte > cbfifo_space(fifo, head, nbyte))
+        return -1;
+    cbfifo_publish(fifo, head + nbyte);
+    return nbyte;
+}
+
+
+/*
+ * Gives the consumer the stored bytes in place, without removing them.
+ * Follow with cbfifo_consume() to remove the bytes that were used.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   ptr1     Set to the oldest stored byte
+ *   len1     Set to the number of stored bytes from ptr1 up to the end
+ *            of the ring
+ *   ptr2     Set to the start of the ring if the stored bytes wrap
+ *            around, otherwise NULL
+ *   len2     Set to the number of stored bytes from ptr2, or 0
+ * 
+ * Returns:
+ *   The number of bytes stored, len1 + len2
+ */
+size_t cbfifo_peek(cbfifo_t *fifo, void **ptr1, size_t *len1, void **ptr2, size_t *len2) {
+
+    assert(fifo && ptr1 && len1 && ptr2 && len2);
+    size_t avail;
+    size_t tail = cbfifo_load_tail(fifo, fifo->size, &avail);
+    size_t off = cbfifo_index(fifo, tail);
+
+    fifo->peek_tail = tail;
+    *ptr1 = fifo->buff + off;
+    if(avail <= cbfifo_run(fifo, off)) {
+        // No wrap, all stored bytes are in one span
+        *len1 = avail;
+        *ptr2 = NULL;
+        *len2 = 0;
+    } else {
+        // Stored bytes run past the end of the ring
+        *len1 = cbfifo_run(fifo, off);
+        *ptr2 = fifo->buff;
+        *len2 = avail - *len1;
     }
-    // SIZE of buffer
-    fifo-> size = SIZE;
-    // Pointer to keep track of the size of the bytes in
-    // Circular Buffer 
-    fifo->storedbytes = 0;
+    return avail;
+}
 
-    // Helper Pointers for circular buffer 
-    fifo->head = 0;
-    fifo->tail = 0;
 
-    fifo->full_status = false;
-    created = true;
+/*
+ * Removes bytes from the FIFO without copying them, typically after
+ * reading them through cbfifo_peek()
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   nbyte    Number of bytes to remove
+ * 
+ * Returns:
+ *   The number of bytes removed, which will be between 0 and nbyte. On a
+ * CBFIFO_OVERWRITE FIFO, 0 if the producer dropped any of the bytes the
+ * last cbfifo_peek() showed; peek again before retrying.
+ */
+size_t cbfifo_consume(cbfifo_t *fifo, size_t nbyte) {
+
+    assert(fifo);
+    size_t tail, len;
+    if(fifo->flags & CBFIFO_OVERWRITE) {
+        // Remove from where cbfifo_peek() looked, not from the current
+        // tail: if the producer dropped any of those bytes meanwhile,
+        // the bytes now at tail were never seen, so nothing is removed
+        tail = fifo->peek_tail;
+        len = cbfifo_avail(fifo, tail, nbyte);
+        if(len > fifo->size)
+            return 0;
+        if(len > nbyte)
+            len = nbyte;
+        if(len > 0 && !cbfifo_advance_tail(fifo, tail, len))
+            return 0;
+        return len;
+    }
+    do {
+        tail = cbfifo_load_tail(fifo, nbyte, &len);
+        if(len > nbyte)
+            len = nbyte;
+    } while(len > 0 && !cbfifo_advance_tail(fifo, tail, len));
+    return len;
 }
 
-// Helper Function to enque data per byte
-void helper_cbenque(void *buf, size_t nbyte)
+
+// Helper Function: whether want bytes are stored (data) or free
+static bool cbfifo_ready(cbfifo_t *fifo, bool data, size_t pos, size_t want)
 {
-    if (buf && fifo->buff) {
-    // Typecasting to 8 bits
-    uint8_t *data = (uint8_t*) buf;
-    assert(fifo);
-    /* If the Size if not full continue to add on the byte 
-     corresponding to head and update the head and the 
-     tail pointer */
-    if(!fifo->full_status) {   
-
-        // Moves the base pointer upto nbytes 
-        for(int i =0; i< nbyte ; i++) {
-            fifo->buff[fifo->head] = *(uint8_t*) (data + i);
-            update_head_tail();
+    if(data)
+        return cbfifo_avail(fifo, pos, want) >= want;
+    if(fifo->flags & CBFIFO_MPSC) {
+        size_t tail = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+        size_t reserve = atomic_load_explicit(&fifo->reserve, memory_order_relaxed);
+        return cbfifo_mpsc_space(fifo, tail, reserve) >= want;
+    }
+    return cbfifo_space(fifo, pos, want) >= want;
+}
+
+
+/*
+ * Waits until at least want bytes are stored (consumer, data is true)
+ * or free (producer, data is false). Polls up to the side's adaptive
+ * spin count first, then sleeps on a futex until the other side's
+ * cbfifo_notify(). The spin count doubles when polling succeeds and
+ * halves when we had to sleep, so a fast peer is met by spinning and a
+ * slow one costs no CPU. CBFIFO_MPSC producers share the space side, so
+ * they spin a fixed count instead of adapting space_spin.
+ *
+ * Returns true once the condition holds, false on timeout.
+ */
+static bool cbfifo_wait_for(cbfifo_t *fifo, bool data, size_t want, long timeout_us)
+{
+    _Atomic uint32_t *seq = data ? &fifo->data_seq : &fifo->space_seq;
+    _Atomic uint32_t *waiters = data ? &fifo->data_waiters : &fifo->space_waiters;
+    unsigned fixed_spin = CBFIFO_SPIN_MIN;
+    unsigned *spin = data ? &fifo->data_spin : &fifo->space_spin;
+    size_t pos = atomic_load_explicit(data ? &fifo->tail : &fifo->head, memory_order_relaxed);
+    struct timespec deadline, now, left;
+
+    if(!data && (fifo->flags & CBFIFO_MPSC))
+        spin = &fixed_spin;
+
+    for(unsigned i = 0; i < *spin; i++) {
+        if(cbfifo_ready(fifo, data, pos, want)) {
+            // Spinning paid off, allow a longer spin next time
+            if(i > 0 && *spin < CBFIFO_SPIN_MAX)
+                *spin <<= 1;
+            return true;
         }
+        cbfifo_cpu_relax();
+    }
+    if(*spin > CBFIFO_SPIN_MIN)
+        *spin >>= 1;
+
+    if(timeout_us >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_us / 1000000;
+        deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
         }
     }
 
+    while(!cbfifo_ready(fifo, data, pos, want)) {
+        struct timespec *timeout = NULL;
+        if(timeout_us >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = deadline.tv_sec - now.tv_sec;
+            left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if(left.tv_nsec < 0) {
+                left.tv_sec--;
+                left.tv_nsec += 1000000000;
+            }
+            if(left.tv_sec < 0)
+                return false;
+            timeout = &left;
+        }
+
+        // Announce ourselves, then check again before sleeping
+        uint32_t val = atomic_load_explicit(seq, memory_order_acquire);
+        atomic_fetch_add_explicit(waiters, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if(!cbfifo_ready(fifo, data, pos, want))
+            cbfifo_futex_wait(seq, val, timeout);
+        atomic_fetch_sub_explicit(waiters, 1, memory_order_relaxed);
+    }
+    return true;
 }
 
 
 /*
- * Enqueues data onto the FIFO, up to the limit of the available FIFO
- * capacity.
+ * Dequeues from a CBFIFO_BLOCKING FIFO, first waiting until at least
+ * min_bytes bytes are stored
  *
  * Parameters:
- *   buf      Pointer to the data
- *   nbyte    Max number of bytes to enqueue
+ *   fifo        The fifo in question
+ *   buf         Destination for the dequeued data
+ *   nbyte       Bytes of data requested
+ *   min_bytes   Bytes to wait for, from 1 up to nbyte and the capacity
+ *   timeout_us  Longest time to wait, in microseconds, or -1 for no limit
  * 
  * Returns:
- *   The number of bytes actually enqueued, which could be 0. In case
+ *   The number of bytes actually copied, which is 0 on timeout. In case
  * of an error, returns -1.
  */
-size_t cbfifo_enqueue(void *buf, size_t nbyte) {
+size_t cbfifo_dequeue_wait(cbfifo_t *fifo, void *buf, size_t nbyte, size_t min_bytes, long timeout_us) {
 
-    //Asserts that the base struct is created which handles 
-    //The byte storage
-    if (!created) {
-    cbfifo_create(); 
+    assert(fifo);
+    if(buf == NULL || !(fifo->flags & CBFIFO_BLOCKING))
+        return -1;
+
+    if(min_bytes > nbyte)
+        min_bytes = nbyte;
+    if(min_bytes > fifo->size)
+        min_bytes = fifo->size;
+    if(min_bytes == 0)
+        min_bytes = 1;
+
+    if(!cbfifo_wait_for(fifo, true, min_bytes, timeout_us))
+        return 0;
+    return cbfifo_dequeue_from(fifo, buf, nbyte);
+}
+
+
+/*
+ * Enqueues onto a CBFIFO_BLOCKING FIFO, first waiting until there is
+ * room for all nbyte bytes
+ *
+ * Parameters:
+ *   fifo        The fifo in question
+ *   buf         Pointer to the data
+ *   nbyte       Number of bytes to enqueue
+ *   timeout_us  Longest time to wait, in microseconds, or -1 for no limit
+ * 
+ * Returns:
+ *   The number of bytes enqueued. On timeout, or in case of an error,
+ * returns -1. A CBFIFO_OVERWRITE FIFO never waits, and takes all nbyte
+ * bytes as cbfifo_enqueue_to() does.
+ */
+size_t cbfifo_enqueue_wait(cbfifo_t *fifo, void *buf, size_t nbyte, long timeout_us) {
+
+    assert(fifo);
+    if(buf == NULL || !(fifo->flags & CBFIFO_BLOCKING))
+        return -1;
+
+    // There is always room, made by dropping the oldest bytes, even for
+    // more than the ring holds
+    if(fifo->flags & CBFIFO_OVERWRITE)
+        return cbfifo_enqueue_to(fifo, buf, nbyte);
+    if(nbyte > fifo->size)
+        return -1;
+
+    if(!(fifo->flags & CBFIFO_MPSC)) {
+        if(!cbfifo_wait_for(fifo, false, nbyte, timeout_us))
+            return -1;
+        return cbfifo_enqueue_to(fifo, buf, nbyte);
     }
-    // Checks for assertions 
-    if (buf && created && nbyte>=0 && !fifo->full_status) {
 
-        // Checks if the bytes to be inserted exceeds the 
-        // max capacity of the Circular Buffer  
-        if(cbfifo_length() + nbyte > fifo->size) {
-            // Error Handling 
+    // Other producers may claim the room we waited for, so wait again
+    // for whatever is left of the timeout
+    struct timespec start, now;
+    long left_us = timeout_us;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(;;) {
+        if(!cbfifo_wait_for(fifo, false, nbyte, left_us))
             return -1;
+        size_t ret = cbfifo_enqueue_to(fifo, buf, nbyte);
+        if(ret != (size_t)-1)
+            return ret;
+        if(timeout_us >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left_us = timeout_us - ((now.tv_sec - start.tv_sec) * 1000000L +
+                (now.tv_nsec - start.tv_nsec) / 1000);
+            if(left_us < 0)
+                return -1;
         }
-        else {
-            // Helper Function call to Enqueue 
-            helper_cbenque(buf, nbyte);
-        }
-        return (fifo->storedbytes);
     }
-    else {
+}
+
+
+/*
+ * Enqueues one message onto a CBFIFO_MSG FIFO, header and payload
+ * published together
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   buf      Pointer to the payload
+ *   len      Length of the payload, which may be 0
+ * 
+ * Returns:
+ *   len if the message was enqueued. If it does not fit, nothing is
+ * enqueued and -1 is returned; also -1 in case of an error.
+ */
+size_t cbfifo_msg_enqueue(cbfifo_t *fifo, const void *buf, size_t len) {
+
+    uint8_t hdr[CBFIFO_VARINT_MAX];
+    assert(fifo);
+    if(buf == NULL || !(fifo->flags & CBFIFO_MSG))
+        return -1;
+
+    size_t hlen = cbfifo_varint_encode(hdr, len);
+    if(hlen > fifo->size || len > fifo->size - hlen)
         return -1;
+
+    if(fifo->flags & CBFIFO_MPSC) {
+        size_t start;
+        if(!cbfifo_mpsc_claim(fifo, hlen + len, hlen + len, &start))
+            return -1;
+        cbfifo_write_at(fifo, start, hdr, hlen);
+        cbfifo_write_at(fifo, start + hlen, (const uint8_t*)buf, len);
+        cbfifo_mpsc_publish(fifo, start, hlen + len);
+        return len;
     }
-    
+
+    size_t head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    if(fifo->flags & CBFIFO_OVERWRITE)
+        cbfifo_make_room(fifo, head, hlen + len);
+    else if(hlen + len > cbfifo_space(fifo, head, hlen + len))
+        return -1;
+    // The header goes in unpublished; copying the payload in after it
+    // then moves head past both at once
+    cbfifo_write_at(fifo, head, hdr, hlen);
+    cbfifo_copy_in(fifo, head + hlen, (const uint8_t*)buf, len);
+    return len;
 }
 
 
 /*
- * Attempts to remove ("dequeue") up to nbyte bytes of data from the
- * FIFO. Removed data will be copied into the buffer pointed to by buf.
+ * Removes up to max whole messages from a CBFIFO_MSG FIFO, copying
+ * their payloads one after another into buf
  *
  * Parameters:
- *   buf      Destination for the dequeued data
- *   nbyte    Bytes of data requested
+ *   fifo     The fifo in question
+ *   buf      Destination for the payloads
+ *   size     Size of buf, in bytes
+ *   msgs     Set to the payload pointer and length of each message
+ *   max      Most messages to dequeue
  * 
  * Returns:
- *   The number of bytes actually copied, which will be between 0 and
- *  nbyte. In case of an error, returns -1.
+ *   The number of messages dequeued, which is 0 if none are stored. If
+ * the oldest message does not fit in buf, it is left queued and -1 is
+ * returned; also -1 in case of an error.
  */
-size_t cbfifo_dequeue(void *buf, size_t nbyte) {
+size_t cbfifo_msg_dequeue_batch(cbfifo_t *fifo, void *buf, size_t size, cbfifo_msg_t *msgs, size_t max) {
 
-    uint8_t *buffer = (uint8_t*) buf;
-    size_t len=0;
-    assert(fifo && buffer);
-    for(uint8_t i=0; i < nbyte; i++) {
-        // Cannot Dequeue from an empty buffer
-        if(!cbfifo_empty(fifo)) {   
-            // Stored bytes checks the size of the
-            // Buffer 
-            if(fifo->storedbytes <= 0) {
-                // cbfifo_free();
-                return i;
+    uint8_t *out = (uint8_t*)buf;
+    assert(fifo);
+    if(out == NULL || msgs == NULL || !(fifo->flags & CBFIFO_MSG))
+        return -1;
+
+    for(;;) {
+        // head is read once for the whole batch, and tail written once
+        size_t avail;
+        size_t tail = cbfifo_load_tail(fifo, fifo->size, &avail);
+        size_t end = tail + avail;
+        size_t pos = tail, used = 0, count = 0;
+        bool torn = false;
+
+        while(count < max && pos != end) {
+            size_t len;
+            size_t hlen = cbfifo_varint_decode(fifo, pos, end - pos, &len);
+            // Messages are published whole, so a header can only be cut
+            // short by a CBFIFO_OVERWRITE producer writing over it
+            if(hlen == 0 || len > end - pos - hlen) {
+                assert(fifo->flags & CBFIFO_OVERWRITE);
+                torn = true;
+                break;
             }
-            // Dequues from the front where the tail is 
-            *(uint8_t*) (buffer + i) = fifo->buff[fifo->tail];
-            // Updated tail status 
-            reset_tail(fifo); 
-            // Stores the current length
-            fifo->storedbytes = cbfifo_length();
-            len++;
+            if(len > size - used)
+                break;
+            cbfifo_read_at(fifo, pos + hlen, out + used, len);
+            msgs[count].data = out + used;
+            msgs[count].len = len;
+            used += len;
+            pos += hlen + len;
+            count++;
+        }
+
+        if(!torn && pos != tail) {
+            if(cbfifo_advance_tail(fifo, tail, pos - tail))
+                return count;
+        } else if(!torn) {
+            // Nothing taken: either empty or the oldest message is too
+            // big, as long as the producer did not move tail meanwhile
+            atomic_thread_fence(memory_order_acquire);
+            if(atomic_load_explicit(&fifo->tail, memory_order_relaxed) == tail)
+                return (count < max && pos != end) ? (size_t)-1 : 0;
         }
     }
-    // Returns the number of bytes Dequeued 
-    return len;
 }
 
 
 /*
- * Returns the number of bytes currently on the FIFO. 
+ * Returns the payload length of the oldest message on a CBFIFO_MSG
+ * FIFO
  *
  * Parameters:
- *   none
+ *   fifo  The fifo in question
  * 
  * Returns:
- *   Number of bytes currently available to be dequeued from the FIFO
+ *   The payload length, or -1 if no message is stored
  */
-size_t cbfifo_length() {
-    
+size_t cbfifo_msg_length(cbfifo_t *fifo) {
+
+    size_t len;
     assert(fifo);
-    size_t size = fifo->size;
-    if(!fifo->full_status) {
-        if(fifo->head >= fifo->tail) {
-            // When Head is ahead of Tail
-            size = (fifo->head - fifo->tail);
-        }
-        else {
-            // When Tail is ahead of head
-            size = fifo->size + fifo->head - fifo->tail;
-        }
+    if(!(fifo->flags & CBFIFO_MSG))
+        return -1;
+    for(;;) {
+        size_t avail;
+        size_t tail = cbfifo_load_tail(fifo, 1, &avail);
+        if(avail == 0)
+            return -1;
+        bool whole = cbfifo_varint_decode(fifo, tail, avail, &len) > 0;
+        // As in cbfifo_msg_dequeue_batch(), the header counts only if a
+        // CBFIFO_OVERWRITE producer did not drop it while we read
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&fifo->tail, memory_order_relaxed) == tail)
+            return whole ? len : (size_t)-1;
     }
-    // Size of the circular buffer 
-    return size;
 }
 
 
 /*
- * Returns the FIFO's capacity
+ * Returns the number of bytes a CBFIFO_OVERWRITE FIFO has dropped to
+ * make room, including message headers
  *
  * Parameters:
- *   none
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   Bytes dropped since the FIFO was created
+ */
+size_t cbfifo_dropped_bytes(cbfifo_t *fifo) {
+    assert(fifo);
+    return atomic_load_explicit(&fifo->dropped_bytes, memory_order_relaxed);
+}
+
+
+/*
+ * Returns the number of whole messages a CBFIFO_OVERWRITE | CBFIFO_MSG
+ * FIFO has dropped to make room
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   Messages dropped since the FIFO was created
+ */
+size_t cbfifo_dropped_msgs(cbfifo_t *fifo) {
+    assert(fifo);
+    return atomic_load_explicit(&fifo->dropped_msgs, memory_order_relaxed);
+}
+
+
+/*
+ * Returns the number of bytes currently on the given FIFO. 
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   Number of bytes currently available to be dequeued from the FIFO
+ */
+size_t cbfifo_length_of(cbfifo_t *fifo) {
+    assert(fifo);
+    // tail first: head never falls behind a tail read earlier
+    size_t tail = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&fifo->head, memory_order_acquire);
+    // A CBFIFO_OVERWRITE producer may move both between the two loads
+    return (head - tail > fifo->size) ? fifo->size : (head - tail);
+}
+
+
+/*
+ * Returns the given FIFO's capacity
+ *
+ * Parameters:
+ *   fifo  The fifo in question
  * 
  * Returns:
  *   The capacity, in bytes, for the FIFO
  */
-size_t cbfifo_capacity() {
+size_t cbfifo_capacity_of(cbfifo_t *fifo) {
+    assert(fifo);
     // The Max capacity of the circular buffer 
     return fifo->size;
 }
 
 
+/*
+ * Legacy interface: thin wrappers over the default instance
+ */
+
+// Helper Function
+bool cbfifo_empty()
+{
+    return cbfifo_is_empty(cbfifo_default());
+}
+
+// Helper Function to enque as much of the data as fits
+void helper_cbenque(void *buf, size_t nbyte)
+{
+    if (buf)
+        cbfifo_enqueue_partial(cbfifo_default(), buf, nbyte);
+}
+
+/*
+ * Enqueues data onto the default FIFO, if all of it fits. Existing
+ * callers rely on the return value being the resulting FIFO length, so
+ * that is kept here.
+ */
+size_t cbfifo_enqueue(void *buf, size_t nbyte) {
+    cbfifo_t *fifo = cbfifo_default();
+    if(cbfifo_enqueue_to(fifo, buf, nbyte) == (size_t)-1)
+        return -1;
+    return cbfifo_length_of(fifo);
+}
+
+size_t cbfifo_dequeue(void *buf, size_t nbyte) {
+    return cbfifo_dequeue_from(cbfifo_default(), buf, nbyte);
+}
+
+size_t cbfifo_length() {
+    return cbfifo_length_of(cbfifo_default());
+}
+
+size_t cbfifo_capacity() {
+    return cbfifo_capacity_of(cbfifo_default());
+}
+
+
 
 #endif // _CBFIFO_C_
 
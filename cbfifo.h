@@ -14,30 +14,227 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <sys/uio.h>  // for struct iovec
 
 #define SIZE 128
 
+/*
+ * Options for cbfifo_new_ex()
+ *
+ *   CBFIFO_POW2  Round the capacity up to a power of two, so offsets in
+ *                the ring are found with a mask instead of a compare
+ *   CBFIFO_SPSC  Allow one producer thread and one consumer thread to
+ *                use the FIFO at the same time, without locking. The
+ *                producer may only call the enqueue functions and the
+ *                consumer the dequeue functions. Implies CBFIFO_POW2.
+ *   CBFIFO_MIRROR  Map the ring's pages twice, back to back, so stored
+ *                or free bytes never wrap: cbfifo_peek() and
+ *                cbfifo_reserve() always return a single span. Needs a
+ *                capacity of at least one page, and rounds it up to a
+ *                whole number of pages; otherwise, or where the mapping
+ *                is not available, a plain array is used instead.
+ *   CBFIFO_BLOCKING  Allow cbfifo_dequeue_wait() and cbfifo_enqueue_wait().
+ *                Each call that moves head or tail then costs a memory
+ *                fence, and a wake-up syscall only when the other side
+ *                is asleep. Implies CBFIFO_SPSC, unless CBFIFO_MPSC is
+ *                also given.
+ *   CBFIFO_MPSC  Allow any number of producer threads and one consumer
+ *                thread to use the FIFO at the same time, without
+ *                locking. Producers claim space in turn and copy their
+ *                bytes in parallel; each enqueue is stored whole and
+ *                contiguous in the stream, in claim order. Only
+ *                cbfifo_enqueue_to(), cbfifo_enqueue_partial(),
+ *                cbfifo_enqueuev() and cbfifo_enqueue_wait() may be
+ *                used to produce. Implies CBFIFO_POW2.
+ *   CBFIFO_MSG   Store discrete messages rather than a byte stream,
+ *                through cbfifo_msg_enqueue() and
+ *                cbfifo_msg_dequeue_batch(). Each message is a varint
+ *                length followed by the payload; the byte-level calls
+ *                would split messages, so should not be used.
+ *   CBFIFO_OVERWRITE  Never turn the producer away: an enqueue that does
+ *                not fit drops the oldest stored bytes (whole messages
+ *                with CBFIFO_MSG) to make room, and a byte enqueue
+ *                larger than the ring keeps only its last bytes. Drops
+ *                are counted, see cbfifo_dropped_bytes(). With
+ *                CBFIFO_SPSC the consumer may lose a race with the
+ *                producer, in which case it reads again from the new
+ *                oldest byte; bytes seen through cbfifo_peek() may be
+ *                overwritten before they are consumed, in which case
+ *                cbfifo_consume() removes nothing. Implies
+ *                CBFIFO_POW2, and cannot be used with CBFIFO_MPSC.
+ */
+#define CBFIFO_POW2     0x01u
+#define CBFIFO_SPSC     0x02u
+#define CBFIFO_MIRROR   0x04u
+#define CBFIFO_BLOCKING 0x08u
+#define CBFIFO_MPSC     0x10u
+#define CBFIFO_MSG      0x20u
+#define CBFIFO_OVERWRITE 0x40u
+
+/* 
+ * The cbfifo's main data structure. 
+ *
+ * Defined here as an incomplete type, in order to hide the
+ * implementation from the user. Each cbfifo_t owns its own ring, so
+ * several independent FIFOs may be used side by side; the legacy
+ * cbfifo_*() functions below operate on a default SIZE-byte instance.
+ */
+typedef struct cbfifo_s cbfifo_t;
+
+
+/*
+ * Creates a new FIFO with its own ring of the requested capacity
+ *
+ * Parameters:
+ *   capacity  Size of the ring, in bytes
+ * 
+ * Returns:
+ *   A pointer to a cbfifo_t, or NULL in case of an error.
+ */
+cbfifo_t *cbfifo_new(size_t capacity);
+
+
+/*
+ * Creates a new FIFO, with options
+ *
+ * Parameters:
+ *   capacity  Size of the ring, in bytes
+ *   flags     Bitwise OR of CBFIFO_* options, or 0
+ * 
+ * Returns:
+ *   A pointer to a cbfifo_t, or NULL in case of an error.
+ */
+cbfifo_t *cbfifo_new_ex(size_t capacity, unsigned flags);
+
+
+/*
+ * Teardown function. Frees the ring and the FIFO itself. After calling
+ * this function, the fifo should not be used again!
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   none
+ */
+void cbfifo_free(cbfifo_t *fifo);
+
 
 /*
- * Enqueues data onto the FIFO, up to the limit of the available FIFO
- * capacity.
+ * Enqueues data onto the given FIFO, if all of it fits. See
+ * cbfifo_enqueue_partial() to enqueue as much as fits instead.
  *
  * Parameters:
+ *   fifo     The fifo in question
+ *   buf      Pointer to the data
+ *   nbyte    Number of bytes to enqueue
+ * 
+ * Returns:
+ *   nbyte, if the bytes were enqueued. If they do not all fit, nothing
+ * is enqueued and -1 is returned; also -1 in case of an error. A
+ * CBFIFO_OVERWRITE FIFO always takes, and returns, all nbyte bytes.
+ */
+size_t cbfifo_enqueue_to(cbfifo_t *fifo, void *buf, size_t nbyte);
+
+
+/*
+ * Enqueues as many of nbyte bytes as fit onto the given FIFO
+ *
+ * Parameters:
+ *   fifo     The fifo in question
  *   buf      Pointer to the data
  *   nbyte    Max number of bytes to enqueue
  * 
  * Returns:
+ *   The number of bytes actually enqueued, from the start of buf, which
+ * could be 0. In case of an error, returns -1.
+ */
+size_t cbfifo_enqueue_partial(cbfifo_t *fifo, const void *buf, size_t nbyte);
+
+
+/*
+ * Gathers data from iovcnt buffers onto the given FIFO, as much as
+ * fits, in order. The bytes are published to the consumer together.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   iov      The buffers, as for writev()
+ *   iovcnt   Number of buffers, which may be 0
+ * 
+ * Returns:
  *   The number of bytes actually enqueued, which could be 0. In case
  * of an error, returns -1.
  */
-size_t cbfifo_enqueue(void *buf, size_t nbyte);
+size_t cbfifo_enqueuev(cbfifo_t *fifo, const struct iovec *iov, int iovcnt);
+
+
+/*
+ * Scatters as much data as is stored, up to the total size of iovcnt
+ * buffers, from the given FIFO into those buffers, filling each one
+ * before moving to the next
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   iov      The buffers, as for readv()
+ *   iovcnt   Number of buffers, which may be 0
+ * 
+ * Returns:
+ *   The number of bytes actually copied, which could be 0. In case of
+ * an error, returns -1.
+ */
+size_t cbfifo_dequeuev(cbfifo_t *fifo, const struct iovec *iov, int iovcnt);
+
+
+/*
+ * Reads from a file descriptor straight into the free space of the
+ * given FIFO, with one readv() across the free span(s) of the ring, so
+ * the data is copied only once. The FIFO's producer calls this. Only
+ * free space is used, even on a CBFIFO_OVERWRITE FIFO; a CBFIFO_MPSC
+ * FIFO is not supported.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   fd       File descriptor to read, blocking or not
+ *   max      Most bytes to read
+ * 
+ * Returns:
+ *   The number of bytes read, or 0 at end of file or if max is 0. On
+ * failure returns -1 with errno set and nothing enqueued: EAGAIN if a
+ * non-blocking fd has nothing to read, ENOBUFS if the FIFO is full,
+ * EINVAL for a CBFIFO_MPSC FIFO, or the error from readv().
+ */
+size_t cbfifo_read_from_fd(cbfifo_t *fifo, int fd, size_t max);
+
+
+/*
+ * Writes stored bytes from the given FIFO straight to a file
+ * descriptor, with one writev() across the stored span(s) of the ring,
+ * and removes the bytes that were written. The FIFO's consumer calls
+ * this. A CBFIFO_OVERWRITE FIFO is not supported, since bytes already
+ * written could not be taken back if the producer overwrote them.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   fd       File descriptor to write, blocking or not. Writing to a
+ *            closed pipe or socket raises SIGPIPE, as for writev().
+ *   max      Most bytes to write
+ * 
+ * Returns:
+ *   The number of bytes written, or 0 if the FIFO is empty or max is
+ * 0. On failure returns -1 with errno set and nothing removed: EAGAIN
+ * if a non-blocking fd cannot take more, EINVAL for a CBFIFO_OVERWRITE
+ * FIFO, or the error from writev().
+ */
+size_t cbfifo_write_to_fd(cbfifo_t *fifo, int fd, size_t max);
 
 
 /*
  * Attempts to remove ("dequeue") up to nbyte bytes of data from the
- * FIFO. Removed data will be copied into the buffer pointed to by buf.
+ * given FIFO. Removed data will be copied into the buffer pointed to
+ * by buf.
  *
  * Parameters:
+ *   fifo     The fifo in question
  *   buf      Destination for the dequeued data
  *   nbyte    Bytes of data requested
  * 
@@ -45,57 +242,309 @@ size_t cbfifo_enqueue(void *buf, size_t nbyte);
  *   The number of bytes actually copied, which will be between 0 and
  *  nbyte. In case of an error, returns -1.
  */
-size_t cbfifo_dequeue(void *buf, size_t nbyte);
+size_t cbfifo_dequeue_from(cbfifo_t *fifo, void *buf, size_t nbyte);
 
 
 /*
- * Returns the number of bytes currently on the FIFO. 
+ * Reserves space for the producer to write into the ring directly,
+ * without copying from a buffer of its own. Follow with cbfifo_commit().
  *
  * Parameters:
- *   none
+ *   fifo     The fifo in question
+ *   nbyte    Minimum number of bytes needed, or 0 for whatever is free
+ *   ptr      Set to the first free byte in the ring
+ *   contig   Set to the number of free bytes from ptr up to the end of
+ *            the ring. Any further free bytes start at the beginning of
+ *            the ring, and are reached by committing and reserving again.
+ * 
+ * Returns:
+ *   The total number of free bytes, or 0 if fewer than nbyte are free
+ * or the FIFO is CBFIFO_MPSC.
+ */
+size_t cbfifo_reserve(cbfifo_t *fifo, size_t nbyte, void **ptr, size_t *contig);
+
+
+/*
+ * Makes bytes written into space from cbfifo_reserve() visible to the
+ * consumer
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   nbyte    Number of bytes written, at most the contig value returned
+ *            by the last cbfifo_reserve()
+ * 
+ * Returns:
+ *   The number of bytes committed. In case of an error, or if the FIFO
+ * is CBFIFO_MPSC, returns -1.
+ */
+size_t cbfifo_commit(cbfifo_t *fifo, size_t nbyte);
+
+
+/*
+ * Gives the consumer the stored bytes in place, without removing them.
+ * Follow with cbfifo_consume() to remove the bytes that were used.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   ptr1     Set to the oldest stored byte
+ *   len1     Set to the number of stored bytes from ptr1 up to the end
+ *            of the ring
+ *   ptr2     Set to the start of the ring if the stored bytes wrap
+ *            around, otherwise NULL
+ *   len2     Set to the number of stored bytes from ptr2, or 0
+ * 
+ * Returns:
+ *   The number of bytes stored, len1 + len2
+ */
+size_t cbfifo_peek(cbfifo_t *fifo, void **ptr1, size_t *len1, void **ptr2, size_t *len2);
+
+
+/*
+ * Removes bytes from the FIFO without copying them, typically after
+ * reading them through cbfifo_peek()
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   nbyte    Number of bytes to remove
+ * 
+ * Returns:
+ *   The number of bytes removed, which will be between 0 and nbyte. On a
+ * CBFIFO_OVERWRITE FIFO, 0 if the producer dropped any of the bytes the
+ * last cbfifo_peek() showed; peek again before retrying.
+ */
+size_t cbfifo_consume(cbfifo_t *fifo, size_t nbyte);
+
+
+/*
+ * Dequeues from a CBFIFO_BLOCKING FIFO, first waiting until at least
+ * min_bytes bytes are stored. Spins briefly, then sleeps until the
+ * producer enqueues.
+ *
+ * Parameters:
+ *   fifo        The fifo in question
+ *   buf         Destination for the dequeued data
+ *   nbyte       Bytes of data requested
+ *   min_bytes   Bytes to wait for, from 1 up to nbyte and the capacity
+ *   timeout_us  Longest time to wait, in microseconds, or -1 for no limit
+ * 
+ * Returns:
+ *   The number of bytes actually copied, which is 0 on timeout. In case
+ * of an error, returns -1.
+ */
+size_t cbfifo_dequeue_wait(cbfifo_t *fifo, void *buf, size_t nbyte, size_t min_bytes, long timeout_us);
+
+
+/*
+ * Enqueues onto a CBFIFO_BLOCKING FIFO, first waiting until there is
+ * room for all nbyte bytes. Spins briefly, then sleeps until the
+ * consumer dequeues.
+ *
+ * Parameters:
+ *   fifo        The fifo in question
+ *   buf         Pointer to the data
+ *   nbyte       Number of bytes to enqueue
+ *   timeout_us  Longest time to wait, in microseconds, or -1 for no limit
+ * 
+ * Returns:
+ *   The number of bytes enqueued. On timeout, or in case of an error,
+ * returns -1. A CBFIFO_OVERWRITE FIFO never waits, and takes all nbyte
+ * bytes as cbfifo_enqueue_to() does.
+ */
+size_t cbfifo_enqueue_wait(cbfifo_t *fifo, void *buf, size_t nbyte, long timeout_us);
+
+
+/*
+ * A message returned by cbfifo_msg_dequeue_batch()
+ */
+typedef struct {
+    void *data;
+    size_t len;
+} cbfifo_msg_t;
+
+
+/*
+ * Enqueues one message onto a CBFIFO_MSG FIFO. The length header and
+ * the payload are published together, so the consumer never sees part
+ * of a message.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   buf      Pointer to the payload
+ *   len      Length of the payload, which may be 0
+ * 
+ * Returns:
+ *   len if the message was enqueued. If it does not fit, nothing is
+ * enqueued and -1 is returned; also -1 in case of an error. On a
+ * CBFIFO_OVERWRITE FIFO, only a message larger than the whole ring
+ * does not fit.
+ */
+size_t cbfifo_msg_enqueue(cbfifo_t *fifo, const void *buf, size_t len);
+
+
+/*
+ * Removes up to max whole messages from a CBFIFO_MSG FIFO, copying
+ * their payloads one after another into buf. Stops early at the first
+ * message that would not fit in what is left of buf.
+ *
+ * Parameters:
+ *   fifo     The fifo in question
+ *   buf      Destination for the payloads
+ *   size     Size of buf, in bytes
+ *   msgs     Set to the payload pointer and length of each message
+ *   max      Most messages to dequeue
+ * 
+ * Returns:
+ *   The number of messages dequeued, which is 0 if none are stored. If
+ * the oldest message does not fit in buf, it is left queued and -1 is
+ * returned; also -1 in case of an error.
+ */
+size_t cbfifo_msg_dequeue_batch(cbfifo_t *fifo, void *buf, size_t size, cbfifo_msg_t *msgs, size_t max);
+
+
+/*
+ * Returns the payload length of the oldest message on a CBFIFO_MSG
+ * FIFO, for sizing the buffer passed to cbfifo_msg_dequeue_batch()
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   The payload length, or -1 if no message is stored
+ */
+size_t cbfifo_msg_length(cbfifo_t *fifo);
+
+
+/*
+ * Returns the number of bytes a CBFIFO_OVERWRITE FIFO has dropped to
+ * make room, including message headers
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   Bytes dropped since the FIFO was created
+ */
+size_t cbfifo_dropped_bytes(cbfifo_t *fifo);
+
+
+/*
+ * Returns the number of whole messages a CBFIFO_OVERWRITE | CBFIFO_MSG
+ * FIFO has dropped to make room
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   Messages dropped since the FIFO was created
+ */
+size_t cbfifo_dropped_msgs(cbfifo_t *fifo);
+
+
+/*
+ * Returns the number of bytes currently on the given FIFO. 
+ *
+ * Parameters:
+ *   fifo  The fifo in question
  * 
  * Returns:
  *   Number of bytes currently available to be dequeued from the FIFO
  */
-size_t cbfifo_length();
+size_t cbfifo_length_of(cbfifo_t *fifo);
 
 
 /*
- * Returns the FIFO's capacity
+ * Returns the given FIFO's capacity
  *
  * Parameters:
- *   none
+ *   fifo  The fifo in question
  * 
  * Returns:
  *   The capacity, in bytes, for the FIFO
  */
-size_t cbfifo_capacity();
+size_t cbfifo_capacity_of(cbfifo_t *fifo);
+
 
 /*
- * Helper function to check if the cB is empty 
+ * Returns the options in effect for the given FIFO
  *
  * Parameters:
- *   none
+ *   fifo  The fifo in question
  * 
  * Returns:
- *   none
+ *   Bitwise OR of CBFIFO_* options. CBFIFO_MIRROR is cleared if the
+ * FIFO fell back to a plain array.
  */
-bool cbfifo_empty();
+unsigned cbfifo_flags_of(cbfifo_t *fifo);
+
 
 /*
- * Helper function to update head and tail pointer to keep track of the CB 
+ * Returns the default FIFO used by the legacy cbfifo_*() functions,
+ * creating it on first use
  *
  * Parameters:
  *   none
  * 
  * Returns:
+ *   A pointer to the default cbfifo_t
+ */
+cbfifo_t *cbfifo_default();
+
+
+/*
+ * Enqueues data onto the default FIFO, if all of it fits; nothing is
+ * enqueued otherwise. See helper_cbenque() to enqueue as much as fits.
+ *
+ * Parameters:
+ *   buf      Pointer to the data
+ *   nbyte    Number of bytes to enqueue
+ * 
+ * Returns:
+ *   The number of bytes on the default FIFO after the enqueue. If the
+ * bytes do not all fit, or in case of an error, returns -1.
+ */
+size_t cbfifo_enqueue(void *buf, size_t nbyte);
+
+
+/*
+ * Attempts to remove ("dequeue") up to nbyte bytes of data from the
+ * FIFO. Removed data will be copied into the buffer pointed to by buf.
+ *
+ * Parameters:
+ *   buf      Destination for the dequeued data
+ *   nbyte    Bytes of data requested
+ * 
+ * Returns:
+ *   The number of bytes actually copied, which will be between 0 and
+ *  nbyte. In case of an error, returns -1.
+ */
+size_t cbfifo_dequeue(void *buf, size_t nbyte);
+
+
+/*
+ * Returns the number of bytes currently on the FIFO. 
+ *
+ * Parameters:
  *   none
+ * 
+ * Returns:
+ *   Number of bytes currently available to be dequeued from the FIFO
  */
-static void update_head_tail();
+size_t cbfifo_length();
+
 
+/*
+ * Returns the FIFO's capacity
+ *
+ * Parameters:
+ *   none
+ * 
+ * Returns:
+ *   The capacity, in bytes, for the FIFO
+ */
+size_t cbfifo_capacity();
 
 /*
- * Helper Function to reset tail incase of over flow  
+ * Helper function to check if the cB is empty 
  *
  * Parameters:
  *   none
@@ -103,10 +552,11 @@ static void update_head_tail();
  * Returns:
  *   none
  */
-static void reset_tail();
+bool cbfifo_empty();
 
 /*
- * Helper Function to enque data per byte  
+ * Helper Function to enque as much of the data as fits onto the
+ * default FIFO, as cbfifo_enqueue_partial() does; the rest is dropped
  *
  * Parameters:
  *   buf      Pointer to the data
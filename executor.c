@@ -0,0 +1,392 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file executor.c
+ * @brief A pool of worker threads with one work-stealing deque each
+ *
+ * Each worker runs the tasks on its own wsdeque newest first, which
+ * keeps a task's children on the core that made them. Tasks from
+ * outside the pool arrive on a shared llfifo behind a mutex. Idle
+ * workers take from the shared llfifo, then steal from the other
+ * workers' deques starting at a random one, and after a few empty
+ * rounds go to sleep until a task is submitted.
+ *
+ * queued counts tasks waiting on any queue and pending those not yet
+ * finished. A worker only sleeps after announcing itself in sleepers
+ * and then finding queued at 0, and a submitter only skips the wake-up
+ * after bumping queued and then finding sleepers at 0, so a task is
+ * never left with every worker asleep.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "executor.h"
+#include "wsdeque.h"
+#include "llfifo.h"
+
+// Size of a cache line, to keep workers apart
+#define EXECUTOR_CACHELINE  64
+// Initial size of each worker's deque
+#define EXECUTOR_DEQUE      256
+// Rounds of looking for work before an idle worker sleeps
+#define EXECUTOR_SPIN       32
+// Finished tasks a worker keeps for reuse
+#define EXECUTOR_SPARE_MAX  1024
+
+typedef struct task_s {
+    executor_fn_t fn;
+    void *arg;
+    struct task_s *next;
+} task_t;
+
+typedef struct {
+    _Alignas(EXECUTOR_CACHELINE) wsdeque_t *deque;
+    executor_t *exec;
+    pthread_t thread;
+    int id;
+    unsigned rand;
+    // Finished tasks, for this worker's next submissions
+    task_t *spare;
+    int num_spare;
+} worker_t;
+
+/*
+ * Definition
+ */
+struct executor_s {
+    int num_workers;
+    worker_t *workers;
+
+    // Guards global, and goes with the two conditions
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond, done_cond;
+    llfifo_t *global;
+
+    _Alignas(EXECUTOR_CACHELINE) _Atomic int global_length;
+    _Atomic long queued;
+    _Atomic long pending;
+    _Atomic int sleepers;
+    _Atomic int stop;
+};
+
+// The worker the calling thread is, if it is one
+static _Thread_local worker_t *exec_self;
+
+
+// Helper Function to get a task, from the worker's spares if it can
+static task_t *newTask(executor_t *exec) {
+    worker_t *self = exec_self;
+    if(self && self->exec == exec && self->spare) {
+        task_t *task = self->spare;
+        self->spare = task->next;
+        self->num_spare--;
+        return task;
+    }
+    return (task_t*)malloc(sizeof(task_t));
+}
+
+// Helper Function to give a finished task back
+static void freeTask(worker_t *self, task_t *task) {
+    if(self->num_spare < EXECUTOR_SPARE_MAX) {
+        task->next = self->spare;
+        self->spare = task;
+        self->num_spare++;
+    } else {
+        free(task);
+    }
+}
+
+
+// Helper Function to find a task for a worker: its own newest, then
+// the shared queue's oldest, then another worker's oldest
+static task_t *takeTask(executor_t *exec, worker_t *self) {
+    task_t *task = (task_t*)wsdeque_pop(self->deque);
+    if(task)
+        return task;
+
+    if(atomic_load_explicit(&exec->global_length, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&exec->lock);
+        task = (task_t*)llfifo_dequeue(exec->global);
+        if(task)
+            atomic_fetch_sub_explicit(&exec->global_length, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&exec->lock);
+        if(task)
+            return task;
+    }
+
+    // xorshift, to spread the thieves over the victims
+    self->rand ^= self->rand << 13;
+    self->rand ^= self->rand >> 17;
+    self->rand ^= self->rand << 5;
+    int n = exec->num_workers;
+    int start = (int)(self->rand % n);
+    for(int i = 0; i < n; i++) {
+        int victim = (start + i) % n;
+        if(victim == self->id)
+            continue;
+        task = (task_t*)wsdeque_steal(exec->workers[victim].deque);
+        if(task)
+            return task;
+    }
+    return NULL;
+}
+
+// Worker thread: runs tasks until the executor stops
+static void *workerMain(void *arg) {
+    worker_t *self = (worker_t*)arg;
+    executor_t *exec = self->exec;
+    int idle = 0;
+
+    exec_self = self;
+    for(;;) {
+        task_t *task = takeTask(exec, self);
+        if(task) {
+            atomic_fetch_sub(&exec->queued, 1);
+            task->fn(task->arg);
+            freeTask(self, task);
+            if(atomic_fetch_sub(&exec->pending, 1) == 1) {
+                pthread_mutex_lock(&exec->lock);
+                pthread_cond_broadcast(&exec->done_cond);
+                pthread_mutex_unlock(&exec->lock);
+            }
+            idle = 0;
+            continue;
+        }
+
+        if(atomic_load(&exec->stop))
+            break;
+        if(++idle < EXECUTOR_SPIN) {
+            sched_yield();
+            continue;
+        }
+
+        // Nothing found for a while: sleep until something is queued
+        pthread_mutex_lock(&exec->lock);
+        atomic_fetch_add(&exec->sleepers, 1);
+        while(atomic_load(&exec->queued) == 0 && !atomic_load(&exec->stop))
+            pthread_cond_wait(&exec->work_cond, &exec->lock);
+        atomic_fetch_sub(&exec->sleepers, 1);
+        pthread_mutex_unlock(&exec->lock);
+        idle = 0;
+    }
+    return NULL;
+}
+
+
+// Helper Function to free an executor whose workers have stopped, or
+// never started; num_workers counts the deques made
+static void freeExecutor(executor_t *exec) {
+    for(int i = 0; i < exec->num_workers; i++) {
+        worker_t *w = &exec->workers[i];
+        while(w->spare) {
+            task_t *task = w->spare;
+            w->spare = task->next;
+            free(task);
+        }
+        wsdeque_destroy(w->deque);
+    }
+
+    pthread_mutex_destroy(&exec->lock);
+    pthread_cond_destroy(&exec->work_cond);
+    pthread_cond_destroy(&exec->done_cond);
+    llfifo_destroy(exec->global);
+    free(exec->workers);
+    free(exec);
+}
+
+
+/*
+ * Starts the worker threads
+ *
+ * Parameters:
+ *   workers  the number of worker threads, or 0 for one per online CPU
+ *
+ * Returns:
+ *   A pointer to an executor_t, or NULL in case of an error.
+ */
+executor_t *executor_create(int workers) {
+    if(workers < 0)
+        return NULL;
+    if(workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (cpus > 0) ? (int)cpus : 1;
+    }
+
+    executor_t *exec = (executor_t*)aligned_alloc(EXECUTOR_CACHELINE, sizeof(executor_t));
+    if(exec == NULL)
+        return NULL;
+    exec->workers = (worker_t*)aligned_alloc(EXECUTOR_CACHELINE, workers * sizeof(worker_t));
+    exec->global = llfifo_create(EXECUTOR_DEQUE);
+    if(exec->workers == NULL || exec->global == NULL) {
+        free(exec->workers);
+        if(exec->global)
+            llfifo_destroy(exec->global);
+        free(exec);
+        return NULL;
+    }
+
+    exec->num_workers = 0;
+    pthread_mutex_init(&exec->lock, NULL);
+    pthread_cond_init(&exec->work_cond, NULL);
+    pthread_cond_init(&exec->done_cond, NULL);
+    atomic_init(&exec->global_length, 0);
+    atomic_init(&exec->queued, 0);
+    atomic_init(&exec->pending, 0);
+    atomic_init(&exec->sleepers, 0);
+    atomic_init(&exec->stop, 0);
+
+    // Every deque has to exist before any worker goes looking in them
+    for(int i = 0; i < workers; i++) {
+        worker_t *w = &exec->workers[i];
+        w->deque = wsdeque_create(EXECUTOR_DEQUE);
+        w->exec = exec;
+        w->id = i;
+        w->rand = 2654435761u * (i + 1);
+        w->spare = NULL;
+        w->num_spare = 0;
+        if(w->deque == NULL) {
+            exec->num_workers = i;
+            freeExecutor(exec);
+            return NULL;
+        }
+    }
+    exec->num_workers = workers;
+    for(int i = 0; i < workers; i++) {
+        if(pthread_create(&exec->workers[i].thread, NULL, workerMain, &exec->workers[i]) != 0) {
+            // Stop the ones started, then free everything
+            atomic_store(&exec->stop, 1);
+            pthread_mutex_lock(&exec->lock);
+            pthread_cond_broadcast(&exec->work_cond);
+            pthread_mutex_unlock(&exec->lock);
+            for(int j = 0; j < i; j++)
+                pthread_join(exec->workers[j].thread, NULL);
+            freeExecutor(exec);
+            return NULL;
+        }
+    }
+    return exec;
+}
+
+
+/*
+ * Submits a task to be run on one of the workers
+ *
+ * Parameters:
+ *   exec  The executor in question
+ *   fn    The function to call
+ *   arg   Passed to fn
+ *
+ * Returns:
+ *   0 on success, -1 on failure
+ */
+int executor_submit(executor_t *exec, executor_fn_t fn, void *arg) {
+
+    assert(exec);
+    if(fn == NULL)
+        return -1;
+    task_t *task = newTask(exec);
+    if(task == NULL)
+        return -1;
+    task->fn = fn;
+    task->arg = arg;
+
+    atomic_fetch_add(&exec->pending, 1);
+    worker_t *self = exec_self;
+    int ret;
+    if(self && self->exec == exec) {
+        ret = wsdeque_push(self->deque, task);
+    } else {
+        pthread_mutex_lock(&exec->lock);
+        ret = llfifo_enqueue(exec->global, task);
+        if(ret > 0)
+            atomic_fetch_add_explicit(&exec->global_length, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&exec->lock);
+    }
+    if(ret < 0) {
+        atomic_fetch_sub(&exec->pending, 1);
+        free(task);
+        return -1;
+    }
+
+    // Wake a sleeping worker, if any
+    atomic_fetch_add(&exec->queued, 1);
+    if(atomic_load(&exec->sleepers) > 0) {
+        pthread_mutex_lock(&exec->lock);
+        pthread_cond_signal(&exec->work_cond);
+        pthread_mutex_unlock(&exec->lock);
+    }
+    return 0;
+}
+
+
+/*
+ * Waits until every task submitted so far, and every task those
+ * submit in turn, has finished
+ *
+ * Parameters:
+ *   exec  The executor in question
+ *
+ * Returns:
+ *   none
+ */
+void executor_wait(executor_t *exec) {
+    assert(exec);
+    pthread_mutex_lock(&exec->lock);
+    while(atomic_load(&exec->pending) > 0)
+        pthread_cond_wait(&exec->done_cond, &exec->lock);
+    pthread_mutex_unlock(&exec->lock);
+}
+
+
+/*
+ * Returns the number of worker threads
+ *
+ * Parameters:
+ *   exec  The executor in question
+ *
+ * Returns:
+ *   The number of workers
+ */
+int executor_workers(executor_t *exec) {
+    assert(exec);
+    return exec->num_workers;
+}
+
+
+/*
+ * Teardown function. Waits for every task to finish, stops the workers
+ * and frees the executor. After calling this function, the executor
+ * should not be used again!
+ *
+ * Parameters:
+ *   exec  The executor in question
+ *
+ * Returns:
+ *   none
+ */
+void executor_destroy(executor_t *exec) {
+    if(exec == NULL)
+        return;
+    executor_wait(exec);
+    atomic_store(&exec->stop, 1);
+    pthread_mutex_lock(&exec->lock);
+    pthread_cond_broadcast(&exec->work_cond);
+    pthread_mutex_unlock(&exec->lock);
+    for(int i = 0; i < exec->num_workers; i++)
+        pthread_join(exec->workers[i].thread, NULL);
+    freeExecutor(exec);
+}
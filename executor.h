@@ -0,0 +1,99 @@
+/*
+ * executor.h - a pool of worker threads running small tasks, with one
+ * work-stealing deque per worker
+ *
+ * Author: Arpit Savarkar, (arpit.savarkar@colorado.edu)
+ *
+ */
+
+#ifndef _EXECUTOR_H_
+#define _EXECUTOR_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+/*
+ * The executor's main data structure.
+ *
+ * Defined here as an incomplete type, in order to hide the
+ * implementation from the user. Tasks submitted by a task already
+ * running on a worker go on that worker's own wsdeque, where it picks
+ * them up again newest first; tasks submitted from other threads go on
+ * a shared llfifo. A worker with nothing of its own to do takes from
+ * the shared llfifo, then steals the oldest tasks of other workers.
+ */
+typedef struct executor_s executor_t;
+
+/*
+ * A task: fn(arg) is called once, on one of the workers
+ */
+typedef void (*executor_fn_t)(void *arg);
+
+
+/*
+ * Starts the worker threads
+ *
+ * Parameters:
+ *   workers  the number of worker threads, or 0 for one per online CPU
+ *
+ * Returns:
+ *   A pointer to an executor_t, or NULL in case of an error.
+ */
+executor_t *executor_create(int workers);
+
+
+/*
+ * Submits a task to be run on one of the workers
+ *
+ * Parameters:
+ *   exec  The executor in question
+ *   fn    The function to call
+ *   arg   Passed to fn
+ *
+ * Returns:
+ *   0 on success, -1 on failure
+ */
+int executor_submit(executor_t *exec, executor_fn_t fn, void *arg);
+
+
+/*
+ * Waits until every task submitted so far, and every task those
+ * submit in turn, has finished. May not be called from a task.
+ *
+ * Parameters:
+ *   exec  The executor in question
+ *
+ * Returns:
+ *   none
+ */
+void executor_wait(executor_t *exec);
+
+
+/*
+ * Returns the number of worker threads
+ *
+ * Parameters:
+ *   exec  The executor in question
+ *
+ * Returns:
+ *   The number of workers
+ */
+int executor_workers(executor_t *exec);
+
+
+/*
+ * Teardown function. Waits for every task to finish, as
+ * executor_wait() does, then stops the workers and frees the executor.
+ * After calling this function, the executor should not be used again!
+ *
+ * Parameters:
+ *   exec  The executor in question
+ *
+ * Returns:
+ *   none
+ */
+void executor_destroy(executor_t *exec);
+
+#endif // _EXECUTOR_H_
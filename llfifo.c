@@ -29,39 +29,437 @@
   Based on the comments/code of (Howdy Pierce, howdy.pierce@colorado.edu)
 */
 
+#include <pthread.h>
+
 #include "llfifo.h"
 
-// Node Struct which keeps track of 
-// next and key(void*)
-typedef struct node_s {
-    struct node_s *next;
-    void* key;
-}node_t;
+// Element slots per block. A block is then 33 pointers, a little over
+// four cache lines on a 64 bit machine.
+#define LLFIFO_BLOCK_SLOTS 32
+
+// Upper bound on the blocks in one slab, so a burst never asks for
+// more than about a megabyte at once
+#define LLFIFO_SLAB_MAX   4096
+
+// Size of a cache line, used to keep the producer and consumer ends of
+// the concurrent FIFOs from sharing one
+#define LLFIFO_CACHELINE  64
+
+// Block Struct which keeps track of
+// next and a run of element slots
+typedef struct llfifo_block_s {
+    struct llfifo_block_s *next;
+    void* slot[LLFIFO_BLOCK_SLOTS];
+}block_t;
 
+// Slab Struct: one allocation holding count blocks, which are handed
+// out in order, carved at a time. idle is scratch space for
+// llfifo_shrink().
+typedef struct slab_s {
+    struct slab_s *next;
+    int count;
+    int carved;
+    int idle;
+    block_t block[];
+}slab_t;
 
-// Defining Struct Space 
+
+/*
+ * Defining Struct Space
+ *
+ * Elements are stored in a linked list of blocks, each holding up to
+ * LLFIFO_BLOCK_SLOTS of them, from slot head_idx of the head block to
+ * slot tail_idx - 1 of the tail block. Blocks emptied by dequeue are
+ * kept on the unused list and reused by enqueue.
+ *
+ * Blocks are not allocated one by one but carved from slabs, newest
+ * first on the slabs list. llfifo_create() makes a single slab for the
+ * initial capacity, and each later slab is as large as all the earlier
+ * ones together (up to LLFIFO_SLAB_MAX blocks), so growing to n
+ * elements takes O(log n) allocations and teardown frees only the slabs.
+ *
+ * capacity counts element slots the way the one node per element list
+ * did: it starts at the value given to llfifo_create() and grows by one
+ * each time an enqueue finds length == capacity. Slabs are only
+ * allocated when the slots already held run out, so slots is always at
+ * least capacity.
+ *
+ * An LLFIFO_ARRAY FIFO has no blocks: its elements are in ring, a
+ * circular array of slots pointers, from ring[head_idx] on.
+ */
 struct llfifo_s {
     int capacity;
     int length;
-    node_t *head, *tail, *unused;
-    int allocatednodes;
+    block_t *head, *tail, *unused;
+    int head_idx, tail_idx;
+    slab_t *slabs;
+    // Element slots in all the slabs allocated, and blocks on unused
+    int slots;
+    int num_unused;
+    // Automatic trim policy, see llfifo_set_trim(); 0 when off
+    int trim_high, trim_low;
+    // Options from llfifo_create_ex(), and the LLFIFO_MPMC queue
+    unsigned flags;
+    struct mpmc_s *mpmc;
+    // LLFIFO_INTRUSIVE: the caller's links, oldest first, and where the
+    // link sits in the caller's struct
+    llfifo_link_t *links, *last_link;
+    size_t link_offset;
+    // LLFIFO_ARRAY: the elements
+    void **ring;
 };
 
 /*
- * Dynamically creates a new done and stores the 
- * Address of the pointer to a new node
+ * Dynamically creates a new slab of count blocks and
+ * puts it at the front of the slabs list
  */
-static node_t* newNode( node_t* next) {
-    node_t* ne = (node_t*)malloc(sizeof(node_t));
+static slab_t* newSlab(llfifo_t *fifo, int count) {
+    slab_t* ne = (slab_t*)malloc(sizeof(slab_t) + (size_t)count * sizeof(block_t));
 
     if(ne == NULL)
         return NULL;
 
-    ne->next = next;
-    ne->key = NULL;
+    ne->next = fifo->slabs;
+    ne->count = count;
+    ne->carved = 0;
+    fifo->slabs = ne;
+    fifo->slots += count * LLFIFO_BLOCK_SLOTS;
     return ne;
 }
 
+/*
+ * Returns a free block: a recycled one from the unused list, else the
+ * next one carved from the newest slab, else one from a new slab
+ */
+static block_t* newBlock(llfifo_t *fifo) {
+    block_t *blk = fifo->unused;
+    if(blk) {
+        // Basically Dequeue and rePointer
+        fifo->unused = blk->next;
+        fifo->num_unused--;
+        return blk;
+    }
+
+    slab_t *slab = fifo->slabs;
+    if(slab == NULL || slab->carved == slab->count) {
+        // Double the blocks held
+        int count = fifo->slots / LLFIFO_BLOCK_SLOTS;
+        if(count < 1)
+            count = 1;
+        if(count > LLFIFO_SLAB_MAX)
+            count = LLFIFO_SLAB_MAX;
+        slab = newSlab(fifo, count);
+        if(slab == NULL)
+            return NULL;
+    }
+    return &slab->block[slab->carved++];
+}
+
+
+/*
+ * Multi-producer, multi-consumer mode (LLFIFO_MPMC)
+ *
+ * A Michael-Scott queue: a linked list of mpmc_node_t from head to
+ * tail, where head is a dummy node and the elements are in the nodes
+ * after it. Enqueue links a node on after tail with a CAS and then
+ * swings tail; dequeue swings head to the next node with a CAS and
+ * takes that node's element, the next node becoming the new dummy. A
+ * thread that finds tail lagging behind the last node moves it on.
+ *
+ * A dequeued dummy cannot be freed or reused while another thread may
+ * still be reading it, so nodes are reclaimed with hazard pointers:
+ * before a thread dereferences head, tail or a next node it publishes
+ * the pointer in one of its hazard slots and checks it is still
+ * current. Removed nodes go on the remover's retired list, and once
+ * LLFIFO_RETIRE_SCAN of them have built up, those that no thread has
+ * in a hazard slot are moved to the remover's free list for its own
+ * enqueues (or freed, past LLFIFO_FREE_MAX). A node is only ever
+ * reused once nobody holds it, so the head and tail CASes are also
+ * safe from ABA.
+ *
+ * Each thread that uses an MPMC FIFO takes a thread number, shared by
+ * all such FIFOs and given back when the thread exits, and owns the
+ * record with that number in each FIFO: hazard slots, retired and
+ * free lists and element counts. At most LLFIFO_MAX_THREADS threads
+ * may use MPMC FIFOs at once.
+ */
+#define LLFIFO_MAX_THREADS  128
+#define LLFIFO_RETIRE_SCAN  (4 * LLFIFO_MAX_THREADS)
+#define LLFIFO_FREE_MAX     (4 * LLFIFO_MAX_THREADS)
+
+typedef struct mpmc_node_s {
+    struct mpmc_node_s *_Atomic next;
+    void *key;
+    // Link on the owner's retired or free list
+    struct mpmc_node_s *free_next;
+} mpmc_node_t;
+
+// Per thread record, written only by the thread that owns it
+typedef struct {
+    _Alignas(LLFIFO_CACHELINE) mpmc_node_t *_Atomic hazard[2];
+    mpmc_node_t *retired, *free;
+    int num_retired, num_free;
+    // Elements this record enqueued and dequeued, see llfifo_length()
+    _Atomic long enqueued, dequeued;
+} mpmc_thread_t;
+
+typedef struct mpmc_s {
+    _Alignas(LLFIFO_CACHELINE) mpmc_node_t *_Atomic head;
+    _Alignas(LLFIFO_CACHELINE) mpmc_node_t *_Atomic tail;
+    // Nodes allocated, less the dummy
+    _Alignas(LLFIFO_CACHELINE) _Atomic int nodes;
+    mpmc_thread_t thread[LLFIFO_MAX_THREADS];
+} mpmc_t;
+
+// Thread numbers in use, and this thread's number plus one (0 for none)
+static _Atomic unsigned char mpmc_used[LLFIFO_MAX_THREADS];
+static _Thread_local int mpmc_self;
+static pthread_key_t mpmc_key;
+static pthread_once_t mpmc_once = PTHREAD_ONCE_INIT;
+
+// Gives a thread's number back when it exits
+static void mpmc_release(void *self) {
+    atomic_store_explicit(&mpmc_used[(intptr_t)self - 1], 0, memory_order_release);
+}
+
+static void mpmc_init_key() {
+    pthread_key_create(&mpmc_key, mpmc_release);
+}
+
+/*
+ * Returns the calling thread's record in mpmc, taking a thread number
+ * on first use, or NULL if all LLFIFO_MAX_THREADS are taken
+ */
+static mpmc_thread_t *mpmc_me(mpmc_t *mpmc) {
+    if(mpmc_self == 0) {
+        pthread_once(&mpmc_once, mpmc_init_key);
+        for(int i = 0; i < LLFIFO_MAX_THREADS; i++) {
+            unsigned char unused = 0;
+            if(atomic_compare_exchange_strong_explicit(&mpmc_used[i], &unused, 1,
+                    memory_order_acquire, memory_order_relaxed)) {
+                mpmc_self = i + 1;
+                pthread_setspecific(mpmc_key, (void *)(intptr_t)mpmc_self);
+                break;
+            }
+        }
+        if(mpmc_self == 0)
+            return NULL;
+    }
+    return &mpmc->thread[mpmc_self - 1];
+}
+
+/*
+ * Publishes *src in hazard slot h and returns it, once it is known to
+ * have still been current after publishing
+ */
+static mpmc_node_t *mpmc_protect(mpmc_thread_t *me, int h, mpmc_node_t *_Atomic *src) {
+    mpmc_node_t *node = atomic_load_explicit(src, memory_order_acquire);
+    for(;;) {
+        atomic_store_explicit(&me->hazard[h], node, memory_order_seq_cst);
+        mpmc_node_t *again = atomic_load_explicit(src, memory_order_seq_cst);
+        if(again == node)
+            return node;
+        node = again;
+    }
+}
+
+static int mpmc_cmp(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(mpmc_node_t * const *)a;
+    uintptr_t y = (uintptr_t)*(mpmc_node_t * const *)b;
+    return (x > y) - (x < y);
+}
+
+// Moves the retired nodes no thread holds onto the free list
+static void mpmc_scan(mpmc_t *mpmc, mpmc_thread_t *me) {
+    mpmc_node_t *held[2 * LLFIFO_MAX_THREADS];
+    int num_held = 0;
+
+    for(int i = 0; i < LLFIFO_MAX_THREADS; i++) {
+        for(int h = 0; h < 2; h++) {
+            mpmc_node_t *node = atomic_load_explicit(&mpmc->thread[i].hazard[h], memory_order_seq_cst);
+            if(node)
+                held[num_held++] = node;
+        }
+    }
+    qsort(held, num_held, sizeof(held[0]), mpmc_cmp);
+
+    mpmc_node_t *node = me->retired;
+    me->retired = NULL;
+    me->num_retired = 0;
+    while(node) {
+        mpmc_node_t *next = node->free_next;
+        if(bsearch(&node, held, num_held, sizeof(held[0]), mpmc_cmp)) {
+            node->free_next = me->retired;
+            me->retired = node;
+            me->num_retired++;
+        } else if(me->num_free < LLFIFO_FREE_MAX) {
+            node->free_next = me->free;
+            me->free = node;
+            me->num_free++;
+        } else {
+            free(node);
+            atomic_fetch_sub_explicit(&mpmc->nodes, 1, memory_order_relaxed);
+        }
+        node = next;
+    }
+}
+
+// Returns a node from the caller's free list, or a new one
+static mpmc_node_t *mpmc_node(mpmc_t *mpmc, mpmc_thread_t *me) {
+    mpmc_node_t *node = me->free;
+    if(node) {
+        me->free = node->free_next;
+        me->num_free--;
+        return node;
+    }
+    node = (mpmc_node_t*)malloc(sizeof(mpmc_node_t));
+    if(node)
+        atomic_fetch_add_explicit(&mpmc->nodes, 1, memory_order_relaxed);
+    return node;
+}
+
+static mpmc_t *mpmc_create(int capacity) {
+    mpmc_t *mpmc = (mpmc_t*)aligned_alloc(LLFIFO_CACHELINE, sizeof(mpmc_t));
+    mpmc_node_t *dummy = (mpmc_node_t*)malloc(sizeof(mpmc_node_t));
+    if(mpmc == NULL || dummy == NULL) {
+        free(mpmc);
+        free(dummy);
+        return NULL;
+    }
+    memset(mpmc, 0, sizeof(mpmc_t));
+
+    atomic_init(&dummy->next, NULL);
+    atomic_init(&mpmc->head, dummy);
+    atomic_init(&mpmc->tail, dummy);
+    atomic_init(&mpmc->nodes, 0);
+
+    // The initial capacity goes to the creating thread
+    mpmc_thread_t *me = mpmc_me(mpmc);
+    for(int i = 0; me && i < capacity; i++) {
+        mpmc_node_t *node = (mpmc_node_t*)malloc(sizeof(mpmc_node_t));
+        if(node == NULL)
+            break;
+        atomic_fetch_add_explicit(&mpmc->nodes, 1, memory_order_relaxed);
+        node->free_next = me->free;
+        me->free = node;
+        me->num_free++;
+    }
+    return mpmc;
+}
+
+static int mpmc_enqueue(mpmc_t *mpmc, void *element) {
+    mpmc_thread_t *me = mpmc_me(mpmc);
+    if(me == NULL)
+        return -1;
+    mpmc_node_t *node = mpmc_node(mpmc, me);
+    if(node == NULL)
+        return -1;
+    node->key = element;
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+
+    mpmc_node_t *tail;
+    for(;;) {
+        tail = mpmc_protect(me, 0, &mpmc->tail);
+        mpmc_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if(tail != atomic_load_explicit(&mpmc->tail, memory_order_acquire))
+            continue;
+        if(next) {
+            // tail is lagging, help it along
+            atomic_compare_exchange_weak_explicit(&mpmc->tail, &tail, next,
+                memory_order_release, memory_order_relaxed);
+            continue;
+        }
+        mpmc_node_t *expected = NULL;
+        if(atomic_compare_exchange_weak_explicit(&tail->next, &expected, node,
+                memory_order_release, memory_order_relaxed))
+            break;
+    }
+    atomic_compare_exchange_strong_explicit(&mpmc->tail, &tail, node,
+        memory_order_release, memory_order_relaxed);
+    atomic_store_explicit(&me->hazard[0], NULL, memory_order_release);
+
+    atomic_store_explicit(&me->enqueued,
+        atomic_load_explicit(&me->enqueued, memory_order_relaxed) + 1, memory_order_relaxed);
+    return 1;
+}
+
+static void *mpmc_dequeue(mpmc_t *mpmc) {
+    mpmc_thread_t *me = mpmc_me(mpmc);
+    if(me == NULL)
+        return NULL;
+
+    mpmc_node_t *head;
+    void *element;
+    for(;;) {
+        head = mpmc_protect(me, 0, &mpmc->head);
+        mpmc_node_t *tail = atomic_load_explicit(&mpmc->tail, memory_order_acquire);
+        mpmc_node_t *next = mpmc_protect(me, 1, &head->next);
+        if(head != atomic_load_explicit(&mpmc->head, memory_order_seq_cst))
+            continue;
+        if(next == NULL) {
+            // Empty
+            atomic_store_explicit(&me->hazard[0], NULL, memory_order_release);
+            atomic_store_explicit(&me->hazard[1], NULL, memory_order_release);
+            return NULL;
+        }
+        if(head == tail) {
+            // tail is lagging, help it along before moving head past it
+            atomic_compare_exchange_weak_explicit(&mpmc->tail, &tail, next,
+                memory_order_release, memory_order_relaxed);
+            continue;
+        }
+        element = next->key;
+        if(atomic_compare_exchange_weak_explicit(&mpmc->head, &head, next,
+                memory_order_acq_rel, memory_order_relaxed))
+            break;
+    }
+    atomic_store_explicit(&me->hazard[0], NULL, memory_order_release);
+    atomic_store_explicit(&me->hazard[1], NULL, memory_order_release);
+
+    // The old dummy is ours now, but others may still be reading it
+    head->free_next = me->retired;
+    me->retired = head;
+    if(++me->num_retired >= LLFIFO_RETIRE_SCAN)
+        mpmc_scan(mpmc, me);
+
+    atomic_store_explicit(&me->dequeued,
+        atomic_load_explicit(&me->dequeued, memory_order_relaxed) + 1, memory_order_relaxed);
+    return element;
+}
+
+// Sum of the per thread counts: exact only while no thread is active
+static int mpmc_length(mpmc_t *mpmc) {
+    long length = 0;
+    for(int i = 0; i < LLFIFO_MAX_THREADS; i++) {
+        length += atomic_load_explicit(&mpmc->thread[i].enqueued, memory_order_relaxed);
+        length -= atomic_load_explicit(&mpmc->thread[i].dequeued, memory_order_relaxed);
+    }
+    return (length > 0) ? (int)length : 0;
+}
+
+// Helper Function to free a list linked through free_next
+static void mpmc_free_list(mpmc_node_t *node) {
+    while(node) {
+        mpmc_node_t *next = node->free_next;
+        free(node);
+        node = next;
+    }
+}
+
+static void mpmc_destroy(mpmc_t *mpmc) {
+    mpmc_node_t *node = atomic_load_explicit(&mpmc->head, memory_order_relaxed);
+    while(node) {
+        mpmc_node_t *next = atomic_load_explicit(&node->next, memory_order_relaxed);
+        free(node);
+        node = next;
+    }
+    for(int i = 0; i < LLFIFO_MAX_THREADS; i++) {
+        mpmc_free_list(mpmc->thread[i].retired);
+        mpmc_free_list(mpmc->thread[i].free);
+    }
+    free(mpmc);
+}
+
 
 /*
  * Initializes the FIFO
@@ -73,34 +471,226 @@ static node_t* newNode( node_t* next) {
  *   A pointer to an llfifo_t, or NULL in case of an error.
  */
 llfifo_t *llfifo_create(int capacity) {
+    return llfifo_create_ex(capacity, 0);
+}
+
+
+/*
+ * Initializes the FIFO, with options
+ *
+ * Parameters:
+ *   capacity  the initial size of the fifo, in number of elements
+ *   flags     Bitwise OR of LLFIFO_* options, or 0
+ * 
+ * Returns:
+ *   A pointer to an llfifo_t, or NULL in case of an error.
+ */
+llfifo_t *llfifo_create_ex(int capacity, unsigned flags) {
     if(capacity < 0)
         return NULL;
 
     // Creates array 
     assert(capacity >= 0);
     llfifo_t* fifo = (llfifo_t*)malloc(sizeof(llfifo_t));
-    assert(fifo);
+    if(fifo == NULL)
+        return NULL;
 
     fifo->capacity = capacity;
-    fifo->allocatednodes = capacity;
     fifo->length = 0;
     fifo->head = fifo->tail = fifo->unused = NULL;
+    fifo->head_idx = fifo->tail_idx = 0;
+    fifo->slabs = NULL;
+    fifo->slots = 0;
+    fifo->num_unused = 0;
+    fifo->trim_high = fifo->trim_low = 0;
+    fifo->flags = flags;
+    fifo->mpmc = NULL;
+    fifo->links = fifo->last_link = NULL;
+    fifo->link_offset = 0;
+    fifo->ring = NULL;
 
-    // Sends the existing location of unused to store
-    // as Next to a temp variable basically 
-    // Creating a linked list with a temp node pointing 
-    // to unused and head of the linkedlist as fifo->unused
-    for(int i =0; i<capacity; i++) {
-        fifo->unused = newNode(fifo->unused);
+    if(flags & LLFIFO_ARRAY) {
+        if(flags & (LLFIFO_MPMC | LLFIFO_INTRUSIVE)) {
+            free(fifo);
+            return NULL;
+        }
+        // One array with exactly capacity slots
+        if(capacity > 0) {
+            fifo->ring = (void**)malloc(capacity * sizeof(void*));
+            if(fifo->ring == NULL) {
+                free(fifo);
+                return NULL;
+            }
+            fifo->slots = capacity;
+        }
+        return fifo;
+    }
 
-        // Checks for Failure Case
-        if(fifo->unused == NULL)
+    // Elements carry their own links, so there is nothing to allocate.
+    // The links are not thread safe, so LLFIFO_MPMC cannot be honoured.
+    if(flags & LLFIFO_INTRUSIVE) {
+        if(flags & LLFIFO_MPMC) {
+            free(fifo);
             return NULL;
+        }
+        return fifo;
     }
+
+    if(flags & LLFIFO_MPMC) {
+        fifo->mpmc = mpmc_create(capacity);
+        if(fifo->mpmc == NULL) {
+            free(fifo);
+            return NULL;
+        }
+        return fifo;
+    }
+
+    // One contiguous slab with enough blocks for capacity elements
+    if(capacity > 0 &&
+       newSlab(fifo, (capacity + LLFIFO_BLOCK_SLOTS - 1) / LLFIFO_BLOCK_SLOTS) == NULL) {
+        // Checks for Failure Case
+        free(fifo);
+        return NULL;
+    }
+    return fifo;
+}
+
+
+/*
+ * Initializes an LLFIFO_INTRUSIVE FIFO for elements that embed their
+ * llfifo_link_t at the given offset
+ *
+ * Parameters:
+ *   link_offset  offsetof() the llfifo_link_t in the elements' struct
+ * 
+ * Returns:
+ *   A pointer to an llfifo_t, or NULL in case of an error.
+ */
+llfifo_t *llfifo_create_intrusive(size_t link_offset) {
+    llfifo_t *fifo = llfifo_create_ex(0, LLFIFO_INTRUSIVE);
+    if(fifo)
+        fifo->link_offset = link_offset;
     return fifo;
 }
 
 
+// Helper Function to enqueue on an LLFIFO_INTRUSIVE FIFO
+static int intrusive_enqueue(llfifo_t *fifo, void *element) {
+    if(element == NULL)
+        return -1;
+    llfifo_link_t *link = (llfifo_link_t*)((char*)element + fifo->link_offset);
+    atomic_store_explicit(&link->next, NULL, memory_order_relaxed);
+
+    if(fifo->last_link)
+        atomic_store_explicit(&fifo->last_link->next, link, memory_order_relaxed);
+    else
+        fifo->links = link;
+    fifo->last_link = link;
+
+    if(fifo->length == fifo->capacity)
+        fifo->capacity++;
+    return (++fifo->length);
+}
+
+// Helper Function to dequeue from an LLFIFO_INTRUSIVE FIFO
+static void *intrusive_dequeue(llfifo_t *fifo) {
+    llfifo_link_t *link = fifo->links;
+    if(link == NULL)
+        return NULL;
+
+    fifo->links = atomic_load_explicit(&link->next, memory_order_relaxed);
+    if(fifo->links == NULL)
+        fifo->last_link = NULL;
+    fifo->length--;
+    return (char*)link - fifo->link_offset;
+}
+
+
+/*
+ * Helper Function to resize an LLFIFO_ARRAY FIFO's array to size
+ * slots, which must be at least the length. Growing reallocates in
+ * place where it can, then moves whichever part of the elements that
+ * wrapped round is cheaper to move; shrinking copies the elements to
+ * the start of a new array.
+ */
+static int array_resize(llfifo_t *fifo, int size) {
+    // Elements from head_idx to the end of the array, and wrapped to the start
+    int first = fifo->slots - fifo->head_idx;
+    if(first > fifo->length)
+        first = fifo->length;
+    int wrapped = fifo->length - first;
+    void **ring;
+
+    if(size > fifo->slots) {
+        ring = (void**)realloc(fifo->ring, size * sizeof(void*));
+        if(ring == NULL)
+            return -1;
+        if(wrapped > 0) {
+            if(wrapped <= size - fifo->slots) {
+                memcpy(ring + fifo->slots, ring, wrapped * sizeof(void*));
+            } else {
+                memmove(ring + size - first, ring + fifo->head_idx, first * sizeof(void*));
+                fifo->head_idx = size - first;
+            }
+        }
+    } else {
+        ring = NULL;
+        if(size > 0 && (ring = (void**)malloc(size * sizeof(void*))) == NULL)
+            return -1;
+        if(fifo->length > 0) {
+            memcpy(ring, fifo->ring + fifo->head_idx, first * sizeof(void*));
+            memcpy(ring + first, fifo->ring, wrapped * sizeof(void*));
+        }
+        free(fifo->ring);
+        fifo->head_idx = 0;
+    }
+
+    fifo->ring = ring;
+    fifo->slots = size;
+    return 0;
+}
+
+// Helper Function to make room for n more elements on an LLFIFO_ARRAY
+// FIFO, at least doubling the array when it has to grow
+static int array_room(llfifo_t *fifo, int n) {
+    int want = fifo->length + n;
+    if(want <= fifo->slots)
+        return 0;
+    int size = (fifo->slots < 16) ? 16 : fifo->slots;
+    while(size < want)
+        size = (size > INT32_MAX / 2) ? INT32_MAX : size * 2;
+    return array_resize(fifo, size);
+}
+
+// Helper Function to enqueue on an LLFIFO_ARRAY FIFO
+static int array_enqueue(llfifo_t *fifo, void *element) {
+    if(fifo->length == fifo->slots && array_room(fifo, 1) < 0)
+        return -1;
+
+    int idx = fifo->head_idx + fifo->length;
+    if(idx >= fifo->slots)
+        idx -= fifo->slots;
+    fifo->ring[idx] = element;
+
+    if(fifo->length == fifo->capacity)
+        fifo->capacity++;
+    return (++fifo->length);
+}
+
+// Helper Function to dequeue from an LLFIFO_ARRAY FIFO
+static void *array_dequeue(llfifo_t *fifo) {
+    if(fifo->length == 0)
+        return NULL;
+
+    void *element = fifo->ring[fifo->head_idx++];
+    if(fifo->head_idx == fifo->slots)
+        fifo->head_idx = 0;
+    if(--fifo->length == 0)
+        fifo->head_idx = 0;
+    return element;
+}
+
+
 /*
  * Enqueues an element onto the FIFO, growing the FIFO by adding
  * additional elements, if necessary
@@ -115,40 +705,49 @@ llfifo_t *llfifo_create(int capacity) {
 int llfifo_enqueue(llfifo_t *fifo, void *element) {
 
     assert(fifo);
+    if(fifo->mpmc)
+        return mpmc_enqueue(fifo->mpmc, element);
+    if(fifo->flags & LLFIFO_INTRUSIVE)
+        return intrusive_enqueue(fifo, element);
+    if(fifo->flags & LLFIFO_ARRAY)
+        return array_enqueue(fifo, element);
 
-    // ele would not point at the 2nd node of the unused 
-    // linkedlist and data currently is NULL
-    node_t * ele = fifo->unused;
-
-    if(ele) {
-        // Basically Dequeue and rePointer
-        fifo->unused = ele->next;
-    } else {
-        // Increasing Capacity
-        ele = newNode(fifo->head);
-        if(ele == NULL)
+    // Tail block is full (or there is none), link on another one
+    if(fifo->tail == NULL || fifo->tail_idx == LLFIFO_BLOCK_SLOTS) {
+        block_t *blk = newBlock(fifo);
+        if(blk == NULL)
             return -1;
-        fifo->capacity++;
+        blk->next = NULL;
+
+        if(fifo->tail)
+            fifo->tail->next = blk;
+        else
+            fifo->head = blk;
+        fifo->tail = blk;
+        fifo->tail_idx = 0;
     }
 
-    // Store Contents 
-    ele->next = NULL;
-    ele->key = element;
+    // Store Contents
+    fifo->tail->slot[fifo->tail_idx++] = element;
+
+    // Increasing Capacity
+    if(fifo->length == fifo->capacity)
+        fifo->capacity++;
 
-    // Incrementing Tail
-    if(fifo->tail)
-        fifo->tail->next = ele;
-    
-    fifo->tail = ele;
-    
-    // If its the first element the head is set to point to it
-    if(!fifo->head)
-        fifo->head = ele;
-    
     return (++fifo->length);
 }
 
 
+// Helper Function for the trim policy, see llfifo_set_trim(): at or
+// below the low water mark with more than the high water mark held,
+// give the surplus back
+static void llfifo_auto_trim(llfifo_t *fifo) {
+    if(fifo->trim_high > 0 && fifo->length <= fifo->trim_low &&
+       fifo->capacity > fifo->trim_high)
+        llfifo_shrink(fifo, fifo->trim_high);
+}
+
+
 /*
  * Removes ("dequeues") an element from the FIFO, and returns it
  *
@@ -161,22 +760,531 @@ int llfifo_enqueue(llfifo_t *fifo, void *element) {
 void *llfifo_dequeue(llfifo_t *fifo) {
     
     assert(fifo);
-    node_t* ele = fifo->head;
-    if(ele == NULL)
+    if(fifo->mpmc)
+        return mpmc_dequeue(fifo->mpmc);
+    if(fifo->flags & (LLFIFO_INTRUSIVE | LLFIFO_ARRAY)) {
+        void *element = (fifo->flags & LLFIFO_ARRAY) ? array_dequeue(fifo)
+            : intrusive_dequeue(fifo);
+        llfifo_auto_trim(fifo);
+        return element;
+    }
+    if(fifo->length == 0)
         return NULL;
-    
-    // Move Head 1 node upwards
-    fifo->head = ele->next;
-    // Set this next to point to fifo->unused
-    ele->next = fifo->unused;
-
-    // Is empty 
-    if(fifo->head == NULL)
-        fifo->tail = NULL;
-    
-    fifo->unused = ele;
+
+    block_t *blk = fifo->head;
+    void *element = blk->slot[fifo->head_idx++];
     fifo->length--;
-    return ele->key;
+
+    if(fifo->length == 0) {
+        // Is empty: keep the block, and start it over
+        fifo->head_idx = fifo->tail_idx = 0;
+    } else if(fifo->head_idx == LLFIFO_BLOCK_SLOTS) {
+        // Move Head 1 block upwards, and set this block
+        // to point to fifo->unused
+        fifo->head = blk->next;
+        fifo->head_idx = 0;
+        blk->next = fifo->unused;
+        fifo->unused = blk;
+        fifo->num_unused++;
+    }
+
+    llfifo_auto_trim(fifo);
+    return element;
+}
+
+
+// Helper Function to find the slab a block was carved from
+static slab_t *slabOf(llfifo_t *fifo, block_t *blk, slab_t *hint) {
+    if(hint && blk >= hint->block && blk < hint->block + hint->count)
+        return hint;
+    for(slab_t *slab = fifo->slabs; slab; slab = slab->next)
+        if(blk >= slab->block && blk < slab->block + slab->count)
+            return slab;
+    return NULL;
+}
+
+
+/*
+ * Lowers the FIFO's capacity and gives idle memory back
+ *
+ * Parameters:
+ *   fifo             The fifo in question
+ *   target_capacity  The capacity wanted, in number of elements
+ * 
+ * Returns:
+ *   The new capacity, which is at least the current length
+ */
+int llfifo_shrink(llfifo_t *fifo, int target_capacity) {
+
+    assert(fifo);
+    if(fifo->mpmc)
+        return -1;
+    fifo->capacity = (target_capacity > fifo->length) ? target_capacity : fifo->length;
+
+    // Only the array's size to change
+    if(fifo->flags & LLFIFO_ARRAY) {
+        if(fifo->slots > fifo->capacity)
+            array_resize(fifo, fifo->capacity);
+        return fifo->capacity;
+    }
+
+    // An empty FIFO still holds on to its last block
+    if(fifo->length == 0 && fifo->head) {
+        fifo->head->next = fifo->unused;
+        fifo->unused = fifo->head;
+        fifo->num_unused++;
+        fifo->head = fifo->tail = NULL;
+        fifo->head_idx = fifo->tail_idx = 0;
+    }
+
+    // Count the idle blocks of each slab: never carved, or unused
+    slab_t *slab, *hint = NULL;
+    for(slab = fifo->slabs; slab; slab = slab->next)
+        slab->idle = slab->count - slab->carved;
+    for(block_t *blk = fifo->unused; blk; blk = blk->next) {
+        hint = slabOf(fifo, blk, hint);
+        hint->idle++;
+    }
+
+    // Pick the slabs with every block idle, as long as enough slots
+    // stay for capacity. Picked slabs are marked with idle = -1.
+    int freeing = 0;
+    for(slab = fifo->slabs; slab; slab = slab->next) {
+        int slots = slab->count * LLFIFO_BLOCK_SLOTS;
+        if(slab->idle == slab->count && fifo->slots - slots >= fifo->capacity) {
+            fifo->slots -= slots;
+            slab->idle = -1;
+            freeing = 1;
+        }
+    }
+
+    // Drop the blocks of picked slabs from the unused list
+    if(freeing) {
+        block_t **link = &fifo->unused;
+        hint = NULL;
+        while(*link) {
+            hint = slabOf(fifo, *link, hint);
+            if(hint->idle < 0) {
+                *link = (*link)->next;
+                fifo->num_unused--;
+            } else
+                link = &(*link)->next;
+        }
+    }
+
+    // Free the picked slabs
+    slab_t **link = &fifo->slabs;
+    while( (slab = *link) ) {
+        if(slab->idle < 0) {
+            *link = slab->next;
+            free(slab);
+        } else {
+            link = &slab->next;
+        }
+    }
+    return fifo->capacity;
+}
+
+
+/*
+ * Grows the FIFO ahead of a burst, so the next n enqueues need no
+ * allocation
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *   n     Number of elements to make room for, beyond the current length
+ * 
+ * Returns:
+ *   The new capacity on success, -1 on failure
+ */
+int llfifo_reserve(llfifo_t *fifo, int n) {
+
+    assert(fifo);
+    if(fifo->mpmc || n < 0 || n > INT32_MAX - fifo->length)
+        return -1;
+
+    // Elements bring their own links
+    if(fifo->flags & LLFIFO_INTRUSIVE) {
+        if(fifo->capacity < fifo->length + n)
+            fifo->capacity = fifo->length + n;
+        return fifo->capacity;
+    }
+
+    if(fifo->flags & LLFIFO_ARRAY) {
+        if(fifo->slots < fifo->length + n && array_resize(fifo, fifo->length + n) < 0)
+            return -1;
+        if(fifo->capacity < fifo->length + n)
+            fifo->capacity = fifo->length + n;
+        return fifo->capacity;
+    }
+
+    // Slots free without allocating: the rest of the tail block, the
+    // unused blocks and the blocks not yet carved from the newest slab
+    int room = fifo->num_unused * LLFIFO_BLOCK_SLOTS;
+    if(fifo->tail)
+        room += LLFIFO_BLOCK_SLOTS - fifo->tail_idx;
+    if(fifo->slabs)
+        room += (fifo->slabs->count - fifo->slabs->carved) * LLFIFO_BLOCK_SLOTS;
+
+    if(room < n) {
+        // The new slab becomes the newest, so any blocks left uncarved
+        // in the old one have to be moved to the unused list first
+        slab_t *slab = fifo->slabs;
+        while(slab && slab->carved < slab->count) {
+            block_t *blk = &slab->block[slab->carved++];
+            blk->next = fifo->unused;
+            fifo->unused = blk;
+            fifo->num_unused++;
+        }
+        if(newSlab(fifo, (n - room + LLFIFO_BLOCK_SLOTS - 1) / LLFIFO_BLOCK_SLOTS) == NULL)
+            return -1;
+    }
+
+    int want = fifo->length + n;
+    if(fifo->capacity < want)
+        fifo->capacity = want;
+    return fifo->capacity;
+}
+
+
+/*
+ * Sets the automatic trim policy
+ *
+ * Parameters:
+ *   fifo        The fifo in question
+ *   high_water  Capacity to shrink back to, or 0 to turn trimming off
+ *   low_water   Length at or below which a dequeue trims the FIFO
+ * 
+ * Returns:
+ *   0 on success, -1 on failure
+ */
+int llfifo_set_trim(llfifo_t *fifo, int high_water, int low_water) {
+
+    assert(fifo);
+    if(fifo->mpmc)
+        return -1;
+    if(high_water < 0 || low_water < 0 || (high_water > 0 && low_water > high_water))
+        return -1;
+    fifo->trim_high = high_water;
+    fifo->trim_low = low_water;
+    return 0;
+}
+
+
+/*
+ * Returns the number of element slots the FIFO has memory for
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   The element slots allocated, at least the capacity
+ */
+int llfifo_allocated(llfifo_t *fifo) {
+    assert(fifo);
+    if(fifo->mpmc)
+        return llfifo_capacity(fifo);
+    return fifo->slots;
+}
+
+
+/*
+ * Enqueues n elements onto the FIFO at once, growing the FIFO if
+ * necessary
+ *
+ * Parameters:
+ *   fifo    The fifo in question
+ *   elems   The elements to enqueue, oldest first
+ *   n       Number of elements
+ * 
+ * Returns:
+ *   The new length of the FIFO on success, -1 on failure, in which
+ * case nothing was enqueued
+ */
+int llfifo_enqueue_many(llfifo_t *fifo, void **elems, int n) {
+
+    assert(fifo);
+    if(n < 0 || (n > 0 && elems == NULL) || n > INT32_MAX - fifo->length)
+        return -1;
+
+    // One at a time, each element being its own node
+    if(fifo->mpmc) {
+        for(int i = 0; i < n; i++)
+            if(mpmc_enqueue(fifo->mpmc, elems[i]) < 0)
+                return -1;
+        return n;
+    }
+    if(fifo->flags & LLFIFO_INTRUSIVE) {
+        for(int i = 0; i < n; i++)
+            if(elems[i] == NULL)
+                return -1;
+        for(int i = 0; i < n; i++)
+            intrusive_enqueue(fifo, elems[i]);
+        return fifo->length;
+    }
+    if(fifo->flags & LLFIFO_ARRAY) {
+        if(n == 0 || array_room(fifo, n) < 0)
+            return (n == 0) ? fifo->length : -1;
+        // Up to the end of the array, then the rest from the start
+        int idx = fifo->head_idx + fifo->length;
+        if(idx >= fifo->slots)
+            idx -= fifo->slots;
+        int count = (n < fifo->slots - idx) ? n : fifo->slots - idx;
+        memcpy(fifo->ring + idx, elems, count * sizeof(void*));
+        memcpy(fifo->ring, elems + count, (n - count) * sizeof(void*));
+        fifo->length += n;
+        if(fifo->capacity < fifo->length)
+            fifo->capacity = fifo->length;
+        return fifo->length;
+    }
+
+    int room = fifo->tail ? LLFIFO_BLOCK_SLOTS - fifo->tail_idx : 0;
+
+    // Take every block needed up front, as a chain, so a failure
+    // leaves the FIFO as it was
+    block_t *first = NULL, *last = NULL;
+    int taken = 0;
+    for(int need = n - room; need > 0; need -= LLFIFO_BLOCK_SLOTS) {
+        block_t *blk = newBlock(fifo);
+        if(blk == NULL) {
+            if(first) {
+                last->next = fifo->unused;
+                fifo->unused = first;
+                fifo->num_unused += taken;
+            }
+            return -1;
+        }
+        taken++;
+        blk->next = NULL;
+        if(last)
+            last->next = blk;
+        else
+            first = blk;
+        last = blk;
+    }
+
+    // Fill the rest of the tail block, then the new blocks in turn
+    int done = (room < n) ? room : n;
+    if(done > 0) {
+        memcpy(&fifo->tail->slot[fifo->tail_idx], elems, done * sizeof(void*));
+        fifo->tail_idx += done;
+    }
+    for(block_t *blk = first; blk; blk = blk->next) {
+        int count = (n - done < LLFIFO_BLOCK_SLOTS) ? n - done : LLFIFO_BLOCK_SLOTS;
+        memcpy(blk->slot, elems + done, count * sizeof(void*));
+        done += count;
+        fifo->tail_idx = count;
+    }
+
+    // Link the new chain on at the tail
+    if(first) {
+        if(fifo->tail)
+            fifo->tail->next = first;
+        else
+            fifo->head = first;
+        fifo->tail = last;
+    }
+
+    fifo->length += n;
+    if(fifo->capacity < fifo->length)
+        fifo->capacity = fifo->length;
+    return fifo->length;
+}
+
+
+/*
+ * Removes ("dequeues") up to max elements from the FIFO at once
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *   out   Set to the dequeued elements, oldest first
+ *   max   Room in out, in number of elements
+ * 
+ * Returns:
+ *   The number of elements dequeued, which could be 0, or -1 on failure
+ */
+int llfifo_dequeue_many(llfifo_t *fifo, void **out, int max) {
+
+    assert(fifo);
+    if(max < 0 || (max > 0 && out == NULL))
+        return -1;
+
+    if(fifo->mpmc || (fifo->flags & LLFIFO_INTRUSIVE)) {
+        int n = 0;
+        while(n < max && (out[n] = llfifo_dequeue(fifo)) != NULL)
+            n++;
+        return n;
+    }
+
+    int n = (max < fifo->length) ? max : fifo->length;
+    int done = 0, emptied = 0;
+    block_t *first = fifo->head, *last = NULL;
+
+    if((fifo->flags & LLFIFO_ARRAY) && n > 0) {
+        // Up to the end of the array, then the rest from the start
+        done = (n < fifo->slots - fifo->head_idx) ? n : fifo->slots - fifo->head_idx;
+        memcpy(out, fifo->ring + fifo->head_idx, done * sizeof(void*));
+        memcpy(out + done, fifo->ring, (n - done) * sizeof(void*));
+        fifo->head_idx = (done < n) ? n - done : fifo->head_idx + n;
+        if(fifo->head_idx == fifo->slots)
+            fifo->head_idx = 0;
+        done = n;
+    }
+
+    while(done < n) {
+        block_t *blk = fifo->head;
+        int count = LLFIFO_BLOCK_SLOTS - fifo->head_idx;
+        if(count > n - done)
+            count = n - done;
+        memcpy(out + done, &blk->slot[fifo->head_idx], count * sizeof(void*));
+        done += count;
+        fifo->head_idx += count;
+
+        // Head block used up, and more blocks follow
+        if(fifo->head_idx == LLFIFO_BLOCK_SLOTS && blk != fifo->tail) {
+            fifo->head = blk->next;
+            fifo->head_idx = 0;
+            last = blk;
+            emptied++;
+        }
+    }
+
+    // Splice the emptied blocks onto the unused list in one go
+    if(last) {
+        last->next = fifo->unused;
+        fifo->unused = first;
+        fifo->num_unused += emptied;
+    }
+
+    fifo->length -= n;
+    if(fifo->length == 0 && (fifo->head || fifo->ring))
+        fifo->head_idx = fifo->tail_idx = 0;
+
+    llfifo_auto_trim(fifo);
+    return n;
+}
+
+
+/*
+ * Removes every element from the FIFO in O(1), by detaching the blocks
+ * that hold them
+ *
+ * Parameters:
+ *   fifo   The fifo in question
+ *   chain  Set up to walk the detached elements
+ * 
+ * Returns:
+ *   The number of elements detached
+ */
+int llfifo_dequeue_all(llfifo_t *fifo, llfifo_chain_t *chain) {
+
+    assert(fifo && chain);
+    if(fifo->mpmc || (fifo->flags & LLFIFO_INTRUSIVE)) {
+        memset(chain, 0, sizeof(*chain));
+        return -1;
+    }
+    chain->ring = NULL;
+    chain->ring_size = 0;
+
+    // Hand the whole array over; the FIFO starts a new one as needed
+    if(fifo->flags & LLFIFO_ARRAY) {
+        chain->first = chain->last = chain->block = NULL;
+        chain->ring = fifo->ring;
+        chain->ring_size = fifo->slots;
+        chain->index = fifo->head_idx;
+        chain->remaining = fifo->length;
+        chain->blocks = 0;
+
+        int n = fifo->length;
+        fifo->ring = NULL;
+        fifo->slots = 0;
+        fifo->head_idx = 0;
+        fifo->length = 0;
+        return n;
+    }
+
+    chain->first = chain->block = fifo->head;
+    chain->last = fifo->tail;
+    chain->index = fifo->head_idx;
+    chain->remaining = fifo->length;
+    chain->blocks = (fifo->head_idx + fifo->length + LLFIFO_BLOCK_SLOTS - 1) / LLFIFO_BLOCK_SLOTS;
+    if(fifo->head && chain->blocks == 0)
+        chain->blocks = 1;
+
+    int n = fifo->length;
+    fifo->head = fifo->tail = NULL;
+    fifo->head_idx = fifo->tail_idx = 0;
+    fifo->length = 0;
+    return n;
+}
+
+
+/*
+ * Returns the next element of a chain from llfifo_dequeue_all()
+ *
+ * Parameters:
+ *   chain  The chain in question
+ * 
+ * Returns:
+ *   The next element, oldest first, or NULL once all have been returned
+ */
+void *llfifo_chain_next(llfifo_chain_t *chain) {
+
+    assert(chain);
+    if(chain->remaining == 0)
+        return NULL;
+    if(chain->ring) {
+        void *element = chain->ring[chain->index++];
+        if(chain->index == chain->ring_size)
+            chain->index = 0;
+        chain->remaining--;
+        return element;
+    }
+    if(chain->index == LLFIFO_BLOCK_SLOTS) {
+        chain->block = chain->block->next;
+        chain->index = 0;
+    }
+    chain->remaining--;
+    return chain->block->slot[chain->index++];
+}
+
+
+/*
+ * Gives the blocks of a chain from llfifo_dequeue_all() back to the
+ * FIFO it came from, in O(1)
+ *
+ * Parameters:
+ *   fifo   The fifo the chain was detached from
+ *   chain  The chain in question, which may not be used again
+ * 
+ * Returns:
+ *   none
+ */
+void llfifo_chain_release(llfifo_t *fifo, llfifo_chain_t *chain) {
+
+    assert(fifo && chain);
+    if(chain->first) {
+        chain->last->next = fifo->unused;
+        fifo->unused = chain->first;
+        fifo->num_unused += chain->blocks;
+    }
+    // The array goes back if the FIFO has not had to start another
+    // one meanwhile, or has a smaller one that is empty
+    if(chain->ring) {
+        if(fifo->length == 0 && fifo->slots < chain->ring_size) {
+            free(fifo->ring);
+            fifo->ring = chain->ring;
+            fifo->slots = chain->ring_size;
+            fifo->head_idx = 0;
+        } else {
+            free(chain->ring);
+        }
+    }
+    chain->first = chain->last = chain->block = NULL;
+    chain->ring = NULL;
+    chain->remaining = 0;
+
+    llfifo_auto_trim(fifo);
 }
 
 
@@ -191,6 +1299,8 @@ void *llfifo_dequeue(llfifo_t *fifo) {
  */
 int llfifo_length(llfifo_t *fifo) {
     assert(fifo);
+    if(fifo->mpmc)
+        return mpmc_length(fifo->mpmc);
     return fifo->length;
 }
 
@@ -206,6 +1316,8 @@ int llfifo_length(llfifo_t *fifo) {
  */
 int llfifo_capacity(llfifo_t *fifo) {
     assert(fifo);
+    if(fifo->mpmc)
+        return atomic_load_explicit(&fifo->mpmc->nodes, memory_order_relaxed);
     return (fifo->capacity);
 }
 
@@ -224,27 +1336,142 @@ int llfifo_capacity(llfifo_t *fifo) {
 void llfifo_destroy(llfifo_t *fifo) {
 
     assert(fifo);
-    node_t* ele;
-    int num_freed =0;
-
-    // To Free the Dynamically allocated list  
-    while( (ele = fifo->head) ) {
-        fifo->head = ele->next;
-        free(ele);
-        num_freed++;
-    }
+    if(fifo->mpmc)
+        mpmc_destroy(fifo->mpmc);
+    free(fifo->ring);
 
-    // To Be the Unused list 
-    while( (ele = fifo->unused) ) {
-        fifo->unused = ele->next;
-        free(ele);
-        num_freed++;
+    // Every block lives in a slab, so freeing the slabs frees both the
+    // Dynamically allocated list and the Unused list
+    slab_t *slab;
+    while( (slab = fifo->slabs) ) {
+        fifo->slabs = slab->next;
+        free(slab);
     }
 
     // Since Everyting is Basically Empty 
     // Free the dynamiclly created FIFO
-    if(fifo->head == (node_t*)NULL  && fifo->tail == 
-        (node_t*)NULL && fifo->unused == (node_t*)NULL) {
-        free(fifo);
+    free(fifo);
+}
+
+
+/*
+ * Multi-producer, single-consumer FIFO (after Dmitry Vyukov's intrusive
+ * MPSC queue)
+ *
+ * Links run from head to tail through their next pointers. A producer
+ * swaps itself in as the new tail, then links the old tail to itself,
+ * so between those two steps the list is briefly broken and the
+ * consumer treats it as empty. stub is a placeholder link which keeps
+ * the list from ever being truly empty; it is pushed again whenever the
+ * consumer is about to take the last real link. tail is written by all
+ * producers and head only by the consumer, so they sit on separate
+ * cache lines.
+ */
+struct llfifo_mpsc_s {
+    _Alignas(LLFIFO_CACHELINE) llfifo_link_t *_Atomic tail;
+    _Alignas(LLFIFO_CACHELINE) llfifo_link_t *head;
+    llfifo_link_t stub;
+};
+
+
+/*
+ * Initializes a multi-producer, single-consumer FIFO
+ *
+ * Parameters:
+ *   none
+ * 
+ * Returns:
+ *   A pointer to an llfifo_mpsc_t, or NULL in case of an error.
+ */
+llfifo_mpsc_t *llfifo_mpsc_create() {
+    llfifo_mpsc_t *fifo = (llfifo_mpsc_t*)aligned_alloc(LLFIFO_CACHELINE, sizeof(llfifo_mpsc_t));
+    if(fifo == NULL)
+        return NULL;
+
+    atomic_init(&fifo->stub.next, NULL);
+    atomic_init(&fifo->tail, &fifo->stub);
+    fifo->head = &fifo->stub;
+    return fifo;
+}
+
+
+/*
+ * Enqueues a link onto the FIFO
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *   link  The link to enqueue
+ * 
+ * Returns:
+ *   none
+ */
+void llfifo_mpsc_push(llfifo_mpsc_t *fifo, llfifo_link_t *link) {
+
+    assert(fifo && link);
+    atomic_store_explicit(&link->next, NULL, memory_order_relaxed);
+
+    // Claim the tail, then hook the previous tail on to us. The
+    // release store publishes the contents of the link's struct.
+    llfifo_link_t *prev = atomic_exchange_explicit(&fifo->tail, link, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, link, memory_order_release);
+}
+
+
+/*
+ * Removes ("dequeues") the oldest link from the FIFO
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   The dequeued link, or NULL if the FIFO was empty (or a push is
+ * half done)
+ */
+llfifo_link_t *llfifo_mpsc_pop(llfifo_mpsc_t *fifo) {
+
+    assert(fifo);
+    llfifo_link_t *head = fifo->head;
+    llfifo_link_t *next = atomic_load_explicit(&head->next, memory_order_acquire);
+
+    // Step over the stub
+    if(head == &fifo->stub) {
+        if(next == NULL)
+            return NULL;
+        fifo->head = head = next;
+        next = atomic_load_explicit(&head->next, memory_order_acquire);
+    }
+
+    if(next) {
+        fifo->head = next;
+        return head;
+    }
+
+    // head has no successor yet. Unless it is also the tail, a producer
+    // has swapped in a new tail but not linked it on yet.
+    if(head != atomic_load_explicit(&fifo->tail, memory_order_acquire))
+        return NULL;
+
+    // head is the last link: queue the stub behind it, so taking head
+    // leaves the list non-empty
+    llfifo_mpsc_push(fifo, &fifo->stub);
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if(next) {
+        fifo->head = next;
+        return head;
     }
-}
\ No newline at end of file
+    return NULL;
+}
+
+
+/*
+ * Teardown function. Links still on the FIFO are not touched.
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   none
+ */
+void llfifo_mpsc_destroy(llfifo_mpsc_t *fifo) {
+    free(fifo);
+}
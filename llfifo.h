@@ -9,11 +9,46 @@
 #define _LLFIFO_H_
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
 
+/*
+ * Options for llfifo_create_ex()
+ *
+ *   LLFIFO_MPMC  Allow any number of threads to call llfifo_enqueue(),
+ *                llfifo_dequeue() and the _many() variants at the same
+ *                time, without locking. Each element then takes its own
+ *                node, and memory is reclaimed with hazard pointers, so
+ *                no thread ever touches a node another has freed. Up to
+ *                128 threads may use such FIFOs at once. llfifo_length()
+ *                is approximate while other threads are active,
+ *                llfifo_capacity() counts the nodes held, and
+ *                llfifo_shrink(), llfifo_reserve(), llfifo_set_trim()
+ *                and llfifo_dequeue_all() are not available.
+ *   LLFIFO_INTRUSIVE  Queue elements by an llfifo_link_t embedded in
+ *                each of them, so nothing is allocated per element and
+ *                the element itself comes back from llfifo_dequeue().
+ *                An element can then only be on one such FIFO at a time,
+ *                and NULL cannot be enqueued. With llfifo_create_ex()
+ *                the link must come first in the element; see
+ *                llfifo_create_intrusive() for other placements.
+ *                llfifo_dequeue_all() is not available. Cannot be
+ *                combined with LLFIFO_MPMC.
+ *   LLFIFO_ARRAY  Keep the elements in one circular array of pointers,
+ *                which doubles when full, instead of in blocks. Elements
+ *                then sit next to each other in memory and take one
+ *                pointer each, at the price of copying them all when
+ *                the array grows or shrinks. Cannot be combined with
+ *                LLFIFO_MPMC or LLFIFO_INTRUSIVE.
+ */
+#define LLFIFO_MPMC     0x01u
+#define LLFIFO_INTRUSIVE 0x02u
+#define LLFIFO_ARRAY    0x04u
+
 /* 
  * The llfifo's main data structure. 
  *
@@ -24,6 +59,20 @@
 typedef struct llfifo_s llfifo_t;
 
 
+/*
+ * The elements taken off a FIFO by llfifo_dequeue_all(), still in the
+ * FIFO's blocks (or, for LLFIFO_ARRAY, its array). Walk them with
+ * llfifo_chain_next(), then hand the memory back with
+ * llfifo_chain_release(). The fields are private.
+ */
+typedef struct {
+    struct llfifo_block_s *first, *last, *block;
+    int index, remaining, blocks;
+    void **ring;
+    int ring_size;
+} llfifo_chain_t;
+
+
 /*
  * Initializes the FIFO
  *
@@ -36,6 +85,35 @@ typedef struct llfifo_s llfifo_t;
 llfifo_t *llfifo_create(int capacity);
 
 
+/*
+ * Initializes the FIFO, with options
+ *
+ * Parameters:
+ *   capacity  the initial size of the fifo, in number of elements
+ *   flags     Bitwise OR of LLFIFO_* options, or 0
+ * 
+ * Returns:
+ *   A pointer to an llfifo_t, or NULL in case of an error.
+ */
+llfifo_t *llfifo_create_ex(int capacity, unsigned flags);
+
+
+/*
+ * Initializes an LLFIFO_INTRUSIVE FIFO, for elements of a struct that
+ * embeds an llfifo_link_t at link_offset, e.g.
+ *
+ *   struct packet { char data[64]; llfifo_link_t link; };
+ *   llfifo_t *fifo = llfifo_create_intrusive(offsetof(struct packet, link));
+ *
+ * Parameters:
+ *   link_offset  Offset of the llfifo_link_t in the elements' struct
+ * 
+ * Returns:
+ *   A pointer to an llfifo_t, or NULL in case of an error.
+ */
+llfifo_t *llfifo_create_intrusive(size_t link_offset);
+
+
 /*
  * Enqueues an element onto the FIFO, growing the FIFO by adding
  * additional elements, if necessary
@@ -45,7 +123,8 @@ llfifo_t *llfifo_create(int capacity);
  *   element The element to enqueue
  * 
  * Returns:
- *   The new length of the FIFO on success, -1 on failure
+ *   The new length of the FIFO on success, -1 on failure. An
+ * LLFIFO_MPMC FIFO has no exact length to give, and returns 1 on success.
  */
 int llfifo_enqueue(llfifo_t *fifo, void *element);
 
@@ -62,6 +141,79 @@ int llfifo_enqueue(llfifo_t *fifo, void *element);
 void *llfifo_dequeue(llfifo_t *fifo);
 
 
+/*
+ * Enqueues n elements onto the FIFO at once, growing the FIFO if
+ * necessary
+ *
+ * Parameters:
+ *   fifo    The fifo in question
+ *   elems   The elements to enqueue, oldest first
+ *   n       Number of elements
+ * 
+ * Returns:
+ *   The new length of the FIFO on success, -1 on failure, in which
+ * case nothing was enqueued. An LLFIFO_MPMC FIFO returns n on success,
+ * and may have enqueued some of the elements on failure.
+ */
+int llfifo_enqueue_many(llfifo_t *fifo, void **elems, int n);
+
+
+/*
+ * Removes ("dequeues") up to max elements from the FIFO at once
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *   out   Set to the dequeued elements, oldest first
+ *   max   Room in out, in number of elements
+ * 
+ * Returns:
+ *   The number of elements dequeued, which could be 0, or -1 on failure
+ */
+int llfifo_dequeue_many(llfifo_t *fifo, void **out, int max);
+
+
+/*
+ * Removes every element from the FIFO in O(1), however many there are,
+ * by detaching the blocks that hold them. The FIFO is left empty and
+ * may be used as usual while the chain is walked.
+ *
+ * Parameters:
+ *   fifo   The fifo in question
+ *   chain  Set up to walk the detached elements
+ * 
+ * Returns:
+ *   The number of elements detached
+ */
+int llfifo_dequeue_all(llfifo_t *fifo, llfifo_chain_t *chain);
+
+
+/*
+ * Returns the next element of a chain from llfifo_dequeue_all()
+ *
+ * Parameters:
+ *   chain  The chain in question
+ * 
+ * Returns:
+ *   The next element, oldest first, or NULL once all have been returned
+ */
+void *llfifo_chain_next(llfifo_chain_t *chain);
+
+
+/*
+ * Gives the blocks of a chain from llfifo_dequeue_all() back to the
+ * FIFO it came from, in O(1). Must be called before the FIFO is
+ * destroyed or shrunk to free them.
+ *
+ * Parameters:
+ *   fifo   The fifo the chain was detached from
+ *   chain  The chain in question, which may not be used again
+ * 
+ * Returns:
+ *   none
+ */
+void llfifo_chain_release(llfifo_t *fifo, llfifo_chain_t *chain);
+
+
 /*
  * Returns the number of elements currently on the FIFO. 
  *
@@ -86,6 +238,67 @@ int llfifo_length(llfifo_t *fifo);
 int llfifo_capacity(llfifo_t *fifo);
 
 
+/*
+ * Lowers the FIFO's capacity, and frees the memory held for elements
+ * beyond it where it can. Memory is held in slabs, and a slab is only
+ * freed once no element in the FIFO uses it.
+ *
+ * Parameters:
+ *   fifo             The fifo in question
+ *   target_capacity  The capacity wanted, in number of elements
+ * 
+ * Returns:
+ *   The new capacity, which is at least the current length
+ */
+int llfifo_shrink(llfifo_t *fifo, int target_capacity);
+
+
+/*
+ * Grows the FIFO ahead of a known burst, so that the next n enqueues
+ * need no allocation
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *   n     Number of elements to make room for, beyond the current length
+ * 
+ * Returns:
+ *   The new capacity on success, -1 on failure
+ */
+int llfifo_reserve(llfifo_t *fifo, int n);
+
+
+/*
+ * Sets the automatic trim policy. Once the FIFO has grown beyond
+ * high_water, it shrinks back to high_water after any dequeue that
+ * leaves the length at or below low_water, including a
+ * llfifo_dequeue_many() that jumps past it. Keeping low_water well
+ * below high_water stops a queue that hovers around one size from
+ * freeing memory only to allocate it again.
+ *
+ * Parameters:
+ *   fifo        The fifo in question
+ *   high_water  Capacity to shrink back to, or 0 to turn trimming off
+ *   low_water   Length at or below which a dequeue trims the FIFO, at
+ *               most high_water
+ * 
+ * Returns:
+ *   0 on success, -1 on failure
+ */
+int llfifo_set_trim(llfifo_t *fifo, int high_water, int low_water);
+
+
+/*
+ * Returns the number of element slots the FIFO has memory for
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   The element slots allocated, which is at least the capacity
+ */
+int llfifo_allocated(llfifo_t *fifo);
+
+
 /*
  * Teardown function. The llfifo will free all dynamically allocated
  * memory. After calling this function, the fifo should not be used
@@ -99,4 +312,83 @@ int llfifo_capacity(llfifo_t *fifo);
  */
 void llfifo_destroy(llfifo_t *fifo);
 
+
+/*
+ * Link to embed in a struct of your own, so that the struct itself can
+ * be queued on an llfifo_mpsc_t or LLFIFO_INTRUSIVE llfifo without
+ * allocating anything
+ */
+typedef struct llfifo_link_s {
+    struct llfifo_link_s *_Atomic next;
+} llfifo_link_t;
+
+/*
+ * Returns the struct of the given type that embeds link as member
+ */
+#define llfifo_entry(link, type, member) \
+    ((type *)((char *)(link) - offsetof(type, member)))
+
+
+/*
+ * A multi-producer, single-consumer FIFO of llfifo_link_t. Any number
+ * of threads may call llfifo_mpsc_push() at the same time, each doing a
+ * single atomic exchange; one thread at a time may call
+ * llfifo_mpsc_pop(), which needs no atomic read-modify-write at all.
+ * Elements pushed by one thread come out in the order it pushed them.
+ */
+typedef struct llfifo_mpsc_s llfifo_mpsc_t;
+
+
+/*
+ * Initializes a multi-producer, single-consumer FIFO
+ *
+ * Parameters:
+ *   none
+ * 
+ * Returns:
+ *   A pointer to an llfifo_mpsc_t, or NULL in case of an error.
+ */
+llfifo_mpsc_t *llfifo_mpsc_create();
+
+
+/*
+ * Enqueues a link onto the FIFO. The link belongs to the FIFO until it
+ * is popped again.
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *   link  The link to enqueue
+ * 
+ * Returns:
+ *   none
+ */
+void llfifo_mpsc_push(llfifo_mpsc_t *fifo, llfifo_link_t *link);
+
+
+/*
+ * Removes ("dequeues") the oldest link from the FIFO. Consumer only.
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   The dequeued link, or NULL if the FIFO was empty. NULL may also be
+ * returned for a moment while a producer is half way through a push;
+ * the link shows up on a later call.
+ */
+llfifo_link_t *llfifo_mpsc_pop(llfifo_mpsc_t *fifo);
+
+
+/*
+ * Teardown function. Links still on the FIFO are not touched, as they
+ * belong to the caller.
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ * 
+ * Returns:
+ *   none
+ */
+void llfifo_mpsc_destroy(llfifo_mpsc_t *fifo);
+
 #endif // _LLFIFO_H_
@@ -6,12 +6,27 @@
 #include "test_cbfifo.h"
 #endif // _TEST_CBFIFO_H_
 
+#ifndef _TEST_MPMCFIFO_H_
+#include "test_mpmcfifo.h"
+#endif // _TEST_MPMCFIFO_H_
+
+#ifndef _TEST_SHARDQ_H_
+#include "test_shardq.h"
+#endif // _TEST_SHARDQ_H_
+
+#ifndef _TEST_WSDEQUE_H_
+#include "test_wsdeque.h"
+#endif // _TEST_WSDEQUE_H_
+
 #include<stdio.h>
 int main() {
     int success = 1;
 
     test_llfifo();
     success &= cbfifo_main();
+    success &= test_mpmcfifo();
+    success &= test_shardq();
+    success &= test_wsdeque();
     if (success)
         printf("All tests succeeded\n");
     else
@@ -0,0 +1,443 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file mpmcfifo.c
+ * @brief A bounded FIFO of pointers for many producer and consumer
+ * threads
+ *
+ * An array of slots, each with a sequence number, after Dmitry
+ * Vyukov's bounded MPMC queue. Producers and consumers each claim a
+ * position with a CAS on their own counter, then hand the slot over
+ * through its sequence number, so there is no lock and no per element
+ * allocation.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#ifndef _MPMCFIFO_C_
+#define _MPMCFIFO_C_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sched.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "mpmcfifo.h"
+
+// Size of a cache line, used to keep the two position counters apart
+#define MPMCFIFO_CACHELINE 64
+
+// Times a waiting call polls before it goes to sleep
+#define MPMCFIFO_SPIN      128
+
+/*
+ * Slot: seq says whose turn it is. For the slot at position pos (mod
+ * size), seq == pos means it is free for the producer that claims pos,
+ * seq == pos + 1 that it holds the element for the consumer that
+ * claims pos, and the consumer then sets it to pos + size, freeing it
+ * for the producer one lap later.
+ */
+typedef struct {
+    _Atomic size_t seq;
+    void *element;
+} slot_t;
+
+/*
+ * Definition
+ *
+ * enqueue_pos and dequeue_pos count the positions ever claimed by
+ * producers and consumers; the slot for a position is pos & mask. The
+ * waiting calls sleep on not_empty or not_full, with the waiters counts
+ * letting the other side skip the wake-up syscall when nobody sleeps.
+ */
+struct mpmcfifo_s {
+    slot_t *slots;
+    size_t size;
+    size_t mask;
+
+    _Alignas(MPMCFIFO_CACHELINE) _Atomic size_t enqueue_pos;
+    _Alignas(MPMCFIFO_CACHELINE) _Atomic size_t dequeue_pos;
+
+    _Alignas(MPMCFIFO_CACHELINE) _Atomic uint32_t not_empty;
+    _Atomic uint32_t not_empty_waiters;
+    _Atomic uint32_t not_full;
+    _Atomic uint32_t not_full_waiters;
+};
+
+
+/*
+ * Initializes the FIFO
+ *
+ * Parameters:
+ *   capacity  the size of the fifo, in number of elements. Rounded up
+ *             to a power of two.
+ *
+ * Returns:
+ *   A pointer to an mpmcfifo_t, or NULL in case of an error.
+ */
+mpmcfifo_t *mpmcfifo_create(int capacity) {
+    if(capacity <= 0 || capacity > (1 << 30))
+        return NULL;
+
+    // Round up to the next power of two
+    size_t size = 1;
+    while(size < (size_t)capacity)
+        size <<= 1;
+
+    mpmcfifo_t *fifo = (mpmcfifo_t*)aligned_alloc(MPMCFIFO_CACHELINE, sizeof(mpmcfifo_t));
+    if(fifo == NULL)
+        return NULL;
+    fifo->slots = (slot_t*)malloc(size * sizeof(slot_t));
+    if(fifo->slots == NULL) {
+        free(fifo);
+        return NULL;
+    }
+
+    fifo->size = size;
+    fifo->mask = size - 1;
+    for(size_t i = 0; i < size; i++) {
+        atomic_init(&fifo->slots[i].seq, i);
+        fifo->slots[i].element = NULL;
+    }
+    atomic_init(&fifo->enqueue_pos, 0);
+    atomic_init(&fifo->dequeue_pos, 0);
+    atomic_init(&fifo->not_empty, 0);
+    atomic_init(&fifo->not_empty_waiters, 0);
+    atomic_init(&fifo->not_full, 0);
+    atomic_init(&fifo->not_full_waiters, 0);
+    return fifo;
+}
+
+
+#ifdef __linux__
+// Sleeps while *addr still holds val, for at most timeout (or forever if NULL)
+static void mpmcfifo_futex_wait(_Atomic uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+// Wakes one thread sleeping on addr
+static void mpmcfifo_futex_wake(_Atomic uint32_t *addr)
+{
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#else
+// Without futexes, sleeping is a yield and waking is implicit
+static void mpmcfifo_futex_wait(_Atomic uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    (void)addr; (void)val; (void)timeout;
+    sched_yield();
+}
+
+static void mpmcfifo_futex_wake(_Atomic uint32_t *addr)
+{
+    (void)addr;
+}
+#endif
+
+/*
+ * Wakes a thread waiting on seq, if there is one. A single wake-up is
+ * enough: each enqueue (or dequeue) makes room for one waiter, and a
+ * waiter that loses the race for it goes back to sleep until the next.
+ * The fence pairs with the one in mpmcfifo_wait().
+ */
+static void mpmcfifo_notify(_Atomic uint32_t *seq, _Atomic uint32_t *waiters)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(waiters, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(seq, 1, memory_order_release);
+        mpmcfifo_futex_wake(seq);
+    }
+}
+
+
+/*
+ * Enqueues an element onto the FIFO, if there is room
+ *
+ * Parameters:
+ *   fifo    The fifo in question
+ *   element The element to enqueue, which may not be NULL
+ *
+ * Returns:
+ *   The new length of the FIFO on success, as seen by this thread, or
+ * -1 if the FIFO was full or element is NULL
+ */
+int mpmcfifo_enqueue(mpmcfifo_t *fifo, void *element) {
+
+    assert(fifo);
+    if(element == NULL)
+        return -1;
+
+    size_t pos = atomic_load_explicit(&fifo->enqueue_pos, memory_order_relaxed);
+    slot_t *slot;
+    for(;;) {
+        slot = &fifo->slots[pos & fifo->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if(dif == 0) {
+            // The slot is free: claim the position
+            if(atomic_compare_exchange_weak_explicit(&fifo->enqueue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if(dif < 0) {
+            // The slot still holds the element from one lap ago: full
+            return -1;
+        } else {
+            // Another producer claimed pos first
+            pos = atomic_load_explicit(&fifo->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->element = element;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    mpmcfifo_notify(&fifo->not_empty, &fifo->not_empty_waiters);
+
+    size_t tail = atomic_load_explicit(&fifo->dequeue_pos, memory_order_relaxed);
+    return (pos + 1 > tail) ? (int)(pos + 1 - tail) : 1;
+}
+
+
+/*
+ * Removes ("dequeues") an element from the FIFO, and returns it
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *
+ * Returns:
+ *   The dequeued element, or NULL if the FIFO was empty
+ */
+void *mpmcfifo_dequeue(mpmcfifo_t *fifo) {
+
+    assert(fifo);
+    size_t pos = atomic_load_explicit(&fifo->dequeue_pos, memory_order_relaxed);
+    slot_t *slot;
+    for(;;) {
+        slot = &fifo->slots[pos & fifo->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(dif == 0) {
+            // The slot holds our element: claim the position
+            if(atomic_compare_exchange_weak_explicit(&fifo->dequeue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if(dif < 0) {
+            // Not filled yet: empty
+            return NULL;
+        } else {
+            // Another consumer claimed pos first
+            pos = atomic_load_explicit(&fifo->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    void *element = slot->element;
+    atomic_store_explicit(&slot->seq, pos + fifo->size, memory_order_release);
+    mpmcfifo_notify(&fifo->not_full, &fifo->not_full_waiters);
+    return element;
+}
+
+
+// Tells the CPU we are in a polling loop
+static inline void mpmcfifo_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+// Whether an element (data true) or a free slot (data false) looks available
+static bool mpmcfifo_ready(mpmcfifo_t *fifo, bool data)
+{
+    if(data)
+        return mpmcfifo_length(fifo) > 0;
+    return mpmcfifo_length(fifo) < (int)fifo->size;
+}
+
+/*
+ * Waits until a slot is ready for the caller: holds an element if data
+ * is true (consumer), or is free (producer). Polls MPMCFIFO_SPIN times
+ * first, then sleeps on the futex the other side notifies.
+ *
+ * Returns true once a slot looks ready, false on timeout.
+ */
+static bool mpmcfifo_wait(mpmcfifo_t *fifo, bool data, const struct timespec *deadline)
+{
+    _Atomic uint32_t *seq = data ? &fifo->not_empty : &fifo->not_full;
+    _Atomic uint32_t *waiters = data ? &fifo->not_empty_waiters : &fifo->not_full_waiters;
+    struct timespec now, left;
+
+    for(int i = 0; i < MPMCFIFO_SPIN; i++) {
+        if(mpmcfifo_ready(fifo, data))
+            return true;
+        mpmcfifo_cpu_relax();
+    }
+
+    for(;;) {
+        const struct timespec *timeout = NULL;
+        if(deadline) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = deadline->tv_sec - now.tv_sec;
+            left.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+            if(left.tv_nsec < 0) {
+                left.tv_sec--;
+                left.tv_nsec += 1000000000;
+            }
+            if(left.tv_sec < 0)
+                return false;
+            timeout = &left;
+        }
+
+        // Announce ourselves, then check again before sleeping
+        uint32_t val = atomic_load_explicit(seq, memory_order_acquire);
+        atomic_fetch_add_explicit(waiters, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool ready = mpmcfifo_ready(fifo, data);
+        if(!ready)
+            mpmcfifo_futex_wait(seq, val, timeout);
+        atomic_fetch_sub_explicit(waiters, 1, memory_order_relaxed);
+        if(ready || mpmcfifo_ready(fifo, data))
+            return true;
+    }
+}
+
+// Sets deadline to timeout_us from now, and returns it, or NULL for -1
+static struct timespec *mpmcfifo_deadline(struct timespec *deadline, long timeout_us)
+{
+    if(timeout_us < 0)
+        return NULL;
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_us / 1000000;
+    deadline->tv_nsec += (timeout_us % 1000000) * 1000;
+    if(deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+    return deadline;
+}
+
+
+/*
+ * Enqueues an element, first waiting until there is room
+ *
+ * Parameters:
+ *   fifo        The fifo in question
+ *   element     The element to enqueue, which may not be NULL
+ *   timeout_us  Longest time to wait, in microseconds, or -1 for no limit
+ *
+ * Returns:
+ *   The new length of the FIFO on success, -1 on timeout or if element
+ * is NULL
+ */
+int mpmcfifo_enqueue_wait(mpmcfifo_t *fifo, void *element, long timeout_us) {
+
+    assert(fifo);
+    if(element == NULL)
+        return -1;
+
+    struct timespec when;
+    struct timespec *deadline = mpmcfifo_deadline(&when, timeout_us);
+    for(;;) {
+        int ret = mpmcfifo_enqueue(fifo, element);
+        if(ret > 0)
+            return ret;
+        // Someone else took the free slot, wait for the next one
+        if(!mpmcfifo_wait(fifo, false, deadline))
+            return -1;
+    }
+}
+
+
+/*
+ * Dequeues an element, first waiting until there is one
+ *
+ * Parameters:
+ *   fifo        The fifo in question
+ *   timeout_us  Longest time to wait, in microseconds, or -1 for no limit
+ *
+ * Returns:
+ *   The dequeued element, or NULL on timeout
+ */
+void *mpmcfifo_dequeue_wait(mpmcfifo_t *fifo, long timeout_us) {
+
+    assert(fifo);
+    struct timespec when;
+    struct timespec *deadline = mpmcfifo_deadline(&when, timeout_us);
+    for(;;) {
+        void *element = mpmcfifo_dequeue(fifo);
+        if(element)
+            return element;
+        if(!mpmcfifo_wait(fifo, true, deadline))
+            return NULL;
+    }
+}
+
+
+/*
+ * Returns the number of elements currently on the FIFO.
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *
+ * Returns:
+ *   The number of elements currently on the FIFO
+ */
+int mpmcfifo_length(mpmcfifo_t *fifo) {
+    assert(fifo);
+    // dequeue_pos first: enqueue_pos never falls behind a value read earlier
+    size_t tail = atomic_load_explicit(&fifo->dequeue_pos, memory_order_acquire);
+    size_t head = atomic_load_explicit(&fifo->enqueue_pos, memory_order_acquire);
+    size_t length = head - tail;
+    if(head < tail)
+        return 0;
+    return (length > fifo->size) ? (int)fifo->size : (int)length;
+}
+
+
+/*
+ * Returns the FIFO's capacity
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *
+ * Returns:
+ *   The capacity, in number of elements, for the FIFO
+ */
+int mpmcfifo_capacity(mpmcfifo_t *fifo) {
+    assert(fifo);
+    return (int)fifo->size;
+}
+
+
+/*
+ * Teardown function. Frees the FIFO. After calling this function, the
+ * fifo should not be used again!
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *
+ * Returns:
+ *   none
+ */
+void mpmcfifo_destroy(mpmcfifo_t *fifo) {
+    if(fifo == NULL)
+        return;
+    free(fifo->slots);
+    free(fifo);
+}
+
+#endif // _MPMCFIFO_C_
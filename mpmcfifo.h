@@ -0,0 +1,136 @@
+/*
+ * mpmcfifo.h - a fixed-size FIFO of pointers, shared by any number of
+ * producer and consumer threads
+ *
+ * Author: Arpit Savarkar, (arpit.savarkar@colorado.edu)
+ *
+ */
+
+#ifndef _MPMCFIFO_H_
+#define _MPMCFIFO_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+/*
+ * The mpmcfifo's main data structure.
+ *
+ * Defined here as an incomplete type, in order to hide the
+ * implementation from the user. The create, enqueue, dequeue, length,
+ * capacity and destroy functions mirror those of llfifo.h, so either
+ * can stand in for the other; unlike an llfifo, an mpmcfifo never
+ * grows, allocates nothing after creation, and may be used from many
+ * threads at once without locking.
+ */
+typedef struct mpmcfifo_s mpmcfifo_t;
+
+
+/*
+ * Initializes the FIFO
+ *
+ * Parameters:
+ *   capacity  the size of the fifo, in number of elements. Rounded up
+ *             to a power of two.
+ *
+ * Returns:
+ *   A pointer to an mpmcfifo_t, or NULL in case of an error.
+ */
+mpmcfifo_t *mpmcfifo_create(int capacity);
+
+
+/*
+ * Enqueues an element onto the FIFO, if there is room
+ *
+ * Parameters:
+ *   fifo    The fifo in question
+ *   element The element to enqueue, which may not be NULL
+ *
+ * Returns:
+ *   The new length of the FIFO on success, as seen by this thread, or
+ * -1 if the FIFO was full or element is NULL
+ */
+int mpmcfifo_enqueue(mpmcfifo_t *fifo, void *element);
+
+
+/*
+ * Removes ("dequeues") an element from the FIFO, and returns it
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *
+ * Returns:
+ *   The dequeued element, or NULL if the FIFO was empty
+ */
+void *mpmcfifo_dequeue(mpmcfifo_t *fifo);
+
+
+/*
+ * Enqueues an element, first waiting until there is room. Spins
+ * briefly, then sleeps until a consumer dequeues.
+ *
+ * Parameters:
+ *   fifo        The fifo in question
+ *   element     The element to enqueue, which may not be NULL
+ *   timeout_us  Longest time to wait, in microseconds, or -1 for no limit
+ *
+ * Returns:
+ *   The new length of the FIFO on success, -1 on timeout or if element
+ * is NULL
+ */
+int mpmcfifo_enqueue_wait(mpmcfifo_t *fifo, void *element, long timeout_us);
+
+
+/*
+ * Dequeues an element, first waiting until there is one. Spins
+ * briefly, then sleeps until a producer enqueues.
+ *
+ * Parameters:
+ *   fifo        The fifo in question
+ *   timeout_us  Longest time to wait, in microseconds, or -1 for no limit
+ *
+ * Returns:
+ *   The dequeued element, or NULL on timeout
+ */
+void *mpmcfifo_dequeue_wait(mpmcfifo_t *fifo, long timeout_us);
+
+
+/*
+ * Returns the number of elements currently on the FIFO. While other
+ * threads are using the FIFO this is only a snapshot.
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *
+ * Returns:
+ *   The number of elements currently on the FIFO
+ */
+int mpmcfifo_length(mpmcfifo_t *fifo);
+
+
+/*
+ * Returns the FIFO's capacity
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *
+ * Returns:
+ *   The capacity, in number of elements, for the FIFO
+ */
+int mpmcfifo_capacity(mpmcfifo_t *fifo);
+
+
+/*
+ * Teardown function. Frees the FIFO. After calling this function, the
+ * fifo should not be used again!
+ *
+ * Parameters:
+ *   fifo  The fifo in question
+ *
+ * Returns:
+ *   none
+ */
+void mpmcfifo_destroy(mpmcfifo_t *fifo);
+
+#endif // _MPMCFIFO_H_
@@ -0,0 +1,297 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file shardq.c
+ * @brief A queue of pointers split into per-core shards
+ *
+ * Each shard is an llfifo behind its own mutex, on a cache line of its
+ * own. Threads work on the shard of the core they run on, found with
+ * sched_getcpu(), and only lock other shards to steal from them when
+ * their own is empty. Each shard also keeps its length and capacity in
+ * atomics, so stealing can skip empty shards and the totals can be
+ * read without taking any lock.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "shardq.h"
+#include "llfifo.h"
+
+// Size of a cache line, to keep shards apart
+#define SHARDQ_CACHELINE 64
+
+typedef struct {
+    _Alignas(SHARDQ_CACHELINE) pthread_mutex_t lock;
+    llfifo_t *fifo;
+    // Copies of the llfifo's length and capacity, read without the lock
+    _Atomic int length;
+    _Atomic int capacity;
+} shard_t;
+
+/*
+ * Definition
+ */
+struct shardq_s {
+    int num_shards;
+    shard_t *shards;
+};
+
+// Shard for threads that cannot ask for their CPU, handed out in turn
+static _Atomic unsigned shardq_next_thread;
+static _Thread_local int shardq_thread = -1;
+
+
+/*
+ * Initializes the queue
+ *
+ * Parameters:
+ *   shards    the number of shards, or 0 for one per online CPU
+ *   capacity  the initial size of each shard, in number of elements
+ *
+ * Returns:
+ *   A pointer to a shardq_t, or NULL in case of an error.
+ */
+shardq_t *shardq_create(int shards, int capacity) {
+    if(shards < 0 || capacity < 0)
+        return NULL;
+    if(shards == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        shards = (cpus > 0) ? (int)cpus : 1;
+    }
+
+    shardq_t *q = (shardq_t*)malloc(sizeof(shardq_t));
+    if(q == NULL)
+        return NULL;
+    q->shards = (shard_t*)aligned_alloc(SHARDQ_CACHELINE, shards * sizeof(shard_t));
+    if(q->shards == NULL) {
+        free(q);
+        return NULL;
+    }
+
+    for(int i = 0; i < shards; i++) {
+        shard_t *shard = &q->shards[i];
+        shard->fifo = llfifo_create(capacity);
+        if(shard->fifo == NULL) {
+            // Undo the shards made so far
+            q->num_shards = i;
+            shardq_destroy(q);
+            return NULL;
+        }
+        pthread_mutex_init(&shard->lock, NULL);
+        atomic_init(&shard->length, 0);
+        atomic_init(&shard->capacity, capacity);
+    }
+    q->num_shards = shards;
+    return q;
+}
+
+
+/*
+ * Returns the shard the calling thread works on first
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The shard, from 0 to shardq_shards(q) - 1
+ */
+int shardq_self(shardq_t *q) {
+    assert(q);
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if(cpu >= 0)
+        return cpu % q->num_shards;
+#endif
+    if(shardq_thread < 0)
+        shardq_thread = (int)(atomic_fetch_add_explicit(&shardq_next_thread, 1,
+            memory_order_relaxed) & 0x7fffffff);
+    return shardq_thread % q->num_shards;
+}
+
+
+/*
+ * Enqueues an element onto a given shard
+ *
+ * Parameters:
+ *   q        The queue in question
+ *   shard    The shard, from 0 to shardq_shards(q) - 1
+ *   element  The element to enqueue
+ *
+ * Returns:
+ *   The new length of the shard on success, -1 on failure
+ */
+int shardq_enqueue_to(shardq_t *q, int shard, void *element) {
+    assert(q);
+    if(shard < 0 || shard >= q->num_shards)
+        return -1;
+
+    shard_t *s = &q->shards[shard];
+    pthread_mutex_lock(&s->lock);
+    int length = llfifo_enqueue(s->fifo, element);
+    if(length > 0) {
+        atomic_store_explicit(&s->length, length, memory_order_relaxed);
+        atomic_store_explicit(&s->capacity, llfifo_capacity(s->fifo), memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return length;
+}
+
+
+/*
+ * Removes ("dequeues") an element from a given shard only
+ *
+ * Parameters:
+ *   q      The queue in question
+ *   shard  The shard, from 0 to shardq_shards(q) - 1
+ *
+ * Returns:
+ *   The dequeued element, or NULL if the shard was empty
+ */
+void *shardq_dequeue_from(shardq_t *q, int shard) {
+    assert(q);
+    if(shard < 0 || shard >= q->num_shards)
+        return NULL;
+
+    shard_t *s = &q->shards[shard];
+    // Nothing to take: skip the lock
+    if(atomic_load_explicit(&s->length, memory_order_relaxed) == 0)
+        return NULL;
+
+    pthread_mutex_lock(&s->lock);
+    void *element = llfifo_dequeue(s->fifo);
+    atomic_store_explicit(&s->length, llfifo_length(s->fifo), memory_order_relaxed);
+    pthread_mutex_unlock(&s->lock);
+    return element;
+}
+
+
+/*
+ * Enqueues an element onto the shard of the calling thread's core
+ *
+ * Parameters:
+ *   q        The queue in question
+ *   element  The element to enqueue
+ *
+ * Returns:
+ *   The new length of that shard on success, -1 on failure
+ */
+int shardq_enqueue(shardq_t *q, void *element) {
+    return shardq_enqueue_to(q, shardq_self(q), element);
+}
+
+
+/*
+ * Removes ("dequeues") an element, from the calling thread's own shard
+ * if it has one, or else from the next shard along that does
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The dequeued element, or NULL if every shard was found empty
+ */
+void *shardq_dequeue(shardq_t *q) {
+    assert(q);
+    int self = shardq_self(q);
+
+    for(int i = 0; i < q->num_shards; i++) {
+        int shard = self + i;
+        if(shard >= q->num_shards)
+            shard -= q->num_shards;
+        void *element = shardq_dequeue_from(q, shard);
+        if(element)
+            return element;
+    }
+    return NULL;
+}
+
+
+/*
+ * Returns the number of shards
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The number of shards
+ */
+int shardq_shards(shardq_t *q) {
+    assert(q);
+    return q->num_shards;
+}
+
+
+/*
+ * Returns the number of elements on all the shards, as an estimate
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The number of elements on the queue
+ */
+int shardq_length(shardq_t *q) {
+    assert(q);
+    int length = 0;
+    for(int i = 0; i < q->num_shards; i++)
+        length += atomic_load_explicit(&q->shards[i].length, memory_order_relaxed);
+    return length;
+}
+
+
+/*
+ * Returns the sum of the shards' capacities, as an estimate
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The capacity, in number of elements, of all the shards together
+ */
+int shardq_capacity(shardq_t *q) {
+    assert(q);
+    int capacity = 0;
+    for(int i = 0; i < q->num_shards; i++)
+        capacity += atomic_load_explicit(&q->shards[i].capacity, memory_order_relaxed);
+    return capacity;
+}
+
+
+/*
+ * Teardown function. Frees the queue and every shard. After calling
+ * this function, the queue should not be used again!
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   none
+ */
+void shardq_destroy(shardq_t *q) {
+    if(q == NULL)
+        return;
+    for(int i = 0; i < q->num_shards; i++) {
+        pthread_mutex_destroy(&q->shards[i].lock);
+        llfifo_destroy(q->shards[i].fifo);
+    }
+    free(q->shards);
+    free(q);
+}
@@ -0,0 +1,166 @@
+/*
+ * shardq.h - a queue of pointers split into per-core shards, for
+ * handing out work between threads
+ *
+ * Author: Arpit Savarkar, (arpit.savarkar@colorado.edu)
+ *
+ */
+
+#ifndef _SHARDQ_H_
+#define _SHARDQ_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+/*
+ * The shardq's main data structure.
+ *
+ * Defined here as an incomplete type, in order to hide the
+ * implementation from the user. A shardq is a set of shards, each an
+ * llfifo with its own lock. A thread enqueues on the shard of the core
+ * it is running on, and dequeues from that shard first, taking from
+ * the other shards only when its own is empty, so threads on different
+ * cores rarely touch the same shard.
+ *
+ * Elements come out of each shard in the order they went into it, but
+ * there is no order across shards: an element can be dequeued before
+ * one enqueued earlier on another core.
+ */
+typedef struct shardq_s shardq_t;
+
+
+/*
+ * Initializes the queue
+ *
+ * Parameters:
+ *   shards    the number of shards, or 0 for one per online CPU
+ *   capacity  the initial size of each shard, in number of elements
+ *
+ * Returns:
+ *   A pointer to a shardq_t, or NULL in case of an error.
+ */
+shardq_t *shardq_create(int shards, int capacity);
+
+
+/*
+ * Enqueues an element onto the shard of the calling thread's core,
+ * growing the shard if necessary
+ *
+ * Parameters:
+ *   q        The queue in question
+ *   element  The element to enqueue
+ *
+ * Returns:
+ *   The new length of that shard on success, -1 on failure
+ */
+int shardq_enqueue(shardq_t *q, void *element);
+
+
+/*
+ * Removes ("dequeues") an element, from the shard of the calling
+ * thread's core if it has one, or else from another shard
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The dequeued element, or NULL if every shard was found empty
+ */
+void *shardq_dequeue(shardq_t *q);
+
+
+/*
+ * Enqueues an element onto a given shard
+ *
+ * Parameters:
+ *   q        The queue in question
+ *   shard    The shard, from 0 to shardq_shards(q) - 1
+ *   element  The element to enqueue
+ *
+ * Returns:
+ *   The new length of the shard on success, -1 on failure
+ */
+int shardq_enqueue_to(shardq_t *q, int shard, void *element);
+
+
+/*
+ * Removes ("dequeues") an element from a given shard only
+ *
+ * Parameters:
+ *   q      The queue in question
+ *   shard  The shard, from 0 to shardq_shards(q) - 1
+ *
+ * Returns:
+ *   The dequeued element, or NULL if the shard was empty
+ */
+void *shardq_dequeue_from(shardq_t *q, int shard);
+
+
+/*
+ * Returns the number of shards
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The number of shards
+ */
+int shardq_shards(shardq_t *q);
+
+
+/*
+ * Returns the shard the calling thread enqueues on and dequeues from
+ * first. Threads can move between cores, so this may change from one
+ * call to the next.
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The shard, from 0 to shardq_shards(q) - 1
+ */
+int shardq_self(shardq_t *q);
+
+
+/*
+ * Returns the number of elements on all the shards. The shards are
+ * counted one after the other without stopping other threads, so this
+ * is only an estimate while they are active.
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The number of elements on the queue
+ */
+int shardq_length(shardq_t *q);
+
+
+/*
+ * Returns the sum of the shards' capacities, an estimate in the same
+ * way as shardq_length()
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   The capacity, in number of elements, of all the shards together
+ */
+int shardq_capacity(shardq_t *q);
+
+
+/*
+ * Teardown function. Frees the queue and every shard. After calling
+ * this function, the queue should not be used again!
+ *
+ * Parameters:
+ *   q  The queue in question
+ *
+ * Returns:
+ *   none
+ */
+void shardq_destroy(shardq_t *q);
+
+#endif // _SHARDQ_H_
@@ -27,6 +27,13 @@
   support to debug the Cirular Buffer Implementation
 */
 
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "test_cbfifo.h"
 #include "cbfifo.h"
 
@@ -180,6 +187,1092 @@ int test_cbfifo_dequeue()
 }
 
 
+/*
+ * Reports one check of a sequence-style test, in the same format as the
+ * table-driven tests above. Checks are made one statement at a time since
+ * the FIFO calls under test have side effects.
+ */
+static int cb_tests_passed;
+static int cb_tests_total;
+
+static void cb_check(const char *what, size_t act_res, size_t expected_res)
+{
+  char *test_result;
+
+  cb_tests_total++;
+  if (act_res == expected_res) {
+    test_result = "PASSED";
+    cb_tests_passed++;
+  } else {
+    test_result = "FAILED";
+  }
+  printf("\n  %s: %s returned %ld expected %ld ", test_result,
+      what, (long)act_res, (long)expected_res);
+}
+
+static void cb_check_begin()
+{
+  cb_tests_passed = 0;
+  cb_tests_total = 0;
+}
+
+static int cb_check_end(const char *name)
+{
+  printf("\n %s: PASSED %d/%d\n", name, cb_tests_passed, cb_tests_total);
+  return (cb_tests_passed == cb_tests_total);
+}
+
+
+int test_cbfifo_instances()
+{ 
+  char strIn[] = "abcdef";
+  char strOut[8] = {0};
+  cbfifo_t *fifo1 = cbfifo_new(4);
+  cbfifo_t *fifo2 = cbfifo_new(300);
+
+  cb_check_begin();
+  cb_check("cbfifo_new(4) != NULL", fifo1 != NULL, 1);
+  cb_check("cbfifo_new(300) != NULL", fifo2 != NULL, 1);
+  if (fifo1 == NULL || fifo2 == NULL) {
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  // Each instance has its own ring, so operations on one must not
+  // be visible on the other or on the default instance
+  size_t default_len = cbfifo_length();
+  cb_check("cbfifo_capacity_of(fifo1)", cbfifo_capacity_of(fifo1), 4);
+  cb_check("cbfifo_capacity_of(fifo2)", cbfifo_capacity_of(fifo2), 300);
+  cb_check("cbfifo_enqueue_to(fifo1, 3)", cbfifo_enqueue_to(fifo1, strIn, 3), 3);
+  cb_check("cbfifo_enqueue_to(fifo1, 2)", cbfifo_enqueue_to(fifo1, strIn, 2), -1);
+  cb_check("cbfifo_enqueue_to(fifo2, 6)", cbfifo_enqueue_to(fifo2, strIn, 6), 6);
+  cb_check("cbfifo_length_of(fifo1)", cbfifo_length_of(fifo1), 3);
+  cb_check("cbfifo_length_of(fifo2)", cbfifo_length_of(fifo2), 6);
+  cb_check("cbfifo_length()", cbfifo_length(), default_len);
+  cb_check("cbfifo_dequeue_from(fifo2, 4)", cbfifo_dequeue_from(fifo2, strOut, 4), 4);
+  cb_check("strOut == \"abcd\"", memcmp(strOut, "abcd", 4), 0);
+  cb_check("cbfifo_dequeue_from(fifo1, 8)", cbfifo_dequeue_from(fifo1, strOut, 8), 3);
+  cb_check("strOut == \"abc\"", memcmp(strOut, "abc", 3), 0);
+  cb_check("cbfifo_length_of(fifo1)", cbfifo_length_of(fifo1), 0);
+  cb_check("cbfifo_length_of(fifo2)", cbfifo_length_of(fifo2), 2);
+  cb_check("cbfifo_new(0)", (size_t)cbfifo_new(0), 0);
+
+  cbfifo_free(fifo1);
+  cbfifo_free(fifo2);
+
+  return cb_check_end(__FUNCTION__);
+}
+
+
+int test_cbfifo_wrap()
+{ 
+  uint8_t in[1000], out[1000];
+  cbfifo_t *fifo = cbfifo_new(1000);
+
+  cb_check_begin();
+  cb_check("cbfifo_new(1000) != NULL", fifo != NULL, 1);
+  if (fifo == NULL) {
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  for (int i = 0; i < 1000; i++)
+    in[i] = (uint8_t)(i * 7);
+
+  // Single calls larger than 255 bytes, crossing the end of the ring
+  cb_check("cbfifo_enqueue_to(fifo, 700)", cbfifo_enqueue_to(fifo, in, 700), 700);
+  cb_check("cbfifo_dequeue_from(fifo, 600)", cbfifo_dequeue_from(fifo, out, 600), 600);
+  cb_check("out == in[0..600)", memcmp(out, in, 600), 0);
+  cb_check("cbfifo_enqueue_to(fifo, 800)", cbfifo_enqueue_to(fifo, in + 100, 800), 800);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 900);
+  cb_check("cbfifo_enqueue_to(fifo, 101)", cbfifo_enqueue_to(fifo, in, 101), -1);
+  cb_check("cbfifo_enqueue_to(fifo, 100)", cbfifo_enqueue_to(fifo, in + 900, 100), 100);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 1000);
+  cb_check("cbfifo_dequeue_from(fifo, 100)", cbfifo_dequeue_from(fifo, out, 100), 100);
+  cb_check("out == in[600..700)", memcmp(out, in + 600, 100), 0);
+  cb_check("cbfifo_dequeue_from(fifo, 1000)", cbfifo_dequeue_from(fifo, out, 1000), 900);
+  cb_check("out == in[100..1000)", memcmp(out, in + 100, 900), 0);
+  cb_check("cbfifo_dequeue_from(fifo, 1)", cbfifo_dequeue_from(fifo, out, 1), 0);
+
+  cbfifo_free(fifo);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+/*
+ * Streams a counting byte pattern through the fifo in uneven chunks, so
+ * head and tail wrap many times, and checks it comes out unchanged
+ */
+static int cb_stream_pattern(cbfifo_t *fifo, int rounds)
+{
+  uint8_t buf[97];
+  uint8_t next_in = 0, next_out = 0;
+
+  for (int r = 0; r < rounds; r++) {
+    size_t n_in = 1 + (r * 31) % sizeof(buf);
+    size_t room = cbfifo_capacity_of(fifo) - cbfifo_length_of(fifo);
+    if (n_in > room)
+      n_in = room;
+    for (size_t i = 0; i < n_in; i++)
+      buf[i] = next_in++;
+    if (cbfifo_enqueue_to(fifo, buf, n_in) != n_in)
+      return 0;
+
+    size_t n_out = cbfifo_dequeue_from(fifo, buf, 1 + (r * 17) % sizeof(buf));
+    for (size_t i = 0; i < n_out; i++)
+      if (buf[i] != next_out++)
+        return 0;
+  }
+  return 1;
+}
+
+
+int test_cbfifo_pow2()
+{ 
+  uint8_t buf[128] = {0};
+  cbfifo_t *fifo = cbfifo_new_ex(100, CBFIFO_POW2);
+  cbfifo_t *plain = cbfifo_new(100);
+
+  cb_check_begin();
+  cb_check("cbfifo_new_ex(100, CBFIFO_POW2) != NULL", fifo != NULL, 1);
+  cb_check("cbfifo_new(100) != NULL", plain != NULL, 1);
+  if (fifo == NULL || plain == NULL) {
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  cb_check("cbfifo_capacity_of(fifo)", cbfifo_capacity_of(fifo), 128);
+  cb_check("cbfifo_capacity_of(plain)", cbfifo_capacity_of(plain), 100);
+  cb_check("cbfifo_enqueue_to(fifo, 128)", cbfifo_enqueue_to(fifo, buf, 128), 128);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 128);
+  cb_check("cbfifo_enqueue_to(fifo, 1)", cbfifo_enqueue_to(fifo, buf, 1), -1);
+  cb_check("cbfifo_dequeue_from(fifo, 128)", cbfifo_dequeue_from(fifo, buf, 128), 128);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 0);
+  cb_check("stream through fifo", cb_stream_pattern(fifo, 5000), 1);
+  cb_check("stream through plain", cb_stream_pattern(plain, 5000), 1);
+
+  cbfifo_free(fifo);
+  cbfifo_free(plain);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+#define SPSC_TEST_BYTES (1024u * 1024)
+
+// Producer thread: writes a counting pattern in uneven chunks
+static void *spsc_producer(void *arg)
+{
+  cbfifo_t *fifo = (cbfifo_t *)arg;
+  uint8_t buf[61];
+  uint8_t next = 0;
+  size_t sent = 0;
+
+  while (sent < SPSC_TEST_BYTES) {
+    size_t n = 1 + sent % sizeof(buf);
+    if (n > SPSC_TEST_BYTES - sent)
+      n = SPSC_TEST_BYTES - sent;
+    for (size_t i = 0; i < n; i++)
+      buf[i] = (uint8_t)(next + i);
+    if (cbfifo_enqueue_to(fifo, buf, n) == n) {
+      next += n;
+      sent += n;
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+
+int test_cbfifo_spsc()
+{ 
+  uint8_t buf[100];
+  uint8_t next = 0;
+  size_t received = 0;
+  int in_order = 1;
+  pthread_t producer;
+  cbfifo_t *fifo = cbfifo_new_ex(1000, CBFIFO_SPSC);
+
+  cb_check_begin();
+  cb_check("cbfifo_new_ex(1000, CBFIFO_SPSC) != NULL", fifo != NULL, 1);
+  if (fifo == NULL) {
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+  cb_check("cbfifo_capacity_of(fifo)", cbfifo_capacity_of(fifo), 1024);
+
+  // Consumer runs here while the producer thread fills the ring
+  pthread_create(&producer, NULL, spsc_producer, fifo);
+  while (received < SPSC_TEST_BYTES) {
+    size_t n = cbfifo_dequeue_from(fifo, buf, 1 + received % sizeof(buf));
+    for (size_t i = 0; i < n; i++)
+      if (buf[i] != next++)
+        in_order = 0;
+    if (n == 0)
+      sched_yield();
+    received += n;
+  }
+  pthread_join(producer, NULL);
+
+  cb_check("bytes received in order", in_order, 1);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 0);
+
+  cbfifo_free(fifo);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+int test_cbfifo_reserve()
+{ 
+  uint8_t out[16];
+  void *ptr;
+  size_t contig;
+  cbfifo_t *fifo = cbfifo_new(10);
+
+  cb_check_begin();
+  cb_check("cbfifo_new(10) != NULL", fifo != NULL, 1);
+  if (fifo == NULL) {
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  // Write straight into an empty ring
+  cb_check("cbfifo_reserve(fifo, 4)", cbfifo_reserve(fifo, 4, &ptr, &contig), 10);
+  cb_check("contig", contig, 10);
+  memcpy(ptr, "abcdefg", 7);
+  cb_check("cbfifo_length_of(fifo) before commit", cbfifo_length_of(fifo), 0);
+  cb_check("cbfifo_commit(fifo, 7)", cbfifo_commit(fifo, 7), 7);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 7);
+  cb_check("cbfifo_dequeue_from(fifo, 5)", cbfifo_dequeue_from(fifo, out, 5), 5);
+  cb_check("out == \"abcde\"", memcmp(out, "abcde", 5), 0);
+
+  // 8 bytes free: 3 before the wrap point, 5 after it
+  cb_check("cbfifo_reserve(fifo, 9)", cbfifo_reserve(fifo, 9, &ptr, &contig), 0);
+  cb_check("cbfifo_reserve(fifo, 6)", cbfifo_reserve(fifo, 6, &ptr, &contig), 8);
+  cb_check("contig", contig, 3);
+  memcpy(ptr, "hij", contig);
+  cb_check("cbfifo_commit(fifo, 3)", cbfifo_commit(fifo, 3), 3);
+  cb_check("cbfifo_reserve(fifo, 3)", cbfifo_reserve(fifo, 3, &ptr, &contig), 5);
+  cb_check("contig", contig, 5);
+  memcpy(ptr, "klm", 3);
+  cb_check("cbfifo_commit(fifo, 3)", cbfifo_commit(fifo, 3), 3);
+  cb_check("cbfifo_commit(fifo, 3)", cbfifo_commit(fifo, 3), -1);
+  cb_check("cbfifo_dequeue_from(fifo, 16)", cbfifo_dequeue_from(fifo, out, 16), 8);
+  cb_check("out == \"fghijklm\"", memcmp(out, "fghijklm", 8), 0);
+
+  cbfifo_free(fifo);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+int test_cbfifo_peek()
+{ 
+  uint8_t out[16];
+  void *ptr1, *ptr2;
+  size_t len1, len2;
+  cbfifo_t *fifo = cbfifo_new(10);
+
+  cb_check_begin();
+  cb_check("cbfifo_new(10) != NULL", fifo != NULL, 1);
+  if (fifo == NULL) {
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  cb_check("cbfifo_peek(fifo) empty", cbfifo_peek(fifo, &ptr1, &len1, &ptr2, &len2), 0);
+  cb_check("len1", len1, 0);
+  cb_check("len2", len2, 0);
+
+  // No wrap: one span, and peeking leaves the bytes in place
+  cbfifo_enqueue_to(fifo, "abcdefgh", 8);
+  cb_check("cbfifo_peek(fifo)", cbfifo_peek(fifo, &ptr1, &len1, &ptr2, &len2), 8);
+  cb_check("len1", len1, 8);
+  cb_check("ptr1 == \"abcdefgh\"", memcmp(ptr1, "abcdefgh", 8), 0);
+  cb_check("ptr2", (size_t)ptr2, 0);
+  cb_check("len2", len2, 0);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 8);
+  cb_check("cbfifo_consume(fifo, 6)", cbfifo_consume(fifo, 6), 6);
+
+  // Wrap: "ghij" runs up to the end of the ring, "kl" starts over
+  cbfifo_enqueue_to(fifo, "ijkl", 4);
+  cb_check("cbfifo_peek(fifo)", cbfifo_peek(fifo, &ptr1, &len1, &ptr2, &len2), 6);
+  cb_check("len1", len1, 4);
+  cb_check("ptr1 == \"ghij\"", memcmp(ptr1, "ghij", 4), 0);
+  cb_check("len2", len2, 2);
+  cb_check("ptr2 == \"kl\"", ptr2 ? memcmp(ptr2, "kl", 2) : 1, 0);
+  cb_check("cbfifo_consume(fifo, 5)", cbfifo_consume(fifo, 5), 5);
+  cb_check("cbfifo_dequeue_from(fifo, 16)", cbfifo_dequeue_from(fifo, out, 16), 1);
+  cb_check("out == \"l\"", out[0], 'l');
+  cb_check("cbfifo_consume(fifo, 1)", cbfifo_consume(fifo, 1), 0);
+
+  cbfifo_free(fifo);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+int test_cbfifo_mirror()
+{ 
+  static uint8_t in[16384], out[16384];
+  void *ptr1, *ptr2;
+  size_t len1, len2, contig;
+  cbfifo_t *fifo = cbfifo_new_ex(5000, CBFIFO_MIRROR);
+  cbfifo_t *small = cbfifo_new_ex(100, CBFIFO_MIRROR);
+
+  cb_check_begin();
+  cb_check("cbfifo_new_ex(5000, CBFIFO_MIRROR) != NULL", fifo != NULL, 1);
+  cb_check("cbfifo_new_ex(100, CBFIFO_MIRROR) != NULL", small != NULL, 1);
+  if (fifo == NULL || small == NULL) {
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  // Under a page, the plain array is used
+  cb_check("cbfifo_flags_of(small) & CBFIFO_MIRROR", cbfifo_flags_of(small) & CBFIFO_MIRROR, 0);
+  cb_check("cbfifo_capacity_of(small)", cbfifo_capacity_of(small), 100);
+
+  if (!(cbfifo_flags_of(fifo) & CBFIFO_MIRROR)) {
+    printf("\n  SKIPPED: mirrored mapping not available");
+  } else {
+    size_t cap = cbfifo_capacity_of(fifo);
+    cb_check("cbfifo_capacity_of(fifo) >= 5000", cap >= 5000, 1);
+    for (size_t i = 0; i < sizeof(in); i++)
+      in[i] = (uint8_t)(i * 13);
+
+    // Move tail close to the end of the ring, then store bytes that
+    // wrap around: they must still read back as one span
+    cb_check("cbfifo_enqueue_to(fifo, cap - 10)", cbfifo_enqueue_to(fifo, in, cap - 10), cap - 10);
+    cb_check("cbfifo_dequeue_from(fifo, cap - 10)", cbfifo_dequeue_from(fifo, out, cap - 10), cap - 10);
+    cb_check("cbfifo_reserve(fifo, cap)", cbfifo_reserve(fifo, cap, &ptr1, &contig), cap);
+    cb_check("contig", contig, cap);
+    memcpy(ptr1, in, 100);
+    cb_check("cbfifo_commit(fifo, 100)", cbfifo_commit(fifo, 100), 100);
+    cb_check("cbfifo_peek(fifo)", cbfifo_peek(fifo, &ptr1, &len1, &ptr2, &len2), 100);
+    cb_check("len1", len1, 100);
+    cb_check("len2", len2, 0);
+    cb_check("ptr1 == in[0..100)", memcmp(ptr1, in, 100), 0);
+    cb_check("cbfifo_dequeue_from(fifo, 100)", cbfifo_dequeue_from(fifo, out, 100), 100);
+    cb_check("out == in[0..100)", memcmp(out, in, 100), 0);
+  }
+
+  cbfifo_free(fifo);
+  cbfifo_free(small);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+#define BLOCKING_TEST_BYTES (50u * 20000)
+
+// Producer thread: writes a counting pattern, waiting for room
+static void *blocking_producer(void *arg)
+{
+  cbfifo_t *fifo = (cbfifo_t *)arg;
+  uint8_t buf[50];
+  uint8_t next = 0;
+
+  for (size_t sent = 0; sent < BLOCKING_TEST_BYTES; sent += sizeof(buf)) {
+    for (size_t i = 0; i < sizeof(buf); i++)
+      buf[i] = next++;
+    if (cbfifo_enqueue_wait(fifo, buf, sizeof(buf), -1) != sizeof(buf))
+      break;
+  }
+  return NULL;
+}
+
+
+int test_cbfifo_blocking()
+{ 
+  uint8_t buf[256];
+  uint8_t next = 0;
+  size_t received = 0;
+  int in_order = 1;
+  pthread_t producer;
+  struct timespec start, end;
+  cbfifo_t *plain = cbfifo_new(64);
+  cbfifo_t *fifo = cbfifo_new_ex(256, CBFIFO_BLOCKING);
+  cbfifo_t *lossy = cbfifo_new_ex(64, CBFIFO_BLOCKING | CBFIFO_OVERWRITE);
+
+  cb_check_begin();
+  cb_check("cbfifo_new_ex(256, CBFIFO_BLOCKING) != NULL", fifo != NULL, 1);
+  cb_check("cbfifo_new(64) != NULL", plain != NULL, 1);
+  cb_check("cbfifo_new_ex(64, CBFIFO_BLOCKING | CBFIFO_OVERWRITE) != NULL", lossy != NULL, 1);
+  if (fifo == NULL || plain == NULL || lossy == NULL) {
+    cbfifo_free(fifo);
+    cbfifo_free(plain);
+    cbfifo_free(lossy);
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  cb_check("cbfifo_dequeue_wait(plain)", cbfifo_dequeue_wait(plain, buf, 1, 1, 0), -1);
+  cb_check("cbfifo_enqueue_wait(fifo, 257)", cbfifo_enqueue_wait(fifo, buf, 257, 0), -1);
+
+  // CBFIFO_OVERWRITE never waits, even for more than the ring holds
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = (uint8_t)i;
+  cb_check("cbfifo_enqueue_wait(lossy, 100)", cbfifo_enqueue_wait(lossy, buf, 100, 0), 100);
+  cb_check("cbfifo_dropped_bytes(lossy)", cbfifo_dropped_bytes(lossy), 36);
+  cb_check("cbfifo_dequeue_from(lossy, 128)", cbfifo_dequeue_from(lossy, buf + 128, 128), 64);
+  cb_check("last bytes kept", memcmp(buf + 128, buf + 36, 64), 0);
+
+  // Nothing arrives, so this must time out after about 2ms
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  cb_check("cbfifo_dequeue_wait(fifo) timeout", cbfifo_dequeue_wait(fifo, buf, 8, 1, 2000), 0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long waited_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+  cb_check("waited at least 2000us", waited_us >= 2000, 1);
+
+  // Full ring: the producer has to wait for the consumer
+  cb_check("cbfifo_enqueue_wait(fifo, 256)", cbfifo_enqueue_wait(fifo, buf, 256, 0), 256);
+  cb_check("cbfifo_enqueue_wait(fifo, 1) timeout", cbfifo_enqueue_wait(fifo, buf, 1, 1000), -1);
+  cb_check("cbfifo_dequeue_wait(fifo, 256)", cbfifo_dequeue_wait(fifo, buf, 64, 64, 0), 64);
+  cbfifo_consume(fifo, 192);
+
+  // Stream between threads, with the consumer asking for whole 32 byte
+  // chunks while the producer writes 50 at a time
+  pthread_create(&producer, NULL, blocking_producer, fifo);
+  while (received < BLOCKING_TEST_BYTES) {
+    size_t want = BLOCKING_TEST_BYTES - received;
+    if (want > 32)
+      want = 32;
+    size_t n = cbfifo_dequeue_wait(fifo, buf, sizeof(buf), want, 1000000);
+    if (n == 0 || n == (size_t)-1)
+      break;
+    if (n < want)
+      in_order = 0;
+    for (size_t i = 0; i < n; i++)
+      if (buf[i] != next++)
+        in_order = 0;
+    received += n;
+  }
+  pthread_join(producer, NULL);
+
+  cb_check("bytes received", received, BLOCKING_TEST_BYTES);
+  cb_check("bytes received in order", in_order, 1);
+
+  cbfifo_free(fifo);
+  cbfifo_free(plain);
+  cbfifo_free(lossy);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+#define MPSC_PRODUCERS 4
+#define MPSC_RECORDS   20000
+
+// A record is 12 bytes, so records keep straddling the end of the ring
+typedef struct {
+  uint32_t producer;
+  uint32_t seq;
+  uint32_t check;
+} mpsc_record_t;
+
+typedef struct {
+  cbfifo_t *fifo;
+  uint32_t id;
+} mpsc_arg_t;
+
+// Producer thread: writes numbered records, retrying or waiting when full
+static void *mpsc_producer(void *arg)
+{
+  mpsc_arg_t *a = (mpsc_arg_t *)arg;
+  bool blocking = cbfifo_flags_of(a->fifo) & CBFIFO_BLOCKING;
+
+  for (uint32_t i = 0; i < MPSC_RECORDS; i++) {
+    mpsc_record_t rec = { a->id, i, a->id * 0x9e3779b9u ^ i };
+    if (blocking) {
+      if (cbfifo_enqueue_wait(a->fifo, &rec, sizeof(rec), -1) != sizeof(rec))
+        break;
+    } else {
+      while (cbfifo_enqueue_to(a->fifo, &rec, sizeof(rec)) == (size_t)-1)
+        sched_yield();
+    }
+  }
+  return NULL;
+}
+
+// Runs MPSC_PRODUCERS producers into fifo, and checks what arrives here
+static void mpsc_stream(cbfifo_t *fifo, const char *what)
+{
+  pthread_t producers[MPSC_PRODUCERS];
+  mpsc_arg_t args[MPSC_PRODUCERS];
+  uint32_t next[MPSC_PRODUCERS] = {0};
+  bool blocking = cbfifo_flags_of(fifo) & CBFIFO_BLOCKING;
+  size_t received = 0;
+  int in_order = 1;
+  char name[64];
+
+  for (int i = 0; i < MPSC_PRODUCERS; i++) {
+    args[i].fifo = fifo;
+    args[i].id = i;
+    pthread_create(&producers[i], NULL, mpsc_producer, &args[i]);
+  }
+
+  while (received < MPSC_PRODUCERS * MPSC_RECORDS) {
+    mpsc_record_t rec;
+    size_t n;
+    if (blocking)
+      n = cbfifo_dequeue_wait(fifo, &rec, sizeof(rec), sizeof(rec), 1000000);
+    else
+      n = cbfifo_dequeue_from(fifo, &rec, sizeof(rec));
+    if (n == 0 && blocking)
+      break;
+    if (n == 0) {
+      sched_yield();
+      continue;
+    }
+    // Each enqueue is stored whole, so records never interleave
+    if (n != sizeof(rec) || rec.producer >= MPSC_PRODUCERS ||
+        rec.seq != next[rec.producer] || rec.check != (rec.producer * 0x9e3779b9u ^ rec.seq)) {
+      in_order = 0;
+      break;
+    }
+    next[rec.producer]++;
+    received++;
+  }
+  for (int i = 0; i < MPSC_PRODUCERS; i++)
+    pthread_join(producers[i], NULL);
+
+  snprintf(name, sizeof(name), "%s records received", what);
+  cb_check(name, received, MPSC_PRODUCERS * MPSC_RECORDS);
+  snprintf(name, sizeof(name), "%s records in order", what);
+  cb_check(name, in_order, 1);
+}
+
+
+int test_cbfifo_mpsc()
+{ 
+  uint8_t buf[1024];
+  uint8_t out[1024];
+  void *ptr;
+  size_t contig;
+  cbfifo_t *fifo = cbfifo_new_ex(1000, CBFIFO_MPSC);
+  cbfifo_t *blocking = cbfifo_new_ex(100, CBFIFO_MPSC | CBFIFO_BLOCKING);
+
+  cb_check_begin();
+  cb_check("cbfifo_new_ex(1000, CBFIFO_MPSC) != NULL", fifo != NULL, 1);
+  cb_check("cbfifo_new_ex(100, CBFIFO_MPSC | CBFIFO_BLOCKING) != NULL", blocking != NULL, 1);
+  if (fifo == NULL || blocking == NULL) {
+    cbfifo_free(fifo);
+    cbfifo_free(blocking);
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+  cb_check("cbfifo_capacity_of(fifo)", cbfifo_capacity_of(fifo), 1024);
+  cb_check("cbfifo_flags_of(fifo)", cbfifo_flags_of(fifo), CBFIFO_MPSC | CBFIFO_POW2);
+  cb_check("cbfifo_flags_of(blocking)", cbfifo_flags_of(blocking),
+      CBFIFO_MPSC | CBFIFO_BLOCKING | CBFIFO_POW2);
+
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = (uint8_t)(i * 7);
+
+  // A full ring turns enqueues away whole, losing nothing
+  cb_check("cbfifo_enqueue_to(fifo, 0)", cbfifo_enqueue_to(fifo, buf, 0), 0);
+  cb_check("cbfifo_enqueue_to(fifo, 1000)", cbfifo_enqueue_to(fifo, buf, 1000), 1000);
+  cb_check("cbfifo_enqueue_to(fifo, 25) full", cbfifo_enqueue_to(fifo, buf, 25), -1);
+  cb_check("cbfifo_enqueue_to(fifo, 24)", cbfifo_enqueue_to(fifo, buf + 1000, 24), 24);
+  cb_check("cbfifo_enqueue_to(fifo, 1) full", cbfifo_enqueue_to(fifo, buf, 1), -1);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 1024);
+  cb_check("cbfifo_dequeue_from(fifo, 1024)", cbfifo_dequeue_from(fifo, out, 1024), 1024);
+  cb_check("bytes match", memcmp(buf, out, 1024), 0);
+
+  // Wrapping claim
+  cb_check("cbfifo_enqueue_to(fifo, 600)", cbfifo_enqueue_to(fifo, buf, 600), 600);
+  cb_check("cbfifo_dequeue_from(fifo, 600)", cbfifo_dequeue_from(fifo, out, 600), 600);
+  cb_check("cbfifo_enqueue_to(fifo, 700)", cbfifo_enqueue_to(fifo, buf, 700), 700);
+  cb_check("cbfifo_dequeue_from(fifo, 700)", cbfifo_dequeue_from(fifo, out, 700), 700);
+  cb_check("wrapped bytes match", memcmp(buf, out, 700), 0);
+
+  // Producers cannot write into the ring directly
+  cb_check("cbfifo_reserve(fifo)", cbfifo_reserve(fifo, 0, &ptr, &contig), 0);
+  cb_check("cbfifo_commit(fifo)", cbfifo_commit(fifo, 1), -1);
+
+  // Blocking: a full ring makes the producer wait, or time out
+  cb_check("cbfifo_enqueue_wait(blocking, 129)", cbfifo_enqueue_wait(blocking, buf, 129, 0), -1);
+  cb_check("cbfifo_enqueue_wait(blocking, 100)", cbfifo_enqueue_wait(blocking, buf, 100, 0), 100);
+  cb_check("cbfifo_enqueue_wait(blocking, 29) timeout", cbfifo_enqueue_wait(blocking, buf, 29, 1000), -1);
+  cb_check("cbfifo_enqueue_wait(blocking, 28)", cbfifo_enqueue_wait(blocking, buf, 28, 1000), 28);
+  cbfifo_consume(blocking, 128);
+
+  mpsc_stream(fifo, "try");
+  mpsc_stream(blocking, "blocking");
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 0);
+  cb_check("cbfifo_length_of(blocking)", cbfifo_length_of(blocking), 0);
+
+  cbfifo_free(fifo);
+  cbfifo_free(blocking);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+#define MSG_TEST_MESSAGES 100000
+
+// Fills buf with the payload of message i, whose length is i % 151
+static size_t msg_pattern(uint8_t *buf, uint32_t i)
+{
+  size_t len = i % 151;
+  for (size_t k = 0; k < len; k++)
+    buf[k] = (uint8_t)(i + k);
+  return len;
+}
+
+// Producer thread: writes numbered messages of varying length
+static void *msg_producer(void *arg)
+{
+  cbfifo_t *fifo = (cbfifo_t *)arg;
+  uint8_t buf[160];
+
+  for (uint32_t i = 0; i < MSG_TEST_MESSAGES; i++) {
+    size_t len = msg_pattern(buf, i);
+    while (cbfifo_msg_enqueue(fifo, buf, len) != len)
+      sched_yield();
+  }
+  return NULL;
+}
+
+
+int test_cbfifo_msg()
+{ 
+  uint8_t big[300];
+  uint8_t buf[512];
+  uint8_t want[160];
+  cbfifo_msg_t msgs[8];
+  uint32_t next = 0;
+  int in_order = 1;
+  pthread_t producer;
+  cbfifo_t *plain = cbfifo_new(64);
+  cbfifo_t *fifo = cbfifo_new_ex(300, CBFIFO_MSG);
+  cbfifo_t *spsc = cbfifo_new_ex(1000, CBFIFO_MSG | CBFIFO_SPSC);
+
+  cb_check_begin();
+  cb_check("cbfifo_new_ex(300, CBFIFO_MSG) != NULL", fifo != NULL, 1);
+  cb_check("cbfifo_new_ex(1000, CBFIFO_MSG | CBFIFO_SPSC) != NULL", spsc != NULL, 1);
+  if (plain == NULL || fifo == NULL || spsc == NULL) {
+    cbfifo_free(plain);
+    cbfifo_free(fifo);
+    cbfifo_free(spsc);
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  for (size_t i = 0; i < sizeof(big); i++)
+    big[i] = (uint8_t)(i * 3);
+
+  // Message calls need a CBFIFO_MSG FIFO
+  cb_check("cbfifo_msg_enqueue(plain)", cbfifo_msg_enqueue(plain, big, 1), -1);
+  cb_check("cbfifo_msg_dequeue_batch(plain)", cbfifo_msg_dequeue_batch(plain, buf, sizeof(buf), msgs, 8), -1);
+  cb_check("cbfifo_msg_length(fifo) empty", cbfifo_msg_length(fifo), -1);
+  cb_check("cbfifo_msg_dequeue_batch(fifo) empty", cbfifo_msg_dequeue_batch(fifo, buf, sizeof(buf), msgs, 8), 0);
+
+  // Headers are one byte under 128, two up to 16383
+  cb_check("cbfifo_msg_enqueue(fifo, 0)", cbfifo_msg_enqueue(fifo, big, 0), 0);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 1);
+  cb_check("cbfifo_msg_enqueue(fifo, 127)", cbfifo_msg_enqueue(fifo, big, 127), 127);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 129);
+  cb_check("cbfifo_msg_enqueue(fifo, 128)", cbfifo_msg_enqueue(fifo, big + 1, 128), 128);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 259);
+  cb_check("cbfifo_msg_enqueue(fifo, 41) full", cbfifo_msg_enqueue(fifo, big, 41), -1);
+  cb_check("cbfifo_msg_enqueue(fifo, 40)", cbfifo_msg_enqueue(fifo, big + 2, 40), 40);
+  cb_check("cbfifo_length_of(fifo) full", cbfifo_length_of(fifo), 300);
+
+  // Batches stop at max, and at a message that does not fit
+  cb_check("cbfifo_msg_length(fifo)", cbfifo_msg_length(fifo), 0);
+  cb_check("cbfifo_msg_dequeue_batch(fifo, max 2)", cbfifo_msg_dequeue_batch(fifo, buf, sizeof(buf), msgs, 2), 2);
+  cb_check("msgs[0].len", msgs[0].len, 0);
+  cb_check("msgs[1].len", msgs[1].len, 127);
+  cb_check("msgs[1].data", memcmp(msgs[1].data, big, 127), 0);
+  cb_check("cbfifo_msg_length(fifo)", cbfifo_msg_length(fifo), 128);
+  cb_check("cbfifo_msg_dequeue_batch(fifo, 127 bytes)", cbfifo_msg_dequeue_batch(fifo, buf, 127, msgs, 8), -1);
+  cb_check("cbfifo_msg_dequeue_batch(fifo, 150 bytes)", cbfifo_msg_dequeue_batch(fifo, buf, 150, msgs, 8), 1);
+  cb_check("msgs[0].len", msgs[0].len, 128);
+  cb_check("msgs[0].data", memcmp(msgs[0].data, big + 1, 128), 0);
+
+  // A message that wraps around the end of the ring
+  cb_check("cbfifo_msg_enqueue(fifo, 200)", cbfifo_msg_enqueue(fifo, big + 3, 200), 200);
+  cb_check("cbfifo_msg_dequeue_batch(fifo)", cbfifo_msg_dequeue_batch(fifo, buf, sizeof(buf), msgs, 8), 2);
+  cb_check("msgs[0].data", memcmp(msgs[0].data, big + 2, 40), 0);
+  cb_check("msgs[1].len", msgs[1].len, 200);
+  cb_check("msgs[1].data", memcmp(msgs[1].data, big + 3, 200), 0);
+  cb_check("msgs[1].data follows msgs[0]", (uint8_t *)msgs[1].data - buf, 40);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 0);
+  cb_check("cbfifo_msg_enqueue(fifo, 299) too big", cbfifo_msg_enqueue(fifo, big, 299), -1);
+
+  // Between threads, every message arrives whole and in order
+  pthread_create(&producer, NULL, msg_producer, spsc);
+  while (next < MSG_TEST_MESSAGES && in_order) {
+    size_t n = cbfifo_msg_dequeue_batch(spsc, buf, sizeof(buf), msgs, 8);
+    if (n == (size_t)-1)
+      in_order = 0;
+    else if (n == 0)
+      sched_yield();
+    for (size_t i = 0; in_order && i < n; i++, next++) {
+      size_t len = msg_pattern(want, next);
+      if (msgs[i].len != len || memcmp(msgs[i].data, want, len) != 0)
+        in_order = 0;
+    }
+  }
+  pthread_join(producer, NULL);
+  cb_check("messages received", next, MSG_TEST_MESSAGES);
+  cb_check("messages received whole and in order", in_order, 1);
+
+  cbfifo_free(plain);
+  cbfifo_free(fifo);
+  cbfifo_free(spsc);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+#define OVERWRITE_TEST_MESSAGES 200000
+
+// Producer thread: writes numbered messages as fast as it can, never
+// waiting for the consumer
+static void *overwrite_producer(void *arg)
+{
+  cbfifo_t *fifo = (cbfifo_t *)arg;
+  uint8_t buf[160];
+
+  for (uint32_t i = 0; i < OVERWRITE_TEST_MESSAGES; i++) {
+    size_t len = msg_pattern(buf + 4, i) + 4;
+    memcpy(buf, &i, 4);
+    if (cbfifo_msg_enqueue(fifo, buf, len) != len)
+      break;
+  }
+  return NULL;
+}
+
+
+#define OVERWRITE_TEST_BYTES (1024u * 1024)
+
+// Producer thread: writes a counting pattern in uneven chunks, some
+// larger than the ring, never waiting for the consumer
+static void *overwrite_stream_producer(void *arg)
+{
+  cbfifo_t *fifo = (cbfifo_t *)arg;
+  uint8_t buf[97];
+  uint8_t next = 0;
+  size_t sent = 0;
+
+  while (sent < OVERWRITE_TEST_BYTES) {
+    size_t n = 1 + sent % sizeof(buf);
+    if (n > OVERWRITE_TEST_BYTES - sent)
+      n = OVERWRITE_TEST_BYTES - sent;
+    for (size_t i = 0; i < n; i++)
+      buf[i] = (uint8_t)(next + i);
+    if (cbfifo_enqueue_to(fifo, buf, n) != n)
+      break;
+    next += n;
+    sent += n;
+  }
+  return NULL;
+}
+
+
+int test_cbfifo_overwrite()
+{ 
+  uint8_t in[64];
+  uint8_t out[64];
+  uint8_t want[160];
+  uint8_t buf[1024];
+  cbfifo_msg_t msgs[8];
+  size_t received = 0;
+  uint32_t last = 0;
+  int in_order = 1;
+  pthread_t producer;
+  cbfifo_t *bytes = cbfifo_new_ex(10, CBFIFO_OVERWRITE);
+  cbfifo_t *msg = cbfifo_new_ex(64, CBFIFO_OVERWRITE | CBFIFO_MSG);
+  cbfifo_t *spsc = cbfifo_new_ex(512, CBFIFO_OVERWRITE | CBFIFO_MSG | CBFIFO_SPSC);
+  cbfifo_t *stream = cbfifo_new_ex(64, CBFIFO_OVERWRITE | CBFIFO_SPSC);
+
+  cb_check_begin();
+  cb_check("cbfifo_new_ex(10, CBFIFO_OVERWRITE) != NULL", bytes != NULL, 1);
+  cb_check("cbfifo_new_ex(64, CBFIFO_OVERWRITE | CBFIFO_MSG) != NULL", msg != NULL, 1);
+  cb_check("cbfifo_new_ex(512, CBFIFO_OVERWRITE | CBFIFO_MSG | CBFIFO_SPSC) != NULL", spsc != NULL, 1);
+  cb_check("cbfifo_new_ex(64, CBFIFO_OVERWRITE | CBFIFO_SPSC) != NULL", stream != NULL, 1);
+  cb_check("cbfifo_new_ex(64, CBFIFO_OVERWRITE | CBFIFO_MPSC) == NULL",
+      cbfifo_new_ex(64, CBFIFO_OVERWRITE | CBFIFO_MPSC) == NULL, 1);
+  if (bytes == NULL || msg == NULL || spsc == NULL || stream == NULL) {
+    cbfifo_free(bytes);
+    cbfifo_free(msg);
+    cbfifo_free(spsc);
+    cbfifo_free(stream);
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  for (size_t i = 0; i < sizeof(in); i++)
+    in[i] = (uint8_t)i;
+
+  // Bytes: the oldest are dropped to make room, the newest kept
+  cb_check("cbfifo_capacity_of(bytes)", cbfifo_capacity_of(bytes), 16);
+  cb_check("cbfifo_enqueue_to(bytes, 10)", cbfifo_enqueue_to(bytes, in, 10), 10);
+  cb_check("cbfifo_enqueue_to(bytes, 10) full", cbfifo_enqueue_to(bytes, in + 10, 10), 10);
+  cb_check("cbfifo_length_of(bytes)", cbfifo_length_of(bytes), 16);
+  cb_check("cbfifo_dropped_bytes(bytes)", cbfifo_dropped_bytes(bytes), 4);
+  cb_check("cbfifo_dequeue_from(bytes, 64)", cbfifo_dequeue_from(bytes, out, 64), 16);
+  cb_check("newest bytes kept", memcmp(out, in + 4, 16), 0);
+
+  // Larger than the ring: only the last 16 bytes survive
+  cb_check("cbfifo_enqueue_to(bytes, 3)", cbfifo_enqueue_to(bytes, in, 3), 3);
+  cb_check("cbfifo_enqueue_to(bytes, 40)", cbfifo_enqueue_to(bytes, in + 3, 40), 40);
+  cb_check("cbfifo_dropped_bytes(bytes)", cbfifo_dropped_bytes(bytes), 4 + 3 + 24);
+  cb_check("cbfifo_dequeue_from(bytes, 64)", cbfifo_dequeue_from(bytes, out, 64), 16);
+  cb_check("last bytes kept", memcmp(out, in + 27, 16), 0);
+
+  // A peek overtaken by the producer removes nothing when consumed
+  void *ptr1, *ptr2;
+  size_t len1, len2;
+  cb_check("cbfifo_enqueue_to(bytes, 12)", cbfifo_enqueue_to(bytes, in, 12), 12);
+  cb_check("cbfifo_peek(bytes)", cbfifo_peek(bytes, &ptr1, &len1, &ptr2, &len2), 12);
+  cb_check("cbfifo_enqueue_to(bytes, 8)", cbfifo_enqueue_to(bytes, in + 12, 8), 8);
+  cb_check("cbfifo_consume(bytes, 12) overwritten", cbfifo_consume(bytes, 12), 0);
+  cb_check("cbfifo_length_of(bytes)", cbfifo_length_of(bytes), 16);
+  cb_check("cbfifo_peek(bytes) again", cbfifo_peek(bytes, &ptr1, &len1, &ptr2, &len2), 16);
+  cb_check("cbfifo_consume(bytes, 12)", cbfifo_consume(bytes, 12), 12);
+  cb_check("cbfifo_dequeue_from(bytes, 64)", cbfifo_dequeue_from(bytes, out, 64), 4);
+  cb_check("bytes after the consumed ones", memcmp(out, in + 16, 4), 0);
+  cb_check("cbfifo_dropped_msgs(bytes)", cbfifo_dropped_msgs(bytes), 0);
+
+  // Messages: whole messages are dropped, oldest first
+  cb_check("cbfifo_msg_enqueue(msg, 20) #0", cbfifo_msg_enqueue(msg, in, 20), 20);
+  cb_check("cbfifo_msg_enqueue(msg, 20) #1", cbfifo_msg_enqueue(msg, in + 1, 20), 20);
+  cb_check("cbfifo_msg_enqueue(msg, 20) #2", cbfifo_msg_enqueue(msg, in + 2, 20), 20);
+  cb_check("cbfifo_dropped_msgs(msg)", cbfifo_dropped_msgs(msg), 0);
+  cb_check("cbfifo_msg_enqueue(msg, 30) #3", cbfifo_msg_enqueue(msg, in + 3, 30), 30);
+  cb_check("cbfifo_dropped_msgs(msg)", cbfifo_dropped_msgs(msg), 2);
+  cb_check("cbfifo_dropped_bytes(msg)", cbfifo_dropped_bytes(msg), 42);
+  cb_check("cbfifo_msg_enqueue(msg, 64) too big", cbfifo_msg_enqueue(msg, in, 64), -1);
+  cb_check("cbfifo_msg_enqueue(msg, 63) whole ring", cbfifo_msg_enqueue(msg, in, 63), 63);
+  cb_check("cbfifo_dropped_msgs(msg)", cbfifo_dropped_msgs(msg), 4);
+  cb_check("cbfifo_msg_enqueue(msg, 5)", cbfifo_msg_enqueue(msg, in + 5, 5), 5);
+  cb_check("cbfifo_dropped_msgs(msg)", cbfifo_dropped_msgs(msg), 5);
+  cb_check("cbfifo_msg_dequeue_batch(msg)", cbfifo_msg_dequeue_batch(msg, buf, sizeof(buf), msgs, 8), 1);
+  cb_check("msgs[0].len", msgs[0].len, 5);
+  cb_check("msgs[0].data", memcmp(msgs[0].data, in + 5, 5), 0);
+
+  // Between threads: the producer never waits, and the consumer sees
+  // whole messages in order, with gaps only where messages were dropped
+  pthread_create(&producer, NULL, overwrite_producer, spsc);
+  while (in_order && last + 1 < OVERWRITE_TEST_MESSAGES) {
+    size_t n = cbfifo_msg_dequeue_batch(spsc, buf, sizeof(buf), msgs, 8);
+    if (n == (size_t)-1)
+      in_order = 0;
+    else if (n == 0)
+      sched_yield();
+    for (size_t i = 0; in_order && i < n; i++) {
+      uint32_t seq;
+      memcpy(&seq, msgs[i].data, 4);
+      size_t len = msg_pattern(want, seq) + 4;
+      if ((received > 0 && seq <= last) || msgs[i].len != len ||
+          memcmp((uint8_t *)msgs[i].data + 4, want, len - 4) != 0)
+        in_order = 0;
+      last = seq;
+      received++;
+    }
+  }
+  pthread_join(producer, NULL);
+  cb_check("messages whole and in order", in_order, 1);
+  cb_check("last message received", last, OVERWRITE_TEST_MESSAGES - 1);
+  cb_check("messages received + dropped", received + cbfifo_dropped_msgs(spsc), OVERWRITE_TEST_MESSAGES);
+
+  // Bytes between threads, asking for more than the ring holds: no
+  // dequeue returns more than the capacity, and each is an unbroken run
+  int in_run = 1;
+  size_t most = 0;
+  received = 0;
+  pthread_create(&producer, NULL, overwrite_stream_producer, stream);
+  while (received + cbfifo_dropped_bytes(stream) < OVERWRITE_TEST_BYTES) {
+    size_t n = cbfifo_dequeue_from(stream, buf, sizeof(buf));
+    if (n > most)
+      most = n;
+    for (size_t i = 1; i < n && i < sizeof(buf); i++)
+      if (buf[i] != (uint8_t)(buf[i - 1] + 1))
+        in_run = 0;
+    if (n == 0)
+      sched_yield();
+    received += n;
+  }
+  pthread_join(producer, NULL);
+  cb_check("dequeued runs unbroken", in_run, 1);
+  cb_check("no dequeue larger than the ring", most <= cbfifo_capacity_of(stream), 1);
+  cb_check("bytes received + dropped", received + cbfifo_dropped_bytes(stream), OVERWRITE_TEST_BYTES);
+
+  cbfifo_free(bytes);
+  cbfifo_free(msg);
+  cbfifo_free(spsc);
+  cbfifo_free(stream);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+int test_cbfifo_vector()
+{ 
+  uint8_t in[256];
+  uint8_t a[30], b[30], c[50];
+  uint8_t out[128];
+  cbfifo_t *fifo = cbfifo_new(100);
+  cbfifo_t *mpsc = cbfifo_new_ex(64, CBFIFO_MPSC);
+  cbfifo_t *lossy = cbfifo_new_ex(16, CBFIFO_OVERWRITE);
+
+  cb_check_begin();
+  cb_check("cbfifo_new(100) != NULL", fifo != NULL, 1);
+  cb_check("cbfifo_new_ex(64, CBFIFO_MPSC) != NULL", mpsc != NULL, 1);
+  cb_check("cbfifo_new_ex(16, CBFIFO_OVERWRITE) != NULL", lossy != NULL, 1);
+  if (fifo == NULL || mpsc == NULL || lossy == NULL) {
+    cbfifo_free(fifo);
+    cbfifo_free(mpsc);
+    cbfifo_free(lossy);
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+
+  for (size_t i = 0; i < sizeof(in); i++)
+    in[i] = (uint8_t)(i * 5 + 1);
+
+  // Partial accept takes what fits, where cbfifo_enqueue_to() refuses
+  cb_check("cbfifo_enqueue_partial(fifo, 80)", cbfifo_enqueue_partial(fifo, in, 80), 80);
+  cb_check("cbfifo_enqueue_to(fifo, 50)", cbfifo_enqueue_to(fifo, in + 80, 50), -1);
+  cb_check("cbfifo_enqueue_partial(fifo, 50)", cbfifo_enqueue_partial(fifo, in + 80, 50), 20);
+  cb_check("cbfifo_enqueue_partial(fifo, 50) full", cbfifo_enqueue_partial(fifo, in + 100, 50), 0);
+  cb_check("cbfifo_enqueue_partial(fifo, NULL)", cbfifo_enqueue_partial(fifo, NULL, 1), -1);
+
+  // Scatter: each buffer is filled before the next
+  struct iovec scatter[3] = { { a, sizeof(a) }, { b, sizeof(b) }, { c, sizeof(c) } };
+  cb_check("cbfifo_dequeuev(fifo, 110)", cbfifo_dequeuev(fifo, scatter, 3), 100);
+  cb_check("a", memcmp(a, in, 30), 0);
+  cb_check("b", memcmp(b, in + 30, 30), 0);
+  cb_check("c", memcmp(c, in + 60, 40), 0);
+  cb_check("cbfifo_dequeuev(fifo) empty", cbfifo_dequeuev(fifo, scatter, 3), 0);
+
+  // Gather, wrapping around the end of the ring, and cut short
+  struct iovec gather[4] = { { in, 10 }, { NULL, 0 }, { in + 10, 45 }, { in + 55, 60 } };
+  cb_check("cbfifo_enqueue_partial(fifo, 40)", cbfifo_enqueue_partial(fifo, in, 40), 40);
+  cb_check("cbfifo_dequeue_from(fifo, 40)", cbfifo_dequeue_from(fifo, out, 40), 40);
+  cb_check("cbfifo_enqueuev(fifo, 115)", cbfifo_enqueuev(fifo, gather, 4), 100);
+  cb_check("cbfifo_dequeuev(fifo, 30 + 30)", cbfifo_dequeuev(fifo, scatter, 2), 60);
+  cb_check("cbfifo_dequeue_from(fifo, 128)", cbfifo_dequeue_from(fifo, out, sizeof(out)), 40);
+  cb_check("gathered bytes in order", memcmp(a, in, 30) == 0 && memcmp(b, in + 30, 30) == 0 &&
+      memcmp(out, in + 60, 40) == 0, 1);
+  cb_check("cbfifo_enqueuev(fifo, 0 buffers)", cbfifo_enqueuev(fifo, gather, 0), 0);
+
+  // Bad lists
+  struct iovec bad[1] = { { NULL, 4 } };
+  cb_check("cbfifo_enqueuev(fifo, -1 buffers)", cbfifo_enqueuev(fifo, gather, -1), -1);
+  cb_check("cbfifo_enqueuev(fifo, NULL base)", cbfifo_enqueuev(fifo, bad, 1), -1);
+  cb_check("cbfifo_dequeuev(fifo, NULL base)", cbfifo_dequeuev(fifo, bad, 1), -1);
+  cb_check("cbfifo_dequeuev(fifo, NULL list)", cbfifo_dequeuev(fifo, NULL, 2), -1);
+
+  // CBFIFO_MPSC producers claim just what fits
+  cb_check("cbfifo_enqueuev(mpsc, 115)", cbfifo_enqueuev(mpsc, gather, 4), 64);
+  cb_check("cbfifo_enqueue_partial(mpsc, 1) full", cbfifo_enqueue_partial(mpsc, in, 1), 0);
+  cb_check("cbfifo_dequeue_from(mpsc, 128)", cbfifo_dequeue_from(mpsc, out, sizeof(out)), 64);
+  cb_check("mpsc bytes", memcmp(out, in, 64), 0);
+
+  // CBFIFO_OVERWRITE takes everything and keeps the last bytes
+  cb_check("cbfifo_enqueuev(lossy, 115)", cbfifo_enqueuev(lossy, gather, 4), 115);
+  cb_check("cbfifo_dropped_bytes(lossy)", cbfifo_dropped_bytes(lossy), 99);
+  cb_check("cbfifo_dequeue_from(lossy, 128)", cbfifo_dequeue_from(lossy, out, sizeof(out)), 16);
+  cb_check("lossy bytes", memcmp(out, in + 99, 16), 0);
+
+  cbfifo_free(fifo);
+  cbfifo_free(mpsc);
+  cbfifo_free(lossy);
+  return cb_check_end(__FUNCTION__);
+}
+
+
+int test_cbfifo_fd()
+{ 
+  uint8_t in[256];
+  uint8_t out[256];
+  int fds[2];
+  cbfifo_t *fifo = cbfifo_new(60);
+  cbfifo_t *mpsc = cbfifo_new_ex(64, CBFIFO_MPSC);
+  cbfifo_t *lossy = cbfifo_new_ex(64, CBFIFO_OVERWRITE);
+
+  cb_check_begin();
+  cb_check("cbfifo_new(60) != NULL", fifo != NULL, 1);
+  cb_check("cbfifo_new_ex(64, CBFIFO_MPSC) != NULL", mpsc != NULL, 1);
+  cb_check("cbfifo_new_ex(64, CBFIFO_OVERWRITE) != NULL", lossy != NULL, 1);
+  int piped = pipe(fds) == 0;
+  cb_check("pipe(fds)", piped, 1);
+  if (fifo == NULL || mpsc == NULL || lossy == NULL || !piped) {
+    if (piped) {
+      close(fds[0]);
+      close(fds[1]);
+    }
+    cbfifo_free(fifo);
+    cbfifo_free(mpsc);
+    cbfifo_free(lossy);
+    cb_check_end(__FUNCTION__);
+    return 0;
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+  for (size_t i = 0; i < sizeof(in); i++)
+    in[i] = (uint8_t)(i * 11 + 3);
+
+  // Nothing to move either way
+  cb_check("cbfifo_write_to_fd(fifo) empty", cbfifo_write_to_fd(fifo, fds[1], 100), 0);
+  errno = 0;
+  cb_check("cbfifo_read_from_fd(fifo) would block", cbfifo_read_from_fd(fifo, fds[0], 100), -1);
+  cb_check("errno == EAGAIN", errno == EAGAIN || errno == EWOULDBLOCK, 1);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 0);
+  cb_check("cbfifo_read_from_fd(fifo, max 0)", cbfifo_read_from_fd(fifo, fds[0], 0), 0);
+
+  // Into the ring, up to max and then up to what is free
+  cb_check("write(pipe, 100)", write(fds[1], in, 100), 100);
+  cb_check("cbfifo_read_from_fd(fifo, 10)", cbfifo_read_from_fd(fifo, fds[0], 10), 10);
+  cb_check("cbfifo_read_from_fd(fifo, 1000)", cbfifo_read_from_fd(fifo, fds[0], 1000), 50);
+  errno = 0;
+  cb_check("cbfifo_read_from_fd(fifo) full", cbfifo_read_from_fd(fifo, fds[0], 1000), -1);
+  cb_check("errno == ENOBUFS", errno, ENOBUFS);
+  cb_check("cbfifo_dequeue_from(fifo, 45)", cbfifo_dequeue_from(fifo, out, 45), 45);
+  cb_check("bytes read in", memcmp(out, in, 45), 0);
+
+  // Free space wraps, so this is a two buffer readv()
+  cb_check("cbfifo_read_from_fd(fifo, 1000) wrapped", cbfifo_read_from_fd(fifo, fds[0], 1000), 40);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 55);
+
+  // Out of the ring, wrapped, as one writev()
+  cb_check("cbfifo_write_to_fd(fifo, 1000) wrapped", cbfifo_write_to_fd(fifo, fds[1], 1000), 55);
+  cb_check("read(pipe)", read(fds[0], out, sizeof(out)), 55);
+  cb_check("bytes written out", memcmp(out, in + 45, 55), 0);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 0);
+
+  // A full pipe leaves the bytes on the FIFO
+  while (write(fds[1], in, sizeof(in)) > 0)
+    ;
+  cb_check("cbfifo_enqueue_to(fifo, 20)", cbfifo_enqueue_to(fifo, in, 20), 20);
+  errno = 0;
+  cb_check("cbfifo_write_to_fd(fifo) would block", cbfifo_write_to_fd(fifo, fds[1], 1000), -1);
+  cb_check("errno == EAGAIN", errno == EAGAIN || errno == EWOULDBLOCK, 1);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 20);
+  while (read(fds[0], out, sizeof(out)) > 0)
+    ;
+  cb_check("cbfifo_write_to_fd(fifo, 8)", cbfifo_write_to_fd(fifo, fds[1], 8), 8);
+  cb_check("cbfifo_length_of(fifo)", cbfifo_length_of(fifo), 12);
+
+  // Modes that cannot take part
+  errno = 0;
+  cb_check("cbfifo_read_from_fd(mpsc)", cbfifo_read_from_fd(mpsc, fds[0], 10), -1);
+  cb_check("errno == EINVAL", errno, EINVAL);
+  errno = 0;
+  cb_check("cbfifo_write_to_fd(lossy)", cbfifo_write_to_fd(lossy, fds[1], 10), -1);
+  cb_check("errno == EINVAL", errno, EINVAL);
+
+  // End of file
+  close(fds[1]);
+  cb_check("cbfifo_read_from_fd(fifo, 100)", cbfifo_read_from_fd(fifo, fds[0], 100), 8);
+  cb_check("cbfifo_read_from_fd(fifo) end of file", cbfifo_read_from_fd(fifo, fds[0], 100), 0);
+  close(fds[0]);
+
+  cbfifo_free(fifo);
+  cbfifo_free(mpsc);
+  cbfifo_free(lossy);
+  return cb_check_end(__FUNCTION__);
+}
+
+
 int cbfifo_main()
 {
     int pass = 1;
@@ -187,5 +1280,18 @@ int cbfifo_main()
     pass &= test_cbfifo_capacity();
     pass = test_cbfifo_length();
     pass = test_cbfifo_dequeue();
+    pass &= test_cbfifo_instances();
+    pass &= test_cbfifo_wrap();
+    pass &= test_cbfifo_pow2();
+    pass &= test_cbfifo_spsc();
+    pass &= test_cbfifo_reserve();
+    pass &= test_cbfifo_peek();
+    pass &= test_cbfifo_mirror();
+    pass &= test_cbfifo_blocking();
+    pass &= test_cbfifo_mpsc();
+    pass &= test_cbfifo_msg();
+    pass &= test_cbfifo_overwrite();
+    pass &= test_cbfifo_vector();
+    pass &= test_cbfifo_fd();
     return pass;
 }
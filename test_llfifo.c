@@ -6,8 +6,12 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <assert.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 #include "test_llfifo.h"
 #include "llfifo.h"
@@ -45,7 +49,7 @@ static int g_skip_tests = 0;
 }
 
 static void
-test_llfifo_one_iteration(int capacity)
+test_llfifo_one_iteration(int capacity, unsigned flags)
 {
   char *strs[] =
     { "To be, or not to be: that is the question:",
@@ -66,7 +70,7 @@ test_llfifo_one_iteration(int capacity)
   const int strs_len = sizeof(strs) / sizeof(const char *);
   llfifo_t *fifo;
 
-  fifo = llfifo_create(capacity);
+  fifo = llfifo_create_ex(capacity, flags);
   test_assert(fifo != NULL);
 
   test_equal(llfifo_capacity(fifo), capacity);
@@ -118,7 +122,7 @@ test_llfifo_one_iteration(int capacity)
   const int capacity2 = 3;
   llfifo_t *fifo2;
 
-  fifo2 = llfifo_create(capacity2);
+  fifo2 = llfifo_create_ex(capacity2, flags);
   test_assert(fifo2 != NULL);
   test_equal(llfifo_capacity(fifo2), capacity2);
   test_equal(llfifo_length(fifo2), 0);
@@ -152,19 +156,498 @@ test_llfifo_one_iteration(int capacity)
 }
 
 
+/*
+ * Runs enough elements through the fifo to fill and empty many
+ * blocks, with the queue both deep and shallow, and checks order,
+ * length and capacity along the way
+ */
+static void
+test_llfifo_deep(int capacity, unsigned flags)
+{
+  static char items[1000];
+  const int n = sizeof(items);
+  int next = 0;
+  llfifo_t *fifo = llfifo_create_ex(capacity, flags);
+  test_assert(fifo != NULL);
+
+  for (int i=0; i<n; i++)
+    test_equal(llfifo_enqueue(fifo, &items[i]), i+1);
+  test_equal(llfifo_capacity(fifo), max(capacity, n));
+  for (int i=0; i<n/2; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+
+  // Refill, so the list wraps onto recycled blocks
+  for (int i=0; i<n/2; i++)
+    test_equal(llfifo_enqueue(fifo, &items[i]), n/2+i+1);
+  test_equal(llfifo_capacity(fifo), max(capacity, n));
+  for (int i=n/2; i<n; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+  for (int i=0; i<n/2; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+  test_equal(llfifo_length(fifo), 0);
+  test_equal(llfifo_dequeue(fifo), NULL);
+
+  // Trickle through with a short queue
+  for (int i=0; i<n; i++) {
+    test_equal(llfifo_enqueue(fifo, &items[i]), 1);
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+  }
+  test_equal(llfifo_capacity(fifo), max(capacity, n));
+  llfifo_destroy(fifo);
+
+  // Grow while the queue wraps round: two in, one out
+  fifo = llfifo_create_ex(capacity, flags);
+  test_assert(fifo != NULL);
+  for (int i=0; i<2*n; i++) {
+    test_equal(llfifo_enqueue(fifo, &items[i % n]), i - next + 1);
+    if (i & 1) {
+      test_equal(llfifo_dequeue(fifo), &items[next % n]);
+      next++;
+    }
+  }
+  test_equal(llfifo_capacity(fifo), max(capacity, n+1));
+  for (; next < 2*n; next++)
+    test_equal(llfifo_dequeue(fifo), &items[next % n]);
+  test_equal(llfifo_dequeue(fifo), NULL);
+
+  llfifo_destroy(fifo);
+}
+
+
+/*
+ * Grows the fifo through a burst, then checks that memory is given
+ * back by llfifo_shrink() and the trim policy, and held ahead of time
+ * by llfifo_reserve()
+ */
+static void
+test_llfifo_shrink(unsigned flags)
+{
+  static char items[5000];
+  const int n = sizeof(items);
+  llfifo_t *fifo = llfifo_create_ex(0, flags);
+  test_assert(fifo != NULL);
+
+  test_equal(llfifo_allocated(fifo), 0);
+  for (int i=0; i<n; i++)
+    llfifo_enqueue(fifo, &items[i]);
+  test_assert(llfifo_allocated(fifo) >= n);
+
+  // Nothing can go while the elements are there
+  test_equal(llfifo_shrink(fifo, 0), n);
+  test_assert(llfifo_allocated(fifo) >= n);
+  for (int i=0; i<n-10; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+  test_equal(llfifo_shrink(fifo, 0), 10);
+  test_assert(llfifo_allocated(fifo) < n);
+  for (int i=n-10; i<n; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+  test_equal(llfifo_shrink(fifo, 0), 0);
+  test_equal(llfifo_allocated(fifo), 0);
+
+  // Still usable after giving everything back
+  for (int i=0; i<100; i++)
+    test_equal(llfifo_enqueue(fifo, &items[i]), i+1);
+  test_equal(llfifo_capacity(fifo), 100);
+  for (int i=0; i<100; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+
+  // Reserve a little more than is held, with the queue wrapped round
+  for (int i=0; i<100; i++)
+    llfifo_enqueue(fifo, &items[i]);
+  for (int i=0; i<90; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+  for (int i=0; i<80; i++)
+    llfifo_enqueue(fifo, &items[100+i]);
+  test_equal(llfifo_reserve(fifo, 60), 150);
+  for (int i=90; i<180; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+  test_equal(llfifo_length(fifo), 0);
+
+  // Reserve once, then a burst allocates nothing more
+  test_equal(llfifo_reserve(fifo, n), n);
+  int allocated = llfifo_allocated(fifo);
+  test_assert(allocated >= n);
+  for (int i=0; i<n; i++)
+    llfifo_enqueue(fifo, &items[i]);
+  test_equal(llfifo_allocated(fifo), allocated);
+  test_equal(llfifo_reserve(fifo, -1), -1);
+
+  // Trim back to 100 once the length is down to 10, not before
+  test_equal(llfifo_set_trim(fifo, 100, 200), -1);
+  test_equal(llfifo_set_trim(fifo, 100, 10), 0);
+  for (int i=0; i<n-11; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+  test_equal(llfifo_capacity(fifo), n);
+  test_equal(llfifo_dequeue(fifo), &items[n-11]);
+  test_equal(llfifo_capacity(fifo), 100);
+  test_assert(llfifo_allocated(fifo) < n);
+  for (int i=n-10; i<n; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+
+  // A batch that jumps from above the low water mark to below it trims
+  void *out[64];
+  for (int i=0; i<n; i++)
+    llfifo_enqueue(fifo, &items[i]);
+  for (int i=0; i<n-20; i++)
+    test_equal(llfifo_dequeue(fifo), &items[i]);
+  test_equal(llfifo_capacity(fifo), n);
+  test_equal(llfifo_dequeue_many(fifo, out, 15), 15);
+  test_equal(out[14], &items[n-6]);
+  test_equal(llfifo_capacity(fifo), 100);
+  test_equal(llfifo_length(fifo), 5);
+
+  // So does a single dequeue that starts below it
+  test_equal(llfifo_reserve(fifo, n), n + 5);
+  test_equal(llfifo_dequeue(fifo), &items[n-5]);
+  test_equal(llfifo_capacity(fifo), 100);
+  test_equal(llfifo_dequeue_many(fifo, out, 64), 4);
+
+  llfifo_destroy(fifo);
+}
+
+
+/*
+ * Moves elements in batches with llfifo_enqueue_many() and
+ * llfifo_dequeue_many(), mixed with single calls, and detaches whole
+ * queues with llfifo_dequeue_all()
+ */
+static void
+test_llfifo_batch(unsigned flags)
+{
+  static char items[300];
+  void *elems[300], *out[300];
+  const int n = sizeof(items);
+  llfifo_chain_t chain;
+  llfifo_t *fifo = llfifo_create_ex(10, flags);
+  test_assert(fifo != NULL);
+
+  for (int i=0; i<n; i++)
+    elems[i] = &items[i];
+
+  test_equal(llfifo_enqueue_many(fifo, elems, 0), 0);
+  test_equal(llfifo_enqueue_many(fifo, elems, -1), -1);
+  test_equal(llfifo_enqueue(fifo, elems[0]), 1);
+  test_equal(llfifo_enqueue_many(fifo, elems + 1, 100), 101);
+  test_equal(llfifo_enqueue_many(fifo, elems + 101, 199), 300);
+  test_equal(llfifo_capacity(fifo), 300);
+
+  test_equal(llfifo_dequeue(fifo), elems[0]);
+  test_equal(llfifo_dequeue_many(fifo, out, 40), 40);
+  for (int i=0; i<40; i++)
+    test_equal(out[i], elems[1+i]);
+  test_equal(llfifo_dequeue_many(fifo, out, 1000), 259);
+  for (int i=0; i<259; i++)
+    test_equal(out[i], elems[41+i]);
+  test_equal(llfifo_length(fifo), 0);
+  test_equal(llfifo_dequeue_many(fifo, out, 10), 0);
+  test_equal(llfifo_capacity(fifo), 300);
+
+  // Detach a queue that starts part way into a block
+  test_equal(llfifo_enqueue_many(fifo, elems, 250), 250);
+  test_equal(llfifo_dequeue_many(fifo, out, 5), 5);
+  test_equal(llfifo_dequeue_all(fifo, &chain), 245);
+  test_equal(llfifo_length(fifo), 0);
+  test_equal(llfifo_dequeue(fifo), NULL);
+
+  // The FIFO is usable while the chain is walked
+  test_equal(llfifo_enqueue(fifo, elems[7]), 1);
+  for (int i=5; i<250; i++)
+    test_equal(llfifo_chain_next(&chain), elems[i]);
+  test_equal(llfifo_chain_next(&chain), NULL);
+  llfifo_chain_release(fifo, &chain);
+  test_equal(llfifo_dequeue(fifo), elems[7]);
+
+  // Detaching an empty FIFO
+  test_equal(llfifo_dequeue_all(fifo, &chain), 0);
+  test_equal(llfifo_chain_next(&chain), NULL);
+  llfifo_chain_release(fifo, &chain);
+  test_equal(llfifo_enqueue_many(fifo, elems, 3), 3);
+  test_equal(llfifo_dequeue_many(fifo, out, 3), 3);
+  test_equal(out[2], elems[2]);
+  test_equal(llfifo_capacity(fifo), 300);
+
+  llfifo_destroy(fifo);
+}
+
+
+#define MPSC_PRODUCERS  4
+#define MPSC_ITEMS      20000
+
+typedef struct {
+  int producer, seq;
+  llfifo_link_t link;
+} mpsc_item_t;
+
+typedef struct {
+  llfifo_mpsc_t *fifo;
+  mpsc_item_t *items;
+} mpsc_arg_t;
+
+static void *
+mpsc_producer(void *p)
+{
+  mpsc_arg_t *arg = (mpsc_arg_t *)p;
+  for (int i=0; i<MPSC_ITEMS; i++)
+    llfifo_mpsc_push(arg->fifo, &arg->items[i].link);
+  return NULL;
+}
+
+/*
+ * Has several threads push into one llfifo_mpsc_t while this thread
+ * pops, and checks every item arrives once, in order per producer
+ */
+static void
+test_llfifo_mpsc()
+{
+  static mpsc_item_t items[MPSC_PRODUCERS][MPSC_ITEMS];
+  mpsc_arg_t args[MPSC_PRODUCERS];
+  pthread_t threads[MPSC_PRODUCERS];
+  int next_seq[MPSC_PRODUCERS] = {0};
+  int received = 0, in_order = 1;
+  llfifo_mpsc_t *fifo = llfifo_mpsc_create();
+  test_assert(fifo != NULL);
+
+  // Single threaded first
+  test_equal(llfifo_mpsc_pop(fifo), NULL);
+  llfifo_mpsc_push(fifo, &items[0][0].link);
+  llfifo_mpsc_push(fifo, &items[0][1].link);
+  test_equal(llfifo_entry(llfifo_mpsc_pop(fifo), mpsc_item_t, link), &items[0][0]);
+  llfifo_mpsc_push(fifo, &items[0][2].link);
+  test_equal(llfifo_mpsc_pop(fifo), &items[0][1].link);
+  test_equal(llfifo_mpsc_pop(fifo), &items[0][2].link);
+  test_equal(llfifo_mpsc_pop(fifo), NULL);
+
+  for (int p=0; p<MPSC_PRODUCERS; p++) {
+    for (int i=0; i<MPSC_ITEMS; i++) {
+      items[p][i].producer = p;
+      items[p][i].seq = i;
+    }
+    args[p].fifo = fifo;
+    args[p].items = items[p];
+    pthread_create(&threads[p], NULL, mpsc_producer, &args[p]);
+  }
+
+  while (received < MPSC_PRODUCERS * MPSC_ITEMS) {
+    llfifo_link_t *link = llfifo_mpsc_pop(fifo);
+    if (link == NULL) {
+      sched_yield();
+      continue;
+    }
+    mpsc_item_t *item = llfifo_entry(link, mpsc_item_t, link);
+    if (item->seq != next_seq[item->producer]++)
+      in_order = 0;
+    received++;
+  }
+  for (int p=0; p<MPSC_PRODUCERS; p++)
+    pthread_join(threads[p], NULL);
+
+  test_equal(in_order, 1);
+  test_equal(llfifo_mpsc_pop(fifo), NULL);
+  llfifo_mpsc_destroy(fifo);
+}
+
+
+#define MPMC_THREADS  4
+#define MPMC_ITEMS    50000
+
+typedef struct {
+  llfifo_t *fifo;
+  int id;
+  long received;
+  int in_order;
+} mpmc_arg_t;
+
+static _Atomic long mpmc_received;
+
+// Element i of producer p, never NULL
+#define MPMC_ELEMENT(p, i)  ((void *)(uintptr_t)(((p) << 20) | ((i) + 1)))
+
+static void *
+mpmc_producer(void *p)
+{
+  mpmc_arg_t *arg = (mpmc_arg_t *)p;
+  for (int i=0; i<MPMC_ITEMS; i++)
+    while (llfifo_enqueue(arg->fifo, MPMC_ELEMENT(arg->id, i)) != 1)
+      sched_yield();
+  return NULL;
+}
+
+static void *
+mpmc_consumer(void *p)
+{
+  mpmc_arg_t *arg = (mpmc_arg_t *)p;
+  int last[MPMC_THREADS] = {0};
+  while (atomic_load(&mpmc_received) < MPMC_THREADS * MPMC_ITEMS) {
+    uintptr_t e = (uintptr_t)llfifo_dequeue(arg->fifo);
+    if (e == 0) {
+      sched_yield();
+      continue;
+    }
+    // Each consumer must see each producer's elements in order
+    int producer = e >> 20, seq = e & 0xfffff;
+    if (producer >= MPMC_THREADS || seq <= last[producer])
+      arg->in_order = 0;
+    else
+      last[producer] = seq;
+    arg->received++;
+    atomic_fetch_add(&mpmc_received, 1);
+  }
+  return NULL;
+}
+
+/*
+ * Stress test for LLFIFO_MPMC: several producers and consumers share
+ * one fifo, and every element must come out exactly once, in order per
+ * producer, with nodes being recycled rather than piling up
+ */
+static void
+test_llfifo_mpmc()
+{
+  mpmc_arg_t producers[MPMC_THREADS], consumers[MPMC_THREADS];
+  pthread_t threads[2 * MPMC_THREADS];
+  char a, b;
+  llfifo_t *fifo = llfifo_create_ex(4, LLFIFO_MPMC);
+  test_assert(fifo != NULL);
+
+  test_equal(llfifo_capacity(fifo), 4);
+  test_equal(llfifo_dequeue(fifo), NULL);
+  test_equal(llfifo_enqueue(fifo, &a), 1);
+  test_equal(llfifo_enqueue(fifo, &b), 1);
+  test_equal(llfifo_length(fifo), 2);
+  test_equal(llfifo_dequeue(fifo), &a);
+  test_equal(llfifo_dequeue(fifo), &b);
+  test_equal(llfifo_dequeue(fifo), NULL);
+  test_equal(llfifo_length(fifo), 0);
+  test_equal(llfifo_shrink(fifo, 0), -1);
+
+  atomic_store(&mpmc_received, 0);
+  for (int t=0; t<MPMC_THREADS; t++) {
+    mpmc_arg_t arg = { fifo, t, 0, 1 };
+    producers[t] = consumers[t] = arg;
+    pthread_create(&threads[t], NULL, mpmc_consumer, &consumers[t]);
+    pthread_create(&threads[MPMC_THREADS + t], NULL, mpmc_producer, &producers[t]);
+  }
+  for (int t=0; t<2*MPMC_THREADS; t++)
+    pthread_join(threads[t], NULL);
+
+  long received = 0;
+  int in_order = 1;
+  for (int t=0; t<MPMC_THREADS; t++) {
+    received += consumers[t].received;
+    in_order &= consumers[t].in_order;
+  }
+  test_equal(received, MPMC_THREADS * MPMC_ITEMS);
+  test_equal(in_order, 1);
+  test_equal(llfifo_dequeue(fifo), NULL);
+  test_equal(llfifo_length(fifo), 0);
+  test_assert(llfifo_capacity(fifo) < MPMC_THREADS * MPMC_ITEMS / 2);
+
+  llfifo_destroy(fifo);
+}
+
+
+typedef struct {
+  int id;
+  llfifo_link_t link;
+} packet_t;
+
+/*
+ * Queues structs through their own llfifo_link_t, with the link in
+ * the middle of the struct and at its start
+ */
+static void
+test_llfifo_intrusive()
+{
+  packet_t packets[100];
+  void *out[100];
+  const int n = sizeof(packets) / sizeof(packets[0]);
+  llfifo_t *fifo = llfifo_create_intrusive(offsetof(packet_t, link));
+  llfifo_t *front = llfifo_create_ex(0, LLFIFO_INTRUSIVE);
+  llfifo_chain_t chain;
+  test_assert(fifo != NULL && front != NULL);
+
+  for (int i=0; i<n; i++)
+    packets[i].id = i;
+
+  test_equal(llfifo_capacity(fifo), 0);
+  test_equal(llfifo_dequeue(fifo), NULL);
+  test_equal(llfifo_enqueue(fifo, NULL), -1);
+  for (int i=0; i<n; i++)
+    test_equal(llfifo_enqueue(fifo, &packets[i]), i+1);
+  test_equal(llfifo_capacity(fifo), n);
+  for (int i=0; i<n/2; i++) {
+    packet_t *p = (packet_t *)llfifo_dequeue(fifo);
+    test_equal(p, &packets[i]);
+    test_equal(p->id, i);
+  }
+
+  // Move the rest over to a fifo with the link at offset 0
+  test_equal(llfifo_dequeue_many(fifo, out, n), n/2);
+  test_equal(llfifo_length(fifo), 0);
+  test_equal(llfifo_capacity(fifo), n);
+  test_equal(llfifo_enqueue_many(front, (void **)out, n/2), n/2);
+  test_equal(llfifo_dequeue(front), &packets[n/2]);
+  test_equal(llfifo_dequeue_all(front, &chain), -1);
+  for (int i=n/2+1; i<n; i++)
+    test_equal(llfifo_dequeue(front), &packets[i]);
+  test_equal(llfifo_dequeue(front), NULL);
+
+  // An element can be requeued once dequeued
+  test_equal(llfifo_enqueue(fifo, &packets[3]), 1);
+  test_equal(llfifo_enqueue(fifo, &packets[1]), 2);
+  test_equal(llfifo_dequeue(fifo), &packets[3]);
+  test_equal(llfifo_enqueue(fifo, &packets[3]), 2);
+  test_equal(llfifo_dequeue(fifo), &packets[1]);
+  test_equal(llfifo_dequeue(fifo), &packets[3]);
+  test_equal(llfifo_shrink(fifo, 0), 0);
+
+  llfifo_destroy(fifo);
+  llfifo_destroy(front);
+}
+
+
 void test_llfifo()
 {
   g_tests_passed = 0;
   g_tests_total = 0;
   g_skip_tests = 0;
   
-  test_llfifo_one_iteration(0);
-  g_skip_tests = 0;
+  // The block-based FIFO, then the LLFIFO_ARRAY one
+  for (unsigned flags = 0; flags <= LLFIFO_ARRAY; flags += LLFIFO_ARRAY) {
+    test_llfifo_one_iteration(0, flags);
+    g_skip_tests = 0;
   
-  test_llfifo_one_iteration(5);
+    test_llfifo_one_iteration(5, flags);
+    g_skip_tests = 0;
+
+    test_llfifo_one_iteration(20, flags);
+    g_skip_tests = 0;
+
+    test_llfifo_deep(0, flags);
+    g_skip_tests = 0;
+
+    test_llfifo_deep(100, flags);
+    g_skip_tests = 0;
+
+    test_llfifo_shrink(flags);
+    g_skip_tests = 0;
+
+    test_llfifo_batch(flags);
+    g_skip_tests = 0;
+  }
+
+  test_equal(llfifo_create_ex(0, LLFIFO_ARRAY | LLFIFO_MPMC), NULL);
+  test_equal(llfifo_create_ex(0, LLFIFO_ARRAY | LLFIFO_INTRUSIVE), NULL);
+  test_equal(llfifo_create_ex(0, LLFIFO_INTRUSIVE | LLFIFO_MPMC), NULL);
+  g_skip_tests = 0;
+
+  test_llfifo_mpsc();
+  g_skip_tests = 0;
+
+  test_llfifo_mpmc();
   g_skip_tests = 0;
 
-  test_llfifo_one_iteration(20);
+  test_llfifo_intrusive();
   g_skip_tests = 0;
 
   printf("%s: passed %d/%d test cases (%2.1f%%)\n", __FUNCTION__,
@@ -0,0 +1,232 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file test_mpmcfifo.c
+ * @brief Tests for the bounded multi-producer, multi-consumer FIFO in
+ * mpmcfifo.c
+ * 
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "test_mpmcfifo.h"
+#include "mpmcfifo.h"
+
+/*
+ * Reports one check of a sequence-style test, in the same format as the
+ * cbfifo tests.
+ */
+static int mp_tests_passed;
+static int mp_tests_total;
+
+static void mp_check(const char *what, long act_res, long expected_res)
+{
+  char *test_result;
+
+  mp_tests_total++;
+  if (act_res == expected_res) {
+    test_result = "PASSED";
+    mp_tests_passed++;
+  } else {
+    test_result = "FAILED";
+  }
+  printf("\n  %s: %s returned %ld expected %ld ", test_result,
+      what, act_res, expected_res);
+}
+
+static void mp_check_begin()
+{
+  mp_tests_passed = 0;
+  mp_tests_total = 0;
+}
+
+static int mp_check_end(const char *name)
+{
+  printf("\n %s: PASSED %d/%d\n", name, mp_tests_passed, mp_tests_total);
+  return (mp_tests_passed == mp_tests_total);
+}
+
+
+int test_mpmcfifo_basic()
+{ 
+  int values[10];
+  int in_order = 1;
+  mpmcfifo_t *fifo = mpmcfifo_create(5);
+
+  mp_check_begin();
+  mp_check("mpmcfifo_create(0) == NULL", mpmcfifo_create(0) == NULL, 1);
+  mp_check("mpmcfifo_create(-1) == NULL", mpmcfifo_create(-1) == NULL, 1);
+  mp_check("mpmcfifo_create(5) != NULL", fifo != NULL, 1);
+  if (fifo == NULL)
+    return mp_check_end(__FUNCTION__);
+
+  mp_check("mpmcfifo_capacity(fifo)", mpmcfifo_capacity(fifo), 8);
+  mp_check("mpmcfifo_length(fifo)", mpmcfifo_length(fifo), 0);
+  mp_check("mpmcfifo_dequeue(fifo) == NULL", mpmcfifo_dequeue(fifo) == NULL, 1);
+  mp_check("mpmcfifo_enqueue(fifo, NULL)", mpmcfifo_enqueue(fifo, NULL), -1);
+
+  for (int i = 0; i < 8; i++)
+    mp_check("mpmcfifo_enqueue(fifo, &values[i])", mpmcfifo_enqueue(fifo, &values[i]), i + 1);
+  mp_check("mpmcfifo_enqueue(fifo) when full", mpmcfifo_enqueue(fifo, &values[8]), -1);
+  mp_check("mpmcfifo_length(fifo)", mpmcfifo_length(fifo), 8);
+
+  // Go round the ring a few times, keeping it half full
+  for (int i = 0; i < 4; i++)
+    if (mpmcfifo_dequeue(fifo) != &values[i])
+      in_order = 0;
+  for (int lap = 0; lap < 20; lap++) {
+    for (int i = 0; i < 4; i++)
+      mpmcfifo_enqueue(fifo, &values[i]);
+    for (int i = 0; i < 4; i++)
+      if (mpmcfifo_dequeue(fifo) != &values[(lap == 0) ? 4 + i : i])
+        in_order = 0;
+  }
+  mp_check("elements dequeued in order", in_order, 1);
+  mp_check("mpmcfifo_length(fifo)", mpmcfifo_length(fifo), 4);
+
+  mpmcfifo_destroy(fifo);
+  mpmcfifo_destroy(NULL);
+  return mp_check_end(__FUNCTION__);
+}
+
+
+#define MPMC_TEST_THREADS 4
+#define MPMC_TEST_ITEMS   50000
+
+typedef struct {
+  mpmcfifo_t *fifo;
+  int id;
+  long sum;
+  long count;
+  int in_order;
+} mpmc_worker_t;
+
+// Producer thread: enqueues id * MPMC_TEST_ITEMS + 1 .. (id + 1) * MPMC_TEST_ITEMS
+static void *mpmc_producer(void *arg)
+{
+  mpmc_worker_t *w = (mpmc_worker_t *)arg;
+  long base = (long)w->id * MPMC_TEST_ITEMS;
+
+  for (long i = 1; i <= MPMC_TEST_ITEMS; i++) {
+    if ((i & 1) == 0) {
+      while (mpmcfifo_enqueue(w->fifo, (void *)(base + i)) < 0)
+        sched_yield();
+    } else if (mpmcfifo_enqueue_wait(w->fifo, (void *)(base + i), -1) < 0) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Consumer thread: dequeues until its share has arrived, checking that
+// each producer's elements come out in the order they went in
+static void *mpmc_consumer(void *arg)
+{
+  mpmc_worker_t *w = (mpmc_worker_t *)arg;
+  long last[MPMC_TEST_THREADS] = { 0 };
+
+  w->in_order = 1;
+  while (w->count < MPMC_TEST_ITEMS) {
+    void *element = mpmcfifo_dequeue_wait(w->fifo, 1000000);
+    if (element == NULL)
+      break;
+    long v = (long)element;
+    int producer = (int)((v - 1) / MPMC_TEST_ITEMS);
+    if (v <= last[producer])
+      w->in_order = 0;
+    last[producer] = v;
+    w->sum += v;
+    w->count++;
+  }
+  return NULL;
+}
+
+
+int test_mpmcfifo_threads()
+{ 
+  pthread_t threads[2 * MPMC_TEST_THREADS];
+  mpmc_worker_t workers[2 * MPMC_TEST_THREADS] = { 0 };
+  mpmcfifo_t *fifo = mpmcfifo_create(64);
+  long total = 0, count = 0;
+  int in_order = 1;
+
+  mp_check_begin();
+  mp_check("mpmcfifo_create(64) != NULL", fifo != NULL, 1);
+  if (fifo == NULL)
+    return mp_check_end(__FUNCTION__);
+
+  for (int i = 0; i < 2 * MPMC_TEST_THREADS; i++) {
+    workers[i].fifo = fifo;
+    workers[i].id = i % MPMC_TEST_THREADS;
+    pthread_create(&threads[i], NULL,
+        (i < MPMC_TEST_THREADS) ? mpmc_producer : mpmc_consumer, &workers[i]);
+  }
+  for (int i = 0; i < 2 * MPMC_TEST_THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  for (int i = MPMC_TEST_THREADS; i < 2 * MPMC_TEST_THREADS; i++) {
+    total += workers[i].sum;
+    count += workers[i].count;
+    in_order &= workers[i].in_order;
+  }
+  long n = (long)MPMC_TEST_THREADS * MPMC_TEST_ITEMS;
+  mp_check("elements received", count, n);
+  mp_check("sum of elements received", total, n * (n + 1) / 2);
+  mp_check("each producer's elements in order", in_order, 1);
+  mp_check("mpmcfifo_length(fifo)", mpmcfifo_length(fifo), 0);
+
+  mpmcfifo_destroy(fifo);
+  return mp_check_end(__FUNCTION__);
+}
+
+
+int test_mpmcfifo_wait()
+{ 
+  int value;
+  struct timespec start, end;
+  mpmcfifo_t *fifo = mpmcfifo_create(2);
+
+  mp_check_begin();
+  mp_check("mpmcfifo_create(2) != NULL", fifo != NULL, 1);
+  if (fifo == NULL)
+    return mp_check_end(__FUNCTION__);
+
+  // Nothing arrives, so this must time out after about 2ms
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  mp_check("mpmcfifo_dequeue_wait(fifo, 2000) == NULL", mpmcfifo_dequeue_wait(fifo, 2000) == NULL, 1);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long waited_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+  mp_check("waited at least 2000us", waited_us >= 2000, 1);
+
+  mp_check("mpmcfifo_enqueue_wait(fifo, NULL)", mpmcfifo_enqueue_wait(fifo, NULL, 0), -1);
+  mp_check("mpmcfifo_enqueue_wait(fifo, 0)", mpmcfifo_enqueue_wait(fifo, &value, 0), 1);
+  mp_check("mpmcfifo_enqueue_wait(fifo, 0)", mpmcfifo_enqueue_wait(fifo, &value, 0), 2);
+  mp_check("mpmcfifo_enqueue_wait(fifo, 1000) when full", mpmcfifo_enqueue_wait(fifo, &value, 1000), -1);
+  mp_check("mpmcfifo_dequeue_wait(fifo, 0)", mpmcfifo_dequeue_wait(fifo, 0) == &value, 1);
+  mp_check("mpmcfifo_length(fifo)", mpmcfifo_length(fifo), 1);
+
+  mpmcfifo_destroy(fifo);
+  return mp_check_end(__FUNCTION__);
+}
+
+
+int test_mpmcfifo()
+{
+    int pass = 1;
+    pass &= test_mpmcfifo_basic();
+    pass &= test_mpmcfifo_threads();
+    pass &= test_mpmcfifo_wait();
+    return pass;
+}
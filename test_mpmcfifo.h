@@ -0,0 +1,13 @@
+/*
+ * test_mpmcfifo.h - tests for mpmcfifo
+ * 
+ * Author: Arpit Savarkar, (arpit.savarkar@colorado.edu)
+ * 
+ */
+
+#ifndef _TEST_MPMCFIFO_H_
+#define _TEST_MPMCFIFO_H_
+
+int test_mpmcfifo();
+
+#endif // _TEST_MPMCFIFO_H_
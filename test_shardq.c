@@ -0,0 +1,262 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file test_shardq.c
+ * @brief Tests for the per-core sharded queue in shardq.c
+ * 
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "test_shardq.h"
+#include "shardq.h"
+
+/*
+ * Reports one check of a sequence-style test, in the same format as the
+ * cbfifo tests.
+ */
+static int sq_tests_passed;
+static int sq_tests_total;
+
+static void sq_check(const char *what, long act_res, long expected_res)
+{
+  char *test_result;
+
+  sq_tests_total++;
+  if (act_res == expected_res) {
+    test_result = "PASSED";
+    sq_tests_passed++;
+  } else {
+    test_result = "FAILED";
+  }
+  printf("\n  %s: %s returned %ld expected %ld ", test_result,
+      what, act_res, expected_res);
+}
+
+static void sq_check_begin()
+{
+  sq_tests_passed = 0;
+  sq_tests_total = 0;
+}
+
+static int sq_check_end(const char *name)
+{
+  printf("\n %s: PASSED %d/%d\n", name, sq_tests_passed, sq_tests_total);
+  return (sq_tests_passed == sq_tests_total);
+}
+
+
+int test_shardq_basic()
+{ 
+  int values[10];
+  int in_order = 1;
+  shardq_t *q = shardq_create(4, 2);
+  shardq_t *per_cpu = shardq_create(0, 0);
+
+  sq_check_begin();
+  sq_check("shardq_create(-1, 0) == NULL", shardq_create(-1, 0) == NULL, 1);
+  sq_check("shardq_create(4, 2) != NULL", q != NULL, 1);
+  sq_check("shardq_create(0, 0) != NULL", per_cpu != NULL, 1);
+  if (q == NULL || per_cpu == NULL)
+    return sq_check_end(__FUNCTION__);
+
+  sq_check("shardq_shards(per_cpu)", shardq_shards(per_cpu), sysconf(_SC_NPROCESSORS_ONLN));
+  sq_check("shardq_shards(q)", shardq_shards(q), 4);
+  sq_check("shardq_capacity(q)", shardq_capacity(q), 8);
+  sq_check("shardq_length(q)", shardq_length(q), 0);
+  sq_check("shardq_dequeue(q) == NULL", shardq_dequeue(q) == NULL, 1);
+  sq_check("0 <= shardq_self(q) < 4", shardq_self(q) >= 0 && shardq_self(q) < 4, 1);
+  sq_check("shardq_enqueue_to(q, 4)", shardq_enqueue_to(q, 4, &values[0]), -1);
+  sq_check("shardq_dequeue_from(q, -1) == NULL", shardq_dequeue_from(q, -1) == NULL, 1);
+
+  // Two elements on each shard, first in first out per shard
+  for (int i = 0; i < 8; i++)
+    sq_check("shardq_enqueue_to(q, i % 4)", shardq_enqueue_to(q, i % 4, &values[i]), i / 4 + 1);
+  sq_check("shardq_length(q)", shardq_length(q), 8);
+  for (int i = 0; i < 8; i++)
+    if (shardq_dequeue_from(q, i % 4) != &values[i])
+      in_order = 0;
+  sq_check("each shard in order", in_order, 1);
+  sq_check("shardq_dequeue_from(q, 2) == NULL", shardq_dequeue_from(q, 2) == NULL, 1);
+
+  // An element on someone else's shard is still found
+  int other = (shardq_self(q) + 2) % 4;
+  sq_check("shardq_enqueue_to(q, other)", shardq_enqueue_to(q, other, &values[9]), 1);
+  sq_check("shardq_dequeue(q) steals", shardq_dequeue(q) == &values[9], 1);
+
+  // Own shard first
+  sq_check("shardq_enqueue(q)", shardq_enqueue(q, &values[1]), 1);
+  sq_check("shardq_dequeue(q)", shardq_dequeue(q) == &values[1], 1);
+  sq_check("shardq_length(q)", shardq_length(q), 0);
+
+  // Growing a shard shows in the total capacity
+  for (int i = 0; i < 10; i++)
+    shardq_enqueue_to(q, 1, &values[i]);
+  sq_check("shardq_capacity(q)", shardq_capacity(q), 16);
+  sq_check("shardq_length(q)", shardq_length(q), 10);
+
+  shardq_destroy(q);
+  shardq_destroy(per_cpu);
+  shardq_destroy(NULL);
+  return sq_check_end(__FUNCTION__);
+}
+
+
+#define SHARDQ_TEST_THREADS 4
+#define SHARDQ_TEST_ITEMS   20000
+
+typedef struct {
+  shardq_t *q;
+  int id;
+  long sum;
+  long count;
+  int in_order;
+  _Atomic long *left;
+} shardq_worker_t;
+
+// Producer thread: enqueues id * SHARDQ_TEST_ITEMS + 1 .. (id + 1) *
+// SHARDQ_TEST_ITEMS onto shard id
+static void *shardq_producer(void *arg)
+{
+  shardq_worker_t *w = (shardq_worker_t *)arg;
+  long base = (long)w->id * SHARDQ_TEST_ITEMS;
+
+  for (long i = 1; i <= SHARDQ_TEST_ITEMS; i++)
+    shardq_enqueue_to(w->q, w->id, (void *)(base + i));
+  return NULL;
+}
+
+// Consumer thread: dequeues from any shard until everything has been
+// taken, checking that each shard's elements come out in order
+static void *shardq_consumer(void *arg)
+{
+  shardq_worker_t *w = (shardq_worker_t *)arg;
+  long last[SHARDQ_TEST_THREADS] = { 0 };
+
+  w->in_order = 1;
+  while (atomic_load(w->left) > 0) {
+    void *element = shardq_dequeue(w->q);
+    if (element == NULL) {
+      sched_yield();
+      continue;
+    }
+    atomic_fetch_sub(w->left, 1);
+    long v = (long)element;
+    int shard = (int)((v - 1) / SHARDQ_TEST_ITEMS);
+    if (v <= last[shard])
+      w->in_order = 0;
+    last[shard] = v;
+    w->sum += v;
+    w->count++;
+  }
+  return NULL;
+}
+
+// Worker thread: enqueues its share on its own core's shard, and
+// dequeues whatever it finds, as a pool of workers would
+static void *shardq_mixed(void *arg)
+{
+  shardq_worker_t *w = (shardq_worker_t *)arg;
+  long base = (long)w->id * SHARDQ_TEST_ITEMS;
+
+  for (long i = 1; i <= SHARDQ_TEST_ITEMS; i++) {
+    shardq_enqueue(w->q, (void *)(base + i));
+    if (i % 2 == 0) {
+      void *element = shardq_dequeue(w->q);
+      if (element) {
+        atomic_fetch_sub(w->left, 1);
+        w->sum += (long)element;
+        w->count++;
+      }
+    }
+  }
+  while (atomic_load(w->left) > 0) {
+    void *element = shardq_dequeue(w->q);
+    if (element == NULL) {
+      sched_yield();
+      continue;
+    }
+    atomic_fetch_sub(w->left, 1);
+    w->sum += (long)element;
+    w->count++;
+  }
+  return NULL;
+}
+
+
+int test_shardq_threads()
+{ 
+  pthread_t threads[2 * SHARDQ_TEST_THREADS];
+  shardq_worker_t workers[2 * SHARDQ_TEST_THREADS] = { 0 };
+  shardq_t *q = shardq_create(SHARDQ_TEST_THREADS, 16);
+  const long n = (long)SHARDQ_TEST_THREADS * SHARDQ_TEST_ITEMS;
+  _Atomic long left = n;
+  long total = 0, count = 0;
+  int in_order = 1;
+
+  sq_check_begin();
+  sq_check("shardq_create(4, 16) != NULL", q != NULL, 1);
+  if (q == NULL)
+    return sq_check_end(__FUNCTION__);
+
+  // One producer per shard, consumers stealing from all of them
+  for (int i = 0; i < 2 * SHARDQ_TEST_THREADS; i++) {
+    workers[i].q = q;
+    workers[i].id = i % SHARDQ_TEST_THREADS;
+    workers[i].left = &left;
+    pthread_create(&threads[i], NULL,
+        (i < SHARDQ_TEST_THREADS) ? shardq_producer : shardq_consumer, &workers[i]);
+  }
+  for (int i = 0; i < 2 * SHARDQ_TEST_THREADS; i++)
+    pthread_join(threads[i], NULL);
+  for (int i = SHARDQ_TEST_THREADS; i < 2 * SHARDQ_TEST_THREADS; i++) {
+    total += workers[i].sum;
+    count += workers[i].count;
+    in_order &= workers[i].in_order;
+  }
+  sq_check("elements received", count, n);
+  sq_check("sum of elements received", total, n * (n + 1) / 2);
+  sq_check("each shard's elements in order", in_order, 1);
+  sq_check("shardq_length(q)", shardq_length(q), 0);
+
+  // Every thread both enqueues and dequeues
+  atomic_store(&left, n);
+  total = count = 0;
+  for (int i = 0; i < SHARDQ_TEST_THREADS; i++) {
+    workers[i].sum = workers[i].count = 0;
+    pthread_create(&threads[i], NULL, shardq_mixed, &workers[i]);
+  }
+  for (int i = 0; i < SHARDQ_TEST_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    total += workers[i].sum;
+    count += workers[i].count;
+  }
+  sq_check("elements received", count, n);
+  sq_check("sum of elements received", total, n * (n + 1) / 2);
+  sq_check("shardq_length(q)", shardq_length(q), 0);
+
+  shardq_destroy(q);
+  return sq_check_end(__FUNCTION__);
+}
+
+
+int test_shardq()
+{
+    int pass = 1;
+    pass &= test_shardq_basic();
+    pass &= test_shardq_threads();
+    return pass;
+}
@@ -0,0 +1,13 @@
+/*
+ * test_shardq.h - tests for shardq
+ * 
+ * Author: Arpit Savarkar, (arpit.savarkar@colorado.edu)
+ * 
+ */
+
+#ifndef _TEST_SHARDQ_H_
+#define _TEST_SHARDQ_H_
+
+int test_shardq();
+
+#endif // _TEST_SHARDQ_H_
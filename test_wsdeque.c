@@ -0,0 +1,285 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file test_wsdeque.c
+ * @brief Tests for the work-stealing deque in wsdeque.c and the
+ * executor built on it in executor.c
+ * 
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "test_wsdeque.h"
+#include "wsdeque.h"
+#include "executor.h"
+
+/*
+ * Reports one check of a sequence-style test, in the same format as the
+ * cbfifo tests.
+ */
+static int ws_tests_passed;
+static int ws_tests_total;
+
+static void ws_check(const char *what, long act_res, long expected_res)
+{
+  char *test_result;
+
+  ws_tests_total++;
+  if (act_res == expected_res) {
+    test_result = "PASSED";
+    ws_tests_passed++;
+  } else {
+    test_result = "FAILED";
+  }
+  printf("\n  %s: %s returned %ld expected %ld ", test_result,
+      what, act_res, expected_res);
+}
+
+static void ws_check_begin()
+{
+  ws_tests_passed = 0;
+  ws_tests_total = 0;
+}
+
+static int ws_check_end(const char *name)
+{
+  printf("\n %s: PASSED %d/%d\n", name, ws_tests_passed, ws_tests_total);
+  return (ws_tests_passed == ws_tests_total);
+}
+
+
+int test_wsdeque_basic()
+{ 
+  static char items[1000];
+  const int n = sizeof(items);
+  int in_order = 1;
+  wsdeque_t *dq = wsdeque_create(3);
+
+  ws_check_begin();
+  ws_check("wsdeque_create(-1) == NULL", wsdeque_create(-1) == NULL, 1);
+  ws_check("wsdeque_create(3) != NULL", dq != NULL, 1);
+  if (dq == NULL)
+    return ws_check_end(__FUNCTION__);
+
+  ws_check("wsdeque_capacity(dq)", wsdeque_capacity(dq), 4);
+  ws_check("wsdeque_pop(dq) == NULL", wsdeque_pop(dq) == NULL, 1);
+  ws_check("wsdeque_steal(dq) == NULL", wsdeque_steal(dq) == NULL, 1);
+  ws_check("wsdeque_push(dq, NULL)", wsdeque_push(dq, NULL), -1);
+
+  // The owner gets the newest, a thief the oldest
+  ws_check("wsdeque_push(dq, &items[0])", wsdeque_push(dq, &items[0]), 1);
+  ws_check("wsdeque_push(dq, &items[1])", wsdeque_push(dq, &items[1]), 2);
+  ws_check("wsdeque_push(dq, &items[2])", wsdeque_push(dq, &items[2]), 3);
+  ws_check("wsdeque_pop(dq)", wsdeque_pop(dq) == &items[2], 1);
+  ws_check("wsdeque_steal(dq)", wsdeque_steal(dq) == &items[0], 1);
+  ws_check("wsdeque_length(dq)", wsdeque_length(dq), 1);
+  ws_check("wsdeque_pop(dq)", wsdeque_pop(dq) == &items[1], 1);
+  ws_check("wsdeque_pop(dq) == NULL", wsdeque_pop(dq) == NULL, 1);
+  ws_check("wsdeque_length(dq)", wsdeque_length(dq), 0);
+
+  // Grow with the elements wrapped round the array
+  wsdeque_push(dq, &items[0]);
+  wsdeque_push(dq, &items[1]);
+  wsdeque_steal(dq);
+  wsdeque_steal(dq);
+  for (int i = 0; i < n; i++)
+    if (wsdeque_push(dq, &items[i]) != i + 1)
+      in_order = 0;
+  ws_check("wsdeque_capacity(dq)", wsdeque_capacity(dq), 1024);
+  for (int i = 0; i < n / 2; i++)
+    if (wsdeque_steal(dq) != &items[i])
+      in_order = 0;
+  for (int i = n - 1; i >= n / 2; i--)
+    if (wsdeque_pop(dq) != &items[i])
+      in_order = 0;
+  ws_check("elements taken in order", in_order, 1);
+  ws_check("wsdeque_length(dq)", wsdeque_length(dq), 0);
+
+  wsdeque_destroy(dq);
+  wsdeque_destroy(NULL);
+  return ws_check_end(__FUNCTION__);
+}
+
+
+#define WSDEQUE_THIEVES  3
+#define WSDEQUE_ITEMS    100000
+
+typedef struct {
+  wsdeque_t *dq;
+  _Atomic unsigned char *seen;
+  _Atomic int *done;
+  long taken;
+} thief_t;
+
+static void *wsdeque_thief(void *arg)
+{
+  thief_t *t = (thief_t *)arg;
+  for (;;) {
+    long *item = (long *)wsdeque_steal(t->dq);
+    if (item) {
+      atomic_fetch_add(&t->seen[*item], 1);
+      t->taken++;
+    } else if (atomic_load(t->done)) {
+      break;
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+
+int test_wsdeque_threads()
+{ 
+  static long items[WSDEQUE_ITEMS];
+  static _Atomic unsigned char seen[WSDEQUE_ITEMS];
+  pthread_t threads[WSDEQUE_THIEVES];
+  thief_t thieves[WSDEQUE_THIEVES];
+  _Atomic int done = 0;
+  wsdeque_t *dq = wsdeque_create(16);
+  long taken = 0;
+  int once = 1;
+
+  ws_check_begin();
+  ws_check("wsdeque_create(16) != NULL", dq != NULL, 1);
+  if (dq == NULL)
+    return ws_check_end(__FUNCTION__);
+
+  for (int i = 0; i < WSDEQUE_THIEVES; i++) {
+    thieves[i].dq = dq;
+    thieves[i].seen = seen;
+    thieves[i].done = &done;
+    thieves[i].taken = 0;
+    pthread_create(&threads[i], NULL, wsdeque_thief, &thieves[i]);
+  }
+
+  // The owner pushes in bursts and pops about half back, racing the
+  // thieves for the last elements
+  for (long i = 0; i < WSDEQUE_ITEMS; i++) {
+    items[i] = i;
+    wsdeque_push(dq, &items[i]);
+    if (i % 3 == 2) {
+      for (int j = 0; j < 2; j++) {
+        long *item = (long *)wsdeque_pop(dq);
+        if (item) {
+          atomic_fetch_add(&seen[*item], 1);
+          taken++;
+        }
+      }
+    }
+  }
+  long *item;
+  while ((item = (long *)wsdeque_pop(dq)) != NULL) {
+    atomic_fetch_add(&seen[*item], 1);
+    taken++;
+  }
+  atomic_store(&done, 1);
+  for (int i = 0; i < WSDEQUE_THIEVES; i++) {
+    pthread_join(threads[i], NULL);
+    taken += thieves[i].taken;
+  }
+
+  for (long i = 0; i < WSDEQUE_ITEMS; i++)
+    if (seen[i] != 1)
+      once = 0;
+  ws_check("elements taken", taken, WSDEQUE_ITEMS);
+  ws_check("each element taken once", once, 1);
+
+  wsdeque_destroy(dq);
+  return ws_check_end(__FUNCTION__);
+}
+
+
+typedef struct {
+  executor_t *exec;
+  _Atomic long *count;
+  int depth;
+  int heap;
+} spawn_t;
+
+// Task: counts itself, then submits two children until depth runs out
+static void spawn_task(void *arg)
+{
+  spawn_t *s = (spawn_t *)arg;
+  atomic_fetch_add(s->count, 1);
+  for (int i = 0; i < 2 && s->depth > 0; i++) {
+    spawn_t *child = (spawn_t *)malloc(sizeof(spawn_t));
+    *child = *s;
+    child->depth--;
+    child->heap = 1;
+    executor_submit(s->exec, spawn_task, child);
+  }
+  if (s->heap)
+    free(s);
+}
+
+static void count_task(void *arg)
+{
+  atomic_fetch_add((_Atomic long *)arg, 1);
+}
+
+
+int test_executor()
+{ 
+  _Atomic long count = 0;
+  executor_t *exec = executor_create(4);
+  executor_t *per_cpu = executor_create(0);
+
+  ws_check_begin();
+  ws_check("executor_create(-1) == NULL", executor_create(-1) == NULL, 1);
+  ws_check("executor_create(4) != NULL", exec != NULL, 1);
+  ws_check("executor_create(0) != NULL", per_cpu != NULL, 1);
+  if (exec == NULL || per_cpu == NULL)
+    return ws_check_end(__FUNCTION__);
+  ws_check("executor_workers(exec)", executor_workers(exec), 4);
+  ws_check("executor_submit(exec, NULL)", executor_submit(exec, NULL, NULL), -1);
+
+  // Tasks from outside the pool
+  for (int i = 0; i < 10000; i++)
+    executor_submit(exec, count_task, &count);
+  executor_wait(exec);
+  ws_check("tasks run", atomic_load(&count), 10000);
+
+  // Nothing to wait for
+  executor_wait(exec);
+
+  // Tasks submitting tasks, spread by stealing
+  atomic_store(&count, 0);
+  spawn_t root = { exec, &count, 12, 0 };
+  executor_submit(exec, spawn_task, &root);
+  executor_wait(exec);
+  ws_check("spawned tasks run", atomic_load(&count), (1 << 13) - 1);
+
+  // Destroying waits for what is left
+  atomic_store(&count, 0);
+  for (int i = 0; i < 1000; i++)
+    executor_submit(per_cpu, count_task, &count);
+  executor_destroy(per_cpu);
+  ws_check("tasks run before destroy", atomic_load(&count), 1000);
+
+  executor_destroy(exec);
+  executor_destroy(NULL);
+  return ws_check_end(__FUNCTION__);
+}
+
+
+int test_wsdeque()
+{
+    int pass = 1;
+    pass &= test_wsdeque_basic();
+    pass &= test_wsdeque_threads();
+    pass &= test_executor();
+    return pass;
+}
@@ -0,0 +1,13 @@
+/*
+ * test_wsdeque.h - tests for wsdeque and executor
+ * 
+ * Author: Arpit Savarkar, (arpit.savarkar@colorado.edu)
+ * 
+ */
+
+#ifndef _TEST_WSDEQUE_H_
+#define _TEST_WSDEQUE_H_
+
+int test_wsdeque();
+
+#endif // _TEST_WSDEQUE_H_
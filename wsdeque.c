@@ -0,0 +1,267 @@
+/******************************************************************************
+*​​Copyright​​ (C) ​​2020 ​​by ​​Arpit Savarkar
+*​​Redistribution,​​ modification ​​or ​​use ​​of ​​this ​​software ​​in​​source​ ​or ​​binary
+*​​forms​​ is​​ permitted​​ as​​ long​​ as​​ the​​ files​​ maintain​​ this​​ copyright.​​ Users​​ are
+*​​permitted​​ to ​​modify ​​this ​​and ​​use ​​it ​​to ​​learn ​​about ​​the ​​field​​ of ​​embedded
+*​​software. ​​Arpit Savarkar ​​and​ ​the ​​University ​​of ​​Colorado ​​are ​​not​ ​liable ​​for
+*​​any ​​misuse ​​of ​​this ​​material.
+*
+******************************************************************************/ 
+/**
+ * @file wsdeque.c
+ * @brief A work-stealing deque of pointers
+ *
+ * The Chase-Lev deque, with the C11 memory orderings given by Le, Pop,
+ * Cohen and Zappa Nardelli ("Correct and Efficient Work-Stealing for
+ * Weak Memory Models", PPoPP 2013). Elements live in a circular array
+ * from index top (oldest) to bottom - 1 (newest). The owner alone moves
+ * bottom; thieves, and the owner when it takes the last element, move
+ * top with a CAS.
+ *
+ * @author Arpit Savarkar
+ * @date September 10 2020
+ * @version 1.0
+ */
+
+#include <stdatomic.h>
+
+#include "wsdeque.h"
+
+// Size of a cache line, used to keep top and bottom apart
+#define WSDEQUE_CACHELINE 64
+
+/*
+ * Circular array of size slots. When the deque grows, the old array
+ * may still be read by a thief that loaded it earlier, so it is kept
+ * on the prev list until the deque is destroyed. Each array is twice
+ * the size of the one before, so the old ones together never take
+ * more than the current one.
+ */
+typedef struct array_s {
+    long size;
+    struct array_s *prev;
+    _Atomic(void*) slot[];
+} array_t;
+
+/*
+ * Definition
+ */
+struct wsdeque_s {
+    _Alignas(WSDEQUE_CACHELINE) _Atomic long top;
+    _Alignas(WSDEQUE_CACHELINE) _Atomic long bottom;
+    _Atomic(array_t*) array;
+};
+
+
+// Helper Function to allocate an array of size slots
+static array_t *newArray(long size, array_t *prev) {
+    array_t *a = (array_t*)malloc(sizeof(array_t) + size * sizeof(void*));
+    if(a == NULL)
+        return NULL;
+    a->size = size;
+    a->prev = prev;
+    return a;
+}
+
+
+/*
+ * Initializes the deque
+ *
+ * Parameters:
+ *   capacity  the initial size of the deque, in number of elements.
+ *             Rounded up to a power of two.
+ *
+ * Returns:
+ *   A pointer to a wsdeque_t, or NULL in case of an error.
+ */
+wsdeque_t *wsdeque_create(int capacity) {
+    if(capacity < 0 || capacity > (1 << 30))
+        return NULL;
+    long size = 2;
+    while(size < capacity)
+        size <<= 1;
+
+    wsdeque_t *dq = (wsdeque_t*)aligned_alloc(WSDEQUE_CACHELINE, sizeof(wsdeque_t));
+    if(dq == NULL)
+        return NULL;
+    array_t *a = newArray(size, NULL);
+    if(a == NULL) {
+        free(dq);
+        return NULL;
+    }
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+    atomic_init(&dq->array, a);
+    return dq;
+}
+
+
+// Helper Function to double the array, copying over elements top to bottom - 1
+static array_t *grow(wsdeque_t *dq, array_t *a, long top, long bottom) {
+    array_t *bigger = newArray(2 * a->size, a);
+    if(bigger == NULL)
+        return NULL;
+    for(long i = top; i < bottom; i++) {
+        void *element = atomic_load_explicit(&a->slot[i & (a->size - 1)], memory_order_relaxed);
+        atomic_store_explicit(&bigger->slot[i & (bigger->size - 1)], element, memory_order_relaxed);
+    }
+    atomic_store_explicit(&dq->array, bigger, memory_order_release);
+    return bigger;
+}
+
+
+/*
+ * Pushes an element onto the bottom of the deque. Owner only.
+ *
+ * Parameters:
+ *   dq       The deque in question
+ *   element  The element to push, which may not be NULL
+ *
+ * Returns:
+ *   The new length of the deque on success, -1 on failure
+ */
+int wsdeque_push(wsdeque_t *dq, void *element) {
+
+    assert(dq);
+    if(element == NULL)
+        return -1;
+
+    long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    array_t *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+
+    // Full: double the array
+    if(b - t > a->size - 1) {
+        if(a->size > INT32_MAX / 2 || (a = grow(dq, a, t, b)) == NULL)
+            return -1;
+    }
+
+    atomic_store_explicit(&a->slot[b & (a->size - 1)], element, memory_order_relaxed);
+    // The element must be visible before the thieves see the new bottom.
+    // A release store does this as the paper's release fence would, and
+    // costs no more.
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_release);
+    return (int)(b + 1 - t);
+}
+
+
+/*
+ * Pops the newest element from the bottom of the deque. Owner only.
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   The element, or NULL if the deque was empty
+ */
+void *wsdeque_pop(wsdeque_t *dq) {
+
+    assert(dq);
+    long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    array_t *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+
+    // Claim the bottom element, then look at top: the fence orders the
+    // two so that a thief and the owner cannot both take it
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    if(t > b) {
+        // Was empty
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    void *element = atomic_load_explicit(&a->slot[b & (a->size - 1)], memory_order_relaxed);
+    if(t == b) {
+        // The last element: race the thieves for it through top
+        if(!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed))
+            element = NULL;
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    }
+    return element;
+}
+
+
+/*
+ * Steals the oldest element from the top of the deque. Any thread.
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   The element, or NULL if the deque was empty or another thread took
+ * the element first
+ */
+void *wsdeque_steal(wsdeque_t *dq) {
+
+    assert(dq);
+    long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+    if(t >= b)
+        return NULL;
+
+    array_t *a = atomic_load_explicit(&dq->array, memory_order_acquire);
+    void *element = atomic_load_explicit(&a->slot[t & (a->size - 1)], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+    return element;
+}
+
+
+/*
+ * Returns the number of elements on the deque, as a snapshot
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   The number of elements on the deque
+ */
+int wsdeque_length(wsdeque_t *dq) {
+    assert(dq);
+    long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+    return (b > t) ? (int)(b - t) : 0;
+}
+
+
+/*
+ * Returns the deque's current capacity
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   The number of elements the deque holds before it has to grow
+ */
+int wsdeque_capacity(wsdeque_t *dq) {
+    assert(dq);
+    return (int)atomic_load_explicit(&dq->array, memory_order_relaxed)->size;
+}
+
+
+/*
+ * Teardown function. Frees the deque. After calling this function, the
+ * deque should not be used again!
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   none
+ */
+void wsdeque_destroy(wsdeque_t *dq) {
+    if(dq == NULL)
+        return;
+    array_t *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+    while(a) {
+        array_t *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+    free(dq);
+}
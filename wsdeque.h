@@ -0,0 +1,121 @@
+/*
+ * wsdeque.h - a work-stealing deque of pointers (Chase-Lev), for one
+ * owner thread and any number of thieves
+ *
+ * Author: Arpit Savarkar, (arpit.savarkar@colorado.edu)
+ *
+ */
+
+#ifndef _WSDEQUE_H_
+#define _WSDEQUE_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+/*
+ * The wsdeque's main data structure.
+ *
+ * Defined here as an incomplete type, in order to hide the
+ * implementation from the user. A wsdeque belongs to one thread, its
+ * owner, which pushes and pops elements at the bottom, newest first.
+ * Any other thread may steal elements from the top, oldest first. The
+ * owner's calls need no atomic read-modify-write unless it is racing a
+ * thief for the last element, and the deque grows as needed.
+ */
+typedef struct wsdeque_s wsdeque_t;
+
+
+/*
+ * Initializes the deque
+ *
+ * Parameters:
+ *   capacity  the initial size of the deque, in number of elements.
+ *             Rounded up to a power of two.
+ *
+ * Returns:
+ *   A pointer to a wsdeque_t, or NULL in case of an error.
+ */
+wsdeque_t *wsdeque_create(int capacity);
+
+
+/*
+ * Pushes an element onto the bottom of the deque, growing the deque if
+ * necessary. Only the owner may call this.
+ *
+ * Parameters:
+ *   dq       The deque in question
+ *   element  The element to push, which may not be NULL
+ *
+ * Returns:
+ *   The new length of the deque on success, -1 on failure
+ */
+int wsdeque_push(wsdeque_t *dq, void *element);
+
+
+/*
+ * Pops the newest element from the bottom of the deque. Only the owner
+ * may call this.
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   The element, or NULL if the deque was empty
+ */
+void *wsdeque_pop(wsdeque_t *dq);
+
+
+/*
+ * Steals the oldest element from the top of the deque. Any thread may
+ * call this.
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   The element, or NULL if the deque was empty or another thread took
+ * the element first
+ */
+void *wsdeque_steal(wsdeque_t *dq);
+
+
+/*
+ * Returns the number of elements on the deque. While other threads are
+ * using the deque this is only a snapshot.
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   The number of elements on the deque
+ */
+int wsdeque_length(wsdeque_t *dq);
+
+
+/*
+ * Returns the deque's current capacity
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   The number of elements the deque holds before it has to grow
+ */
+int wsdeque_capacity(wsdeque_t *dq);
+
+
+/*
+ * Teardown function. Frees the deque. After calling this function, the
+ * deque should not be used again!
+ *
+ * Parameters:
+ *   dq  The deque in question
+ *
+ * Returns:
+ *   none
+ */
+void wsdeque_destroy(wsdeque_t *dq);
+
+#endif // _WSDEQUE_H_